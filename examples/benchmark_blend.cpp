@@ -33,6 +33,8 @@
 
 static int nodeCount = 4;
 static bool useTextures = false;
+static bool useOpaque = false;
+static bool useOpaquePass = false;
 
 class CreateFractalJob : public WorkQueue::Job
 {
@@ -65,9 +67,14 @@ public:
         rect2d geometry(-dim2, -dim2, dim, dim);
 
         if (useTextures)
-            cout << "creating " << nodeCount << " texture layers.." << endl;
+            cout << "creating " << nodeCount << (useOpaque ? " opaque" : "") << " texture layers.." << endl;
         else
-            cout << "creating " << nodeCount << " solid-color layers.." << endl;
+            cout << "creating " << nodeCount << (useOpaque ? " opaque" : "") << " solid-color layers.." << endl;
+
+        if (useOpaquePass) {
+            cout << "drawing opaque layers front to back.." << endl;
+            static_cast<OpenGLRenderer *>(renderer())->setOpaquePassEnabled(true);
+        }
 
         // Create the scene graph..
         Node *root = Node::create();
@@ -89,7 +96,7 @@ public:
                 workQueue()->schedule(sjob);
 
             } else {
-                *rotation << RectangleNode::create(geometry, vec4(rnd(), rnd(), rnd(), 0.5));
+                *rotation << RectangleNode::create(geometry, vec4(rnd(), rnd(), rnd(), useOpaque ? 1.0 : 0.5));
             }
             animation_rotateZ(animationManager(), rotation, 4 + i);
         }
@@ -107,7 +114,9 @@ public:
             m_pendingJobs.pop_front();
 
             CreateFractalJob *fractalJob = static_cast<CreateFractalJob *>(job.get());
-            Texture *texture = renderer()->createTextureFromImageData(fractalJob->size, Texture::RGBA_32, fractalJob->bits.data());
+            Texture *texture = renderer()->createTextureFromImageData(fractalJob->size,
+                                                                      useOpaque ? Texture::RGBx_32 : Texture::RGBA_32,
+                                                                      fractalJob->bits.data());
             fractalJob->node->setTexture(texture);
 
             cout << "update: texture for node" << fractalJob->index
@@ -142,16 +151,26 @@ int main(int argc, char **argv) {
             nodeCount = atoi(argv[++i]);
         } else if (arg == "--textures") {
             useTextures = true;
+        } else if (arg == "--opaque") {
+            useOpaque = true;
+        } else if (arg == "--opaque-pass") {
+            useOpaquePass = true;
         } else if (arg == "-h" || arg == "--help") {
             cout << "Usage: " << endl
                  << " > " << argv[0] << " [options]" << endl
                  << endl
                  << "Options:" << endl
                  << "  --count [x]      Number of layers" << endl
-                 << "  --textures       Use textures rather than solid fills" << endl;
+                 << "  --textures       Use textures rather than solid fills" << endl
+                 << "  --opaque         Make the layers opaque" << endl
+                 << "  --opaque-pass    Draw opaque layers front to back using the depth buffer" << endl;
         }
     }
 
+    // The opaque pass needs a depth buffer
+    if (useOpaquePass)
+        setenv("RENGINE_SURFACE_DEPTH_SIZE", "16", 0);
+
     RENGINE_BACKEND backend;
 
     BlendBenchWindow surface;
@@ -0,0 +1,139 @@
+/*
+    Copyright (c) 2017, Gunnar Sletta <gunnar@crimson.no>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rengine.h"
+#include "examples.h"
+
+#define  STB_TRUETYPE_IMPLEMENTATION
+#include <stb_truetype.h>
+
+static int frameCount = 50;
+static unsigned maxRadius = 128;
+static BlurNode::Quality quality = BlurNode::NormalQuality;
+
+// Renders a full screen blur for a number of frames for each radius in
+// 1, 2, 4 ... maxRadius and reports the average time spent per frame. The
+// blurred subtree is changed every frame so the layer is never cached.
+class BlurBenchWindow : public StandardSurface
+{
+public:
+    Node *build() override
+    {
+        vec2 s = size();
+        m_texture.reset(rengine_fractalTexture(renderer(), s));
+        m_blur = BlurNode::create(m_radius);
+        m_blur->setQuality(quality);
+        m_toggle = RectangleNode::create(rect2d::fromXywh(0, 0, 1, 1), vec4());
+        *m_blur
+            << TextureNode::create(rect2d::fromPosSize(vec2(), s), m_texture.get())
+            << m_toggle;
+        return &(*Node::create() << m_blur);
+    }
+
+    Node *update(Node *root) override
+    {
+        // Invalidate the blurred layer
+        m_toggle->setColor(vec4(0, 0, 0, m_frame % 2 == 0 ? 0.0f : 0.01f));
+        requestRender();
+        return root;
+    }
+
+    void onBeforeRender() override
+    {
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    void onAfterRender() override
+    {
+        // Wait for the GPU so the time includes the blur itself
+        glFinish();
+        // Skip the first frame of every radius, which compiles the kernel
+        if (m_frame > 0)
+            m_time += std::chrono::steady_clock::now() - m_start;
+
+        if (++m_frame <= frameCount)
+            return;
+
+        double ms = std::chrono::duration<double, std::milli>(m_time).count() / frameCount;
+        cout << "radius " << setw(3) << m_radius << ": " << fixed << setprecision(2) << ms << " ms/frame"
+             << ", downsampled by " << OpenGLRenderer::blurDownsampling(m_blur) << endl;
+
+        m_radius *= 2;
+        if (m_radius > maxRadius) {
+            Backend::get()->quit();
+            return;
+        }
+        m_blur->setRadius(m_radius);
+        m_frame = 0;
+        m_time = std::chrono::steady_clock::duration::zero();
+    }
+
+private:
+    std::unique_ptr<Texture> m_texture;
+    BlurNode *m_blur = nullptr;
+    RectangleNode *m_toggle = nullptr;
+    unsigned m_radius = 1;
+    int m_frame = 0;
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::steady_clock::duration m_time = std::chrono::steady_clock::duration::zero();
+};
+
+RENGINE_DEFINE_GLOBALS
+
+int main(int argc, char **argv) {
+
+    for (int i=0; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (i + 1 < argc && arg == "--frames") {
+            frameCount = std::max(1, atoi(argv[++i]));
+        } else if (i + 1 < argc && arg == "--max-radius") {
+            maxRadius = std::max(1, atoi(argv[++i]));
+        } else if (i + 1 < argc && arg == "--quality") {
+            std::string q(argv[++i]);
+            if (q == "low")
+                quality = BlurNode::LowQuality;
+            else if (q == "high")
+                quality = BlurNode::HighQuality;
+        } else if (arg == "-h" || arg == "--help") {
+            cout << "Usage: " << endl
+                 << " > " << argv[0] << " [options]" << endl
+                 << endl
+                 << "Options:" << endl
+                 << "  --frames [x]       Frames to render per radius" << endl
+                 << "  --max-radius [x]   The largest radius, starting from 1 and doubling" << endl
+                 << "  --quality [x]      low, normal or high" << endl;
+            return 0;
+        }
+    }
+
+    RENGINE_BACKEND backend;
+
+    BlurBenchWindow surface;
+    surface.show();
+
+    backend.run();
+
+    return 0;
+}
@@ -34,6 +34,8 @@ RENGINE_DEFINE_GLOBALS
 static int nodeCount = 1000;
 static bool interleaved = false;
 static bool textured = false;
+static bool instanced = false;
+static int buildThreads = 1;
 static std::vector<Texture *> texturePool;
 
 class Rectangles : public StandardSurface
@@ -55,6 +57,9 @@ public:
             }
         }
 
+        static_cast<OpenGLRenderer *>(renderer())->setInstancingEnabled(instanced);
+        static_cast<OpenGLRenderer *>(renderer())->setBuildThreadCount(buildThreads);
+
         if (root)
             root->destroy();
 
@@ -109,6 +114,10 @@ int main(int argc, char **argv) {
             interleaved = true;
         } else if (i < argc && arg == "--textured") {
             textured = true;
+        } else if (i < argc && arg == "--instanced") {
+            instanced = true;
+        } else if (i + 1 < argc && arg == "--build-threads") {
+            buildThreads = atoi(argv[++i]);
         }
     }
 
@@ -118,6 +127,8 @@ int main(int argc, char **argv) {
     std::cout << "Using " << nodeCount << " nodes..." << std::endl;
     std::cout << "  --interleaved ....: " << (interleaved ? "yes" : "no") << std::endl;
     std::cout << "  --textured .......: " << (textured ? "yes" : "no") << std::endl;
+    std::cout << "  --instanced ......: " << (instanced ? "yes" : "no") << std::endl;
+    std::cout << "  --build-threads ..: " << buildThreads << std::endl;
 
     RENGINE_ALLOCATION_POOL(RectangleNode, rengine_RectangleNode, 1024);
     RENGINE_ALLOCATION_POOL(TextureNode, rengine_TextureNode, 1024);
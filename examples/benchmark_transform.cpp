@@ -0,0 +1,114 @@
+/*
+    Copyright (c) 2017, Gunnar Sletta <gunnar@crimson.no>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rengine.h"
+
+#define  STB_TRUETYPE_IMPLEMENTATION
+#include <stb_truetype.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace rengine;
+
+RENGINE_DEFINE_GLOBALS
+
+static const int quadCount = 100000;
+static const int rounds = 100;
+
+static mat4 matrices[] = {
+    mat4::translate2D(10, 20),
+    mat4::translate2D(10, 20) * mat4::scale2D(2, 3),
+    mat4::translate2D(10, 20) * mat4::rotate2D(0.3) * mat4::scale2D(2, 3),
+};
+static const char *matrixNames[] = { "translate", "translate+scale", "affine" };
+
+// What the renderer used to do per rectangle
+static void mapQuadScalar(const mat4 &m, vec2 a, vec2 b, vec2 *v)
+{
+    v[0] = m * a;
+    v[1] = m * vec2(a.x, b.y);
+    v[2] = m * vec2(b.x, a.y);
+    v[3] = m * b;
+}
+
+static void mapQuadVector(const mat4 &m, vec2 a, vec2 b, vec2 *v)
+{
+    m.mapQuad2D(a, b, v);
+}
+
+template <typename F>
+static double bench(const mat4 &m, const std::vector<rect2d> &quads, std::vector<vec2> &out, F mapQuad)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int r=0; r<rounds; ++r) {
+        vec2 *v = out.data();
+        for (const rect2d &q : quads) {
+            mapQuad(m, q.tl, q.br, v);
+            v += 4;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / rounds;
+}
+
+// Maps the corners of 100k rectangles through 2D matrices of increasing
+// complexity, comparing four scalar 'mat4 * vec2' per quad with
+// mat4::mapQuad2D(), and reports the average time per pass.
+int main(int, char **)
+{
+    std::vector<rect2d> quads;
+    quads.reserve(quadCount);
+    srand(0);
+    for (int i=0; i<quadCount; ++i)
+        quads.push_back(rect2d::fromXywh(rand() % 1000, rand() % 1000, rand() % 100, rand() % 100));
+    std::vector<vec2> out(quadCount * 4);
+
+#if defined(RENGINE_MATH_SSE)
+    const char *simd = "sse";
+#elif defined(RENGINE_MATH_NEON)
+    const char *simd = "neon";
+#else
+    const char *simd = "none";
+#endif
+    std::cout << "mapping " << quadCount << " quads, simd: " << simd << std::endl;
+
+    float checksum = 0;
+    for (unsigned i=0; i<sizeof(matrices) / sizeof(mat4); ++i) {
+        double scalar = bench(matrices[i], quads, out, mapQuadScalar);
+        checksum += out.back().x;
+        double vector = bench(matrices[i], quads, out, mapQuadVector);
+        checksum += out.back().x;
+        std::cout << " - " << matrixNames[i]
+                  << ": scalar=" << scalar << "ms"
+                  << ", mapQuad2D=" << vector << "ms"
+                  << ", speedup=" << scalar / vector << "x" << std::endl;
+    }
+
+    // Keeps the results alive
+    return checksum == 0.12345f ? 1 : 0;
+}
@@ -269,6 +269,9 @@ class AnimationManager : public SignalEmitter
 {
 public:
     AnimationManager()
+        : m_tickInterval(std::chrono::milliseconds(16))
+        , m_running(false)
+        , m_virtualClock(false)
     {
     }
 
@@ -287,6 +290,22 @@ public:
 
     bool isRunning() const { return m_running; }
 
+    /*!
+        Makes the animations run on a virtual clock, which starts at zero and
+        only advances by tickInterval() on each tick(), also when no
+        animations are running. The animations then progress the same way
+        regardless of how long it takes to render each frame.
+     */
+    void setVirtualClock(bool enabled) { m_virtualClock = enabled; }
+    bool virtualClock() const { return m_virtualClock; }
+
+    /*!
+        The time, in seconds, the animations advance by on each tick().
+        Defaults to 0.016.
+     */
+    void setTickInterval(double seconds) { m_tickInterval = std::chrono::microseconds(int64_t(seconds * 1000000)); }
+    double tickInterval() const { return std::chrono::duration<double>(m_tickInterval).count(); }
+
 private:
     time_point now();
     void setRunning(bool running);
@@ -299,16 +318,18 @@ private:
     };
 
     time_point m_nextTick;
+    clock::duration m_tickInterval;
 
     std::list<ManagedAnimation> m_runningAnimations;
     std::list<ManagedAnimation> m_scheduledAnimations;
 
     bool m_running;
+    bool m_virtualClock;
 };
 
 inline time_point AnimationManager::now()
 {
-    if (!m_running)
+    if (!m_running && !m_virtualClock)
         m_nextTick = clock::now();
     return m_nextTick;
 }
@@ -370,7 +391,7 @@ inline void AnimationManager::tick()
     // alternatively:
     // time_point now = clock::now();
     time_point now = m_nextTick;
-    m_nextTick += std::chrono::milliseconds(16);
+    m_nextTick += m_tickInterval;
 
     // std::cout << "AnimationManager::tick: scheduled=" << m_scheduledAnimations.size()
     //           << ", running=" << m_runningAnimations.size() << std::endl;
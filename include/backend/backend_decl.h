@@ -43,6 +43,13 @@ public:
     virtual SurfaceBackendImpl *createSurface(Surface *) = 0;
     virtual void destroySurface(Surface *, SurfaceBackendImpl *) = 0;
 
+    /*!
+        Returns true if the backend renders frames as fast as it can rather
+        than in step with a display. Animations should then advance by a
+        fixed step per frame instead of following the wall clock.
+     */
+    virtual bool usesVirtualClock() const { return false; }
+
 protected:
     bool m_running = true;
 
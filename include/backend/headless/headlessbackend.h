@@ -0,0 +1,277 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    A backend without a display, which renders into an EGL pbuffer. It uses
+    the surfaceless platform when available, so with Mesa's llvmpipe it runs
+    on machines without a GPU or a window system.
+
+    Frames are rendered back to back as soon as they are requested, without
+    waiting for vsync, and animations run on a virtual clock, see
+    AnimationManager::setVirtualClock(). The event loop ends when nothing
+    more has been requested, or after the number of frames in the
+    RENGINE_HEADLESS_FRAMES environment variable. The number of frames and
+    the time spent rendering them is logged when the backend is destroyed.
+    Each frame is finished with glFinish(), so the times include the GPU.
+ */
+class HeadlessBackend : public Backend, SurfaceBackendImpl
+{
+public:
+    HeadlessBackend();
+    ~HeadlessBackend();
+
+    void processEvents() override;
+
+    SurfaceBackendImpl *createSurface(Surface *iface) override;
+    void destroySurface(Surface *surface, SurfaceBackendImpl *impl) override;
+
+    bool usesVirtualClock() const override { return true; }
+
+    Renderer *createRenderer() override;
+
+    bool beginRender() override;
+    bool commitRender() override;
+
+    void show() override { }
+    void hide() override { }
+    vec2 size() const override { return m_size; }
+
+    void requestSize(vec2 size) override;
+
+    void requestRender() override { m_renderRequested = true; }
+
+    vec2 dpi() const override { return vec2(96, 96); }
+
+    unsigned frameCount() const { return m_frameCount; }
+    double frameTime() const { return std::chrono::duration<double>(m_frameTime).count(); }
+
+private:
+    void createPbuffer();
+
+    Surface *m_surface = nullptr;
+    EGLDisplay m_display = EGL_NO_DISPLAY;
+    EGLConfig m_config = nullptr;
+    EGLContext m_context = EGL_NO_CONTEXT;
+    EGLSurface m_pbuffer = EGL_NO_SURFACE;
+    vec2 m_size = vec2(800, 480);
+
+    unsigned m_frameCount = 0;
+    unsigned m_maxFrames = 0;
+    std::chrono::steady_clock::duration m_frameTime = std::chrono::steady_clock::duration::zero();
+    std::chrono::steady_clock::duration m_maxFrameTime = std::chrono::steady_clock::duration::zero();
+
+    bool m_renderRequested = false;
+};
+
+inline void HeadlessBackend_die(const char *msg)
+{
+    printf("%s: 0x%x\n", msg, eglGetError());
+    exit(1);
+}
+
+inline HeadlessBackend::HeadlessBackend()
+{
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+    typedef EGLDisplay (*GetPlatformDisplay)(EGLenum, void *, const EGLint *);
+    GetPlatformDisplay getPlatformDisplay = (GetPlatformDisplay) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, nullptr, nullptr)) {
+        m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (!eglInitialize(m_display, nullptr, nullptr))
+            HeadlessBackend_die("Unable to initialize EGL");
+    }
+
+    char *maxFrames = getenv("RENGINE_HEADLESS_FRAMES");
+    if (maxFrames)
+        m_maxFrames = std::max(0, atoi(maxFrames));
+
+    logi << "HeadlessBackend: created..." << std::endl;
+}
+
+inline HeadlessBackend::~HeadlessBackend()
+{
+    if (m_frameCount > 0) {
+        double total = std::chrono::duration<double, std::milli>(m_frameTime).count();
+        double max = std::chrono::duration<double, std::milli>(m_maxFrameTime).count();
+        logi << "HeadlessBackend: " << m_frameCount << " frames in " << total << " ms, "
+             << total / m_frameCount << " ms/frame average, " << max << " ms max" << std::endl;
+    }
+    eglTerminate(m_display);
+}
+
+inline void HeadlessBackend::processEvents()
+{
+    // There are no events, so if nothing was requested, nothing ever will be..
+    if (!m_renderRequested || !m_surface) {
+        logd << "nothing to render, exiting" << std::endl;
+        m_running = false;
+        return;
+    }
+
+    // reset this before onRender so onRender can schedule another one..
+    m_renderRequested = false;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    m_surface->onRender();
+    std::chrono::steady_clock::duration time = std::chrono::steady_clock::now() - start;
+    m_frameTime += time;
+    m_maxFrameTime = std::max(m_maxFrameTime, time);
+    ++m_frameCount;
+
+    if (m_maxFrames > 0 && m_frameCount >= m_maxFrames)
+        m_running = false;
+}
+
+inline SurfaceBackendImpl *HeadlessBackend::createSurface(Surface *surface)
+{
+    assert(surface); // Called with valid input
+    assert(!m_surface); // there can be only one!
+    assert(m_context == EGL_NO_CONTEXT);
+
+    m_surface = surface;
+
+    // The stencil buffer is used for rotated clips
+    int stencilSize = 8;
+    char *overrideStencilSize = getenv("RENGINE_SURFACE_STENCIL_SIZE");
+    if (overrideStencilSize)
+        stencilSize = std::max(0, atoi(overrideStencilSize));
+
+#ifdef RENGINE_OPENGL_DESKTOP
+    EGLint renderableType = EGL_OPENGL_BIT;
+    eglBindAPI(EGL_OPENGL_API);
+#else
+    EGLint renderableType = EGL_OPENGL_ES2_BIT;
+    eglBindAPI(EGL_OPENGL_ES_API);
+#endif
+
+    EGLint const configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, renderableType,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_STENCIL_SIZE, stencilSize,
+        EGL_NONE
+    };
+    EGLint configCount = 0;
+    if (!eglChooseConfig(m_display, configAttributes, &m_config, 1, &configCount) || configCount == 0)
+        HeadlessBackend_die("No suitable EGL config");
+
+#ifdef RENGINE_OPENGL_DESKTOP
+    EGLint const *contextAttributes = nullptr;
+#else
+    EGLint const contextAttributes[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 2,
+        EGL_NONE
+    };
+#endif
+    m_context = eglCreateContext(m_display, m_config, EGL_NO_CONTEXT, contextAttributes);
+    if (m_context == EGL_NO_CONTEXT)
+        HeadlessBackend_die("Unable to create EGL context");
+
+    createPbuffer();
+
+    requestRender();
+
+    return this;
+}
+
+inline void HeadlessBackend::destroySurface(Surface *surface, SurfaceBackendImpl *impl)
+{
+    eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroySurface(m_display, m_pbuffer);
+    eglDestroyContext(m_display, m_context);
+    m_pbuffer = EGL_NO_SURFACE;
+    m_context = EGL_NO_CONTEXT;
+    m_surface = nullptr;
+}
+
+inline void HeadlessBackend::createPbuffer()
+{
+    if (m_pbuffer != EGL_NO_SURFACE) {
+        eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroySurface(m_display, m_pbuffer);
+    }
+    EGLint const attributes[] = {
+        EGL_WIDTH, EGLint(m_size.x),
+        EGL_HEIGHT, EGLint(m_size.y),
+        EGL_NONE
+    };
+    m_pbuffer = eglCreatePbufferSurface(m_display, m_config, attributes);
+    if (m_pbuffer == EGL_NO_SURFACE)
+        HeadlessBackend_die("Unable to create EGL pbuffer");
+}
+
+inline bool HeadlessBackend::beginRender()
+{
+    assert(m_surface);
+    assert(m_context != EGL_NO_CONTEXT);
+    if (!eglMakeCurrent(m_display, m_pbuffer, m_pbuffer, m_context)) {
+        logw << "eglMakeCurrent failed: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+        return false;
+    }
+    return true;
+}
+
+inline bool HeadlessBackend::commitRender()
+{
+    assert(m_surface);
+    // Nothing is presented, but wait for the GPU so the frame time includes it
+    glFinish();
+    return true;
+}
+
+inline Renderer *HeadlessBackend::createRenderer()
+{
+    assert(m_surface);
+    assert(m_context != EGL_NO_CONTEXT);
+    OpenGLRenderer *r = new OpenGLRenderer();
+    r->setTargetSurface(m_surface);
+    return r;
+}
+
+inline void HeadlessBackend::requestSize(vec2 size)
+{
+    assert(m_surface);
+    if (size == m_size)
+        return;
+    m_size = size;
+    createPbuffer();
+}
+
+#define RENGINE_BACKEND rengine::HeadlessBackend
+
+RENGINE_END_NAMESPACE
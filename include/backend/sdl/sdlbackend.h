@@ -168,9 +168,21 @@ inline SurfaceBackendImpl *SDLBackend::createSurface(Surface *surface)
 
     m_surface = surface;
 
+    // A depth buffer is only needed for OpenGLRenderer's opaque pass
+    int depthSize = 0;
+    char *overrideDepthSize = getenv("RENGINE_SURFACE_DEPTH_SIZE");
+    if (overrideDepthSize)
+        depthSize = std::max(0, atoi(overrideDepthSize));
+
+    // The stencil buffer is used for rotated clips
+    int stencilSize = 8;
+    char *overrideStencilSize = getenv("RENGINE_SURFACE_STENCIL_SIZE");
+    if (overrideStencilSize)
+        stencilSize = std::max(0, atoi(overrideStencilSize));
+
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 0);
-    SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 0);
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, depthSize);
+    SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, stencilSize);
     SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 0);
     SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
     SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 4);
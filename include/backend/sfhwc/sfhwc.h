@@ -56,6 +56,8 @@ public:
     void show() override;
     bool beginRender() override;
     bool commitRender() override;
+    bool commitPartialRender(rect2d damage) override;
+    unsigned bufferAge() const override;
     vec2 size() const override;
     void requestSize(vec2) override { logd << "resizing is not supported on this backend" << std::endl; }
 
@@ -90,6 +92,10 @@ public:
     EGLDisplay m_eglDisplay;
     EGLSurface m_eglSurface;
     EGLContext m_eglContext;
+
+    typedef EGLBoolean (*SwapBuffersWithDamage)(EGLDisplay, EGLSurface, EGLint *, EGLint);
+    SwapBuffersWithDamage m_swapBuffersWithDamage = nullptr;
+    bool m_hasBufferAge = false;
 };
 
 class SfHwcBackend : public Backend, public hwc_procs_t
@@ -178,6 +178,33 @@ inline bool SfHwcSurface::commitRender()
     return true;
 }
 
+inline bool SfHwcSurface::commitPartialRender(rect2d damage)
+{
+    if (!m_swapBuffersWithDamage)
+        return commitRender();
+
+    // EGL wants the rects with the origin in the bottom left corner
+    EGLint rect[4] = { EGLint(damage.left()), EGLint(m_size.y - damage.bottom()),
+                       EGLint(damage.width()), EGLint(damage.height()) };
+    EGLBoolean ok = m_swapBuffersWithDamage(m_eglDisplay, m_eglSurface, rect, damage.width() > 0 && damage.height() > 0 ? 1 : 0);
+    if (!ok) {
+		logw << sfhwc_decode_egl_error(eglGetError()) << std::endl;
+		return false;
+    }
+    return true;
+}
+
+inline unsigned SfHwcSurface::bufferAge() const
+{
+#ifndef EGL_BUFFER_AGE_EXT
+#define EGL_BUFFER_AGE_EXT 0x313D
+#endif
+    EGLint age = 0;
+    if (m_hasBufferAge && !eglQuerySurface(m_eglDisplay, m_eglSurface, EGL_BUFFER_AGE_EXT, &age))
+        return 0;
+    return age;
+}
+
 inline vec2 SfHwcSurface::size() const
 {
 	return m_size;
@@ -257,6 +284,13 @@ inline void SfHwcSurface::initEgl()
     m_eglContext = eglCreateContext(m_eglDisplay, eglConfig, EGL_NO_CONTEXT, eglContextAttributes);
     assert(m_eglContext);
 
+    const char *extensions = eglQueryString(m_eglDisplay, EGL_EXTENSIONS);
+    m_hasBufferAge = std::strstr(extensions, "EGL_EXT_buffer_age") != 0;
+    if (std::strstr(extensions, "EGL_KHR_swap_buffers_with_damage"))
+        m_swapBuffersWithDamage = (SwapBuffersWithDamage) eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    else if (std::strstr(extensions, "EGL_EXT_swap_buffers_with_damage"))
+        m_swapBuffersWithDamage = (SwapBuffersWithDamage) eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+
 	logi << "EGL Configuration:" << std::endl;
 	logi << " - Display .........: " << m_eglDisplay << std::endl;
 	logi << " - Config ..........: " << eglConfig << std::endl;
@@ -0,0 +1,173 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <assert.h>
+#include <stdlib.h>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    A heap allocated block of memory which is handed out in chunks over the
+    course of a frame and reused for the next one.
+
+    The total size needed for a frame is passed to reset(), after which
+    allocate() carves the individual arrays out of the block. The block is
+    only reallocated when it is too small, or when the shrink policy decides
+    that the memory has been unused for long enough.
+ */
+class FrameArena
+{
+public:
+    enum { Alignment = 16 };
+
+    FrameArena()
+        : m_memory(0)
+        , m_capacity(0)
+        , m_used(0)
+        , m_reserved(0)
+        , m_highWaterMark(0)
+        , m_windowPeak(0)
+        , m_framesBelowThreshold(0)
+        , m_shrinkInterval(120)
+        , m_shrinkThreshold(0.5f)
+        , m_growCount(0)
+        , m_shrinkCount(0)
+    {
+    }
+
+    ~FrameArena() { free(m_memory); }
+
+    /*!
+        Returns the number of bytes allocate() will use for \a count objects
+        of type \a T.
+     */
+    template <typename T>
+    static unsigned sizeOf(unsigned count) { return (count * sizeof(T) + Alignment - 1) & ~unsigned(Alignment - 1); }
+
+    /*!
+        Releases everything allocated so far and makes room for \a bytes of
+        allocations.
+     */
+    void reset(unsigned bytes);
+
+    /*!
+        Returns an uninitialized array of \a count objects of type \a T. The
+        total must fit within what was passed to reset().
+     */
+    template <typename T>
+    T *allocate(unsigned count) {
+        unsigned size = sizeOf<T>(count);
+        assert(m_used + size <= m_reserved);
+        T *t = (T *) (m_memory + m_used);
+        m_used += size;
+        return t;
+    }
+
+    /*!
+        Sets the shrink policy. When less than \a threshold of the capacity has
+        been used for \a frames frames in a row, the memory is reallocated to
+        the largest size used during those frames. A \a frames value of 0
+        disables shrinking.
+     */
+    void setShrinkPolicy(unsigned frames, float threshold) {
+        assert(threshold >= 0 && threshold <= 1);
+        m_shrinkInterval = frames;
+        m_shrinkThreshold = threshold;
+        m_framesBelowThreshold = 0;
+        m_windowPeak = 0;
+    }
+    unsigned shrinkInterval() const { return m_shrinkInterval; }
+    float shrinkThreshold() const { return m_shrinkThreshold; }
+
+    unsigned bytesUsed() const { return m_used; }
+    unsigned capacity() const { return m_capacity; }
+
+    /*!
+        Returns the largest size passed to reset() so far.
+     */
+    unsigned highWaterMark() const { return m_highWaterMark; }
+    unsigned growCount() const { return m_growCount; }
+    unsigned shrinkCount() const { return m_shrinkCount; }
+
+private:
+    void reallocate(unsigned capacity) {
+        free(m_memory);
+        m_memory = capacity > 0 ? (char *) malloc(capacity) : 0;
+        m_capacity = capacity;
+    }
+
+    char *m_memory;
+    unsigned m_capacity;
+    unsigned m_used;
+    unsigned m_reserved;
+    unsigned m_highWaterMark;
+    unsigned m_windowPeak;          // the largest size since usage dropped below the shrink threshold
+    unsigned m_framesBelowThreshold;
+    unsigned m_shrinkInterval;
+    float m_shrinkThreshold;
+    unsigned m_growCount;
+    unsigned m_shrinkCount;
+};
+
+inline void FrameArena::reset(unsigned bytes)
+{
+    bytes = (bytes + Alignment - 1) & ~unsigned(Alignment - 1);
+    m_used = 0;
+    m_reserved = bytes;
+    if (bytes > m_highWaterMark)
+        m_highWaterMark = bytes;
+
+    if (bytes > m_capacity) {
+        // Leave some headroom so a slowly growing scene doesn't reallocate
+        // every frame.
+        reallocate((bytes + bytes / 4 + Alignment - 1) & ~unsigned(Alignment - 1));
+        ++m_growCount;
+        m_framesBelowThreshold = 0;
+        m_windowPeak = 0;
+        return;
+    }
+
+    if (m_shrinkInterval == 0)
+        return;
+
+    if (bytes >= m_capacity * m_shrinkThreshold) {
+        m_framesBelowThreshold = 0;
+        m_windowPeak = 0;
+        return;
+    }
+
+    if (bytes > m_windowPeak)
+        m_windowPeak = bytes;
+    if (++m_framesBelowThreshold >= m_shrinkInterval) {
+        reallocate(m_windowPeak);
+        ++m_shrinkCount;
+        m_framesBelowThreshold = 0;
+        m_windowPeak = 0;
+    }
+}
+
+RENGINE_END_NAMESPACE
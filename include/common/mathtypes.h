@@ -32,9 +32,10 @@
 
     A: True, but I want this library and this file in particular to be a
     selfcontained, no-hassle-to-deploy suite of strictly needed math things.
-    It isn't complete or perhaps not fully optimal either (due to no sse and such),
-    but it is all inline, comes at no deployment cost and the file can be included
-    in any project by simply dumping a single header file in there.
+    It isn't complete or perhaps not fully optimal either (sse and neon are
+    only used for the hot 2D paths in the renderer), but it is all inline,
+    comes at no deployment cost and the file can be included in any project
+    by simply dumping a single header file in there.
  */
 
 #pragma once
@@ -44,6 +45,17 @@
 #include <ostream>
 #include <assert.h>
 
+// Define RENGINE_MATH_NO_SIMD to always use the scalar code
+#if !defined(RENGINE_MATH_NO_SIMD)
+#  if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#    define RENGINE_MATH_SSE
+#    include <xmmintrin.h>
+#  elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#    define RENGINE_MATH_NEON
+#    include <arm_neon.h>
+#  endif
+#endif
+
 RENGINE_BEGIN_NAMESPACE
 
 struct vec2 {
@@ -522,6 +534,59 @@ struct mat4 {
                      0,  0,  0, 1, Generic);
     }
 
+    /*!
+        Maps the corners of the axis aligned rectangle from \a a to \a b
+        through the 2D part of this matrix and writes them to \a v in the
+        order top left, bottom left, top right, bottom right. The result is
+        the same as four calls to operator*(vec2), but a pure translate or
+        scale only needs two corners and the general affine case maps all
+        four at once with sse or neon.
+     */
+    void mapQuad2D(vec2 a, vec2 b, vec2 *v) const {
+        static_assert(sizeof(vec2) == 2 * sizeof(float), "vec2 must be two packed floats");
+        if (type == Identity) {
+            v[0] = a;
+            v[1] = vec2(a.x, b.y);
+            v[2] = vec2(b.x, a.y);
+            v[3] = b;
+        } else if ((type & ~(Translation2D | Scale2D)) == 0) {
+            vec2 ta = *this * a;
+            vec2 tb = *this * b;
+            v[0] = ta;
+            v[1] = vec2(ta.x, tb.y);
+            v[2] = vec2(tb.x, ta.y);
+            v[3] = tb;
+        } else {
+#if defined(RENGINE_MATH_SSE)
+            __m128 x = _mm_setr_ps(a.x, a.x, b.x, b.x);
+            __m128 y = _mm_setr_ps(a.y, b.y, a.y, b.y);
+            __m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0]), x),
+                                              _mm_mul_ps(_mm_set1_ps(m[1]), y)),
+                                   _mm_set1_ps(m[3]));
+            __m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[4]), x),
+                                              _mm_mul_ps(_mm_set1_ps(m[5]), y)),
+                                   _mm_set1_ps(m[7]));
+            float *f = &v[0].x;
+            _mm_storeu_ps(f, _mm_unpacklo_ps(rx, ry));
+            _mm_storeu_ps(f + 4, _mm_unpackhi_ps(rx, ry));
+#elif defined(RENGINE_MATH_NEON)
+            float xs[] = { a.x, a.x, b.x, b.x };
+            float ys[] = { a.y, b.y, a.y, b.y };
+            float32x4_t x = vld1q_f32(xs);
+            float32x4_t y = vld1q_f32(ys);
+            float32x4x2_t r;
+            r.val[0] = vaddq_f32(vaddq_f32(vmulq_n_f32(x, m[0]), vmulq_n_f32(y, m[1])), vdupq_n_f32(m[3]));
+            r.val[1] = vaddq_f32(vaddq_f32(vmulq_n_f32(x, m[4]), vmulq_n_f32(y, m[5])), vdupq_n_f32(m[7]));
+            vst2q_f32(&v[0].x, r);
+#else
+            v[0] = *this * a;
+            v[1] = *this * vec2(a.x, b.y);
+            v[2] = *this * vec2(b.x, a.y);
+            v[3] = *this * b;
+#endif
+        }
+    }
+
     bool isIdentity() const { return type == Identity; }
 
     float operator()(int c, int r) {
@@ -594,6 +659,20 @@ public:
         return (*this) | r.tl | r.br;
     }
 
+    /*!
+        Returns the intersection of this rect and \a r. The result has a
+        negative width or height if they don't intersect.
+     */
+    rect2d operator&(rect2d r) const {
+        return rect2d(std::max(tl.x, r.tl.x), std::max(tl.y, r.tl.y),
+                      std::min(br.x, r.br.x), std::min(br.y, r.br.y));
+    }
+
+    rect2d &operator&=(rect2d r) {
+        *this = *this & r;
+        return *this;
+    }
+
     bool operator==(rect2d o) const { return tl == o.tl && br == o.br; }
 
     bool contains(vec2 p) const {
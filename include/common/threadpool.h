@@ -0,0 +1,193 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    A fixed set of threads which run a batch of tasks in parallel.
+
+    run() splits the task indices into one contiguous range per thread. Each
+    thread takes tasks from the front of its own range and when it runs out,
+    it steals from the back of the others' ranges. Tasks of uneven cost will
+    still keep all the threads busy. The thread calling run() takes part in
+    the work and run() returns when all the tasks have completed.
+ */
+class ThreadPool
+{
+public:
+    ThreadPool(unsigned threadCount = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    /*!
+        The number of threads which run tasks, including the one calling
+        run().
+     */
+    unsigned threadCount() const { return m_queueCount; }
+
+    /*!
+        Calls \a task once for each index from 0 up to, but not including,
+        \a count, spread over the threads. Blocks until all the calls have
+        returned.
+     */
+    void run(unsigned count, const std::function<void(unsigned)> &task);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        unsigned first;
+        unsigned last;
+    };
+
+    void threadMain(unsigned index);
+    void work(unsigned index);
+    bool take(unsigned index, unsigned *task);
+
+    std::vector<std::thread> m_threads;
+    std::unique_ptr<Queue[]> m_queues;
+    unsigned m_queueCount;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    unsigned m_generation;
+    bool m_quit;
+
+    const std::function<void(unsigned)> *m_task;
+    std::atomic<unsigned> m_remaining;
+};
+
+inline ThreadPool::ThreadPool(unsigned threadCount)
+    : m_queueCount(std::max(threadCount, 1u))
+    , m_generation(0)
+    , m_quit(false)
+    , m_task(0)
+    , m_remaining(0)
+{
+    m_queues.reset(new Queue[m_queueCount]);
+    for (unsigned i=0; i<m_queueCount; ++i) {
+        m_queues[i].first = 0;
+        m_queues[i].last = 0;
+    }
+    // The calling thread works the first queue
+    for (unsigned i=1; i<m_queueCount; ++i)
+        m_threads.push_back(std::thread(&ThreadPool::threadMain, this, i));
+}
+
+inline ThreadPool::~ThreadPool()
+{
+    m_mutex.lock();
+    m_quit = true;
+    m_wake.notify_all();
+    m_mutex.unlock();
+
+    for (std::thread &t : m_threads)
+        t.join();
+}
+
+inline void ThreadPool::run(unsigned count, const std::function<void(unsigned)> &task)
+{
+    if (count == 0)
+        return;
+
+    // Set before the tasks are queued, so a thread which is still looking
+    // for work from the previous batch can pick them up.
+    m_task = &task;
+    m_remaining = count;
+    for (unsigned i=0; i<m_queueCount; ++i) {
+        std::lock_guard<std::mutex> locker(m_queues[i].mutex);
+        m_queues[i].first = unsigned(uint64_t(count) * i / m_queueCount);
+        m_queues[i].last = unsigned(uint64_t(count) * (i + 1) / m_queueCount);
+    }
+
+    m_mutex.lock();
+    ++m_generation;
+    m_wake.notify_all();
+    m_mutex.unlock();
+
+    work(0);
+
+    std::unique_lock<std::mutex> locker(m_mutex);
+    m_done.wait(locker, [this] { return m_remaining == 0; });
+    m_task = 0;
+}
+
+inline void ThreadPool::threadMain(unsigned index)
+{
+    unsigned generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            m_wake.wait(locker, [&] { return m_quit || m_generation != generation; });
+            if (m_quit)
+                return;
+            generation = m_generation;
+        }
+        work(index);
+    }
+}
+
+inline void ThreadPool::work(unsigned index)
+{
+    unsigned task;
+    while (take(index, &task)) {
+        (*m_task)(task);
+        if (--m_remaining == 0) {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_done.notify_all();
+        }
+    }
+}
+
+/*!
+    Takes the next task from the thread's own queue, or steals the last one
+    from another queue. Returns false when there are none left.
+ */
+inline bool ThreadPool::take(unsigned index, unsigned *task)
+{
+    for (unsigned i=0; i<m_queueCount; ++i) {
+        Queue &q = m_queues[(index + i) % m_queueCount];
+        std::lock_guard<std::mutex> locker(q.mutex);
+        if (q.first < q.last) {
+            *task = i == 0 ? q.first++ : --q.last;
+            return true;
+        }
+    }
+    return false;
+}
+
+RENGINE_END_NAMESPACE
@@ -26,6 +26,7 @@
 #pragma once
 
 #include <chrono>
+#include <future>
 #include <list>
 #include <memory>
 #include <vector>
@@ -77,6 +78,8 @@ RENGINE_END_NAMESPACE
 #include "common/logging.h"
 #include "common/mathtypes.h"
 #include "common/allocationpool.h"
+#include "common/framearena.h"
+#include "common/threadpool.h"
 #include "common/colormatrix.h"
 #include "common/kalmanfilter.h"
 
@@ -96,7 +99,9 @@ RENGINE_END_NAMESPACE
 #include "scenegraph/renderer.h"
 #include "scenegraph/openglshaderprogram.h"
 #include "scenegraph/opengltexture.h"
+#include "scenegraph/opengltextureatlas.h"
 #include "scenegraph/openglrenderer.h"
+#include "scenegraph/softwarerenderer.h"
 #include "scenegraph/layoutnode.h"
 
 #include "animationsystem/animation.h"
@@ -107,8 +112,10 @@ RENGINE_END_NAMESPACE
 #include "backend/sdl/sdlbackend.h"
 #elif defined RENGINE_BACKEND_SFHWC
 #include "backend/sfhwc/sfhwc.h"
+#elif defined RENGINE_BACKEND_HEADLESS
+#include "backend/headless/headlessbackend.h"
 #else
-#error "Please define which backend you want: RENGINE_BACKEND_SDL or RENGNE_BACKEND_SFHWC."
+#error "Please define which backend you want: RENGINE_BACKEND_SDL, RENGINE_BACKEND_SFHWC or RENGINE_BACKEND_HEADLESS."
 #endif
 
 #include "util/workqueue.h"
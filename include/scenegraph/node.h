@@ -70,6 +70,7 @@ public:
         ColorFilterNodeType   = 3,
         BlurNodeType          = 4,
         ShadowNodeType        = 5,
+        ClipNodeType          = 6,
 
         RectangleNodeBaseType = (1 << 6),
         RectangleNodeType     = 1 | RectangleNodeBaseType,
@@ -112,6 +113,8 @@ public:
             child->m_next = m_child;
         }
         child->setParent(this);
+        m_childrenChanged = true;
+        markDirty();
     }
 
     Node &operator<<(Node *child) { append(child); return *this; }
@@ -152,6 +155,8 @@ public:
         child->m_next = 0;
         child->m_prev = 0;
         child->setParent(0);
+        m_childrenChanged = true;
+        markDirty();
     }
 
     // /*!
@@ -236,7 +241,11 @@ public:
      */
     Type type() const { return m_type; }
 
-    void requestPreprocess() { m_preprocess = true; }
+    void requestPreprocess() {
+        m_preprocess = true;
+        markBoundsDirty();
+        markAncestorsDirty();
+    }
     void preprocess() {
         if (m_preprocess) {
             m_preprocess = false;
@@ -280,6 +289,57 @@ public:
 
     virtual bool onPointerEvent(PointerEvent *e) { return false; }
 
+    /*!
+     * Marks this node as changed since it was last rendered. A renderer which
+     * retains its output between frames will rebuild this node and its
+     * subtree in the next frame. Setters call this function, so it only
+     * needs to be called explicitly by subclasses with custom state.
+     */
+    void markDirty() {
+        m_dirty = true;
+        markBoundsDirty();
+        markAncestorsDirty();
+    }
+
+    /*!
+     * State variables used by renderers which retain their output between
+     * frames. A node is dirty when its own state has changed and it has dirty
+     * descendants when something in its subtree has changed or requested
+     * preprocessing. A dirty node's children have changed when children
+     * were added or removed, as opposed to only its own properties.
+     */
+    bool isDirty() const { return m_dirty; }
+    bool childrenChanged() const { return m_childrenChanged; }
+    void clearDirty() { m_dirty = false; m_childrenChanged = false; }
+    bool hasDirtyDescendants() const { return m_dirtyDescendants; }
+    void setDirtyDescendants(bool dirty) { m_dirtyDescendants = dirty; }
+    bool needsUpdate() const { return m_dirty || m_dirtyDescendants || m_preprocess; }
+
+    /*!
+     * Where the renderer placed this node's subtree in its element and vertex
+     * lists in the previous frame.
+     */
+    struct RenderRange {
+        unsigned element;
+        unsigned elementCount;
+        unsigned vertex;
+        unsigned vertexCount;
+    };
+    const RenderRange &renderRange() const { return m_renderRange; }
+    void setRenderRange(const RenderRange &range) { m_renderRange = range; }
+
+    /*!
+     * The bounding rect of this node's subtree in its parent's coordinate
+     * system, as calculated by the renderer. The bounds are dirty when
+     * anything in the subtree has changed since they were set.
+     */
+    const rect2d &cachedBounds() const { return m_bounds; }
+    void setCachedBounds(const rect2d &bounds) {
+        m_bounds = bounds;
+        m_boundsDirty = false;
+    }
+    bool boundsDirty() const { return m_boundsDirty; }
+
 protected:
     virtual void onPreprocess() { }
 
@@ -295,6 +355,11 @@ protected:
         , m_preprocess(false)
         , m_poolAllocated(false)
         , m_pointerTarget(false)
+        , m_dirty(true)
+        , m_childrenChanged(false)
+        , m_dirtyDescendants(false)
+        , m_boundsDirty(true)
+        , m_renderRange{ 0, 0, 0, 0 }
     {
     }
 
@@ -323,6 +388,16 @@ protected:
         m_parent = p;
     }
 
+    void markBoundsDirty() {
+        for (Node *p = this; p && !p->m_boundsDirty; p = p->m_parent)
+            p->m_boundsDirty = true;
+    }
+
+    void markAncestorsDirty() {
+        for (Node *p = m_parent; p && !p->m_dirtyDescendants; p = p->m_parent)
+            p->m_dirtyDescendants = true;
+    }
+
     Node *m_parent;
     Node *m_child;
     Node *m_next;
@@ -332,13 +407,25 @@ protected:
     unsigned m_preprocess : 1;
     unsigned m_poolAllocated : 1;
     unsigned m_pointerTarget : 1;
-    unsigned m_reserved : 21; // 32 - 11
+    unsigned m_dirty : 1;
+    unsigned m_childrenChanged : 1;
+    unsigned m_dirtyDescendants : 1;
+    unsigned m_boundsDirty : 1;
+    unsigned m_reserved : 17; // 32 - 15
+
+    RenderRange m_renderRange;
+    rect2d m_bounds;
 };
 
 class OpacityNode : public Node {
 public:
     float opacity() const { return m_opacity; }
-    void setOpacity(float opacity) { m_opacity = opacity; }
+    void setOpacity(float opacity) {
+        if (m_opacity == opacity)
+            return;
+        m_opacity = opacity;
+        markDirty();
+    }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(OpacityNode, rengine_OpacityNode);
 
@@ -365,10 +452,18 @@ class TransformNode : public Node
 {
 public:
     mat4 matrix() const { return m_matrix; }
-    void setMatrix(mat4 m) { m_matrix = m; }
+    void setMatrix(mat4 m) {
+        m_matrix = m;
+        markDirty();
+    }
 
     float projectionDepth() const { return m_projectionDepth; }
-    void setProjectionDepth(float d) { m_projectionDepth = d; }
+    void setProjectionDepth(float d) {
+        if (m_projectionDepth == d)
+            return;
+        m_projectionDepth = d;
+        markDirty();
+    }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(TransformNode, rengine_TransformNode);
 
@@ -525,6 +620,7 @@ public:
         if (x == m_geometry.x())
             return;
         m_geometry.setX(x);
+        markDirty();
         onXChanged.emit(this);
     }
 
@@ -533,6 +629,7 @@ public:
         if (y == m_geometry.y())
             return;
         m_geometry.setY(y);
+        markDirty();
         onYChanged.emit(this);
     }
 
@@ -551,6 +648,7 @@ public:
         if (w == m_geometry.width())
             return;
         m_geometry.setWidth(w);
+        markDirty();
         onWidthChanged.emit(this);
     }
 
@@ -559,6 +657,7 @@ public:
         if (h == m_geometry.height())
             return;
         m_geometry.setHeight(h);
+        markDirty();
         onHeightChanged.emit(this);
     }
 
@@ -571,6 +670,7 @@ public:
         if (!updateX && !updateY && !updateW && !updateH)
             return;
         m_geometry = rect;
+        markDirty();
         if (updateX) onXChanged.emit(this);
         if (updateY) onYChanged.emit(this);
         if (updateW) onWidthChanged.emit(this);
@@ -615,6 +715,7 @@ public:
         if (c == m_color)
             return;
         m_color = color;
+        markDirty();
         onColorChanged.emit(this);
     }
 
@@ -639,7 +740,12 @@ protected:
 class TextureNode : public RectangleNodeBase {
 public:
     const Texture *texture() const { return m_texture; }
-    void setTexture(const Texture *texture) { m_texture = texture; }
+    void setTexture(const Texture *texture) {
+        if (m_texture == texture)
+            return;
+        m_texture = texture;
+        markDirty();
+    }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(TextureNode, rengine_TextureNode);
 
@@ -663,7 +769,10 @@ protected:
 
 class ColorFilterNode : public Node {
 public:
-    void setColorMatrix(mat4 matrix) { m_colorMatrix = matrix; }
+    void setColorMatrix(mat4 matrix) {
+        m_colorMatrix = matrix;
+        markDirty();
+    }
     mat4 colorMatrix() const { return m_colorMatrix; }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(ColorFilterNode, rengine_ColorFilterNode);
@@ -689,9 +798,37 @@ class BlurNode : public Node {
 public:
     enum { StaticType = BlurNodeType };
 
-    void setRadius(unsigned radius) { m_radius = radius; }
+    void setRadius(unsigned radius) {
+        if (m_radius == radius)
+            return;
+        m_radius = radius;
+        markDirty();
+    }
     unsigned radius() const { return m_radius; }
 
+    /*!
+        Controls the resolution the blur is performed at. With LowQuality
+        and NormalQuality, large radii are blurred on a downsampled copy of
+        the content, which keeps the cost roughly the same regardless of
+        the radius. HighQuality blurs at full resolution, up to the largest
+        radius the renderer supports.
+
+        The default is NormalQuality.
+     */
+    enum Quality {
+        LowQuality,
+        NormalQuality,
+        HighQuality
+    };
+
+    void setQuality(Quality quality) {
+        if (m_quality == quality)
+            return;
+        m_quality = quality;
+        markDirty();
+    }
+    Quality quality() const { return m_quality; }
+
     RENGINE_ALLOCATION_POOL_DECLARATION(BlurNode, rengine_BlurNode);
 
     static BlurNode *create(unsigned radius) {
@@ -703,22 +840,38 @@ public:
     RENGINE_NODE_DEFINE_FROM_FUNCTION(BlurNode, BlurNodeType);
 
 protected:
-    BlurNode() : Node(BlurNodeType), m_radius(3) { }
+    BlurNode() : Node(BlurNodeType), m_radius(3), m_quality(NormalQuality) { }
 
     unsigned m_radius;
+    Quality m_quality;
 };
 
 class ShadowNode : public Node {
 public:
     enum { StaticType = ShadowNodeType };
 
-    void setRadius(unsigned radius) { m_radius = radius; }
+    void setRadius(unsigned radius) {
+        if (m_radius == radius)
+            return;
+        m_radius = radius;
+        markDirty();
+    }
     unsigned radius() const { return m_radius; }
 
-    void setOffset(vec2 offset) { m_offset = offset; }
+    void setOffset(vec2 offset) {
+        if (m_offset == offset)
+            return;
+        m_offset = offset;
+        markDirty();
+    }
     vec2 offset() const { return m_offset; }
 
-    void setColor(vec4 color) { m_color = color; }
+    void setColor(vec4 color) {
+        if (m_color == color)
+            return;
+        m_color = color;
+        markDirty();
+    }
     vec4 color() const { return m_color; }
 
     RENGINE_ALLOCATION_POOL_DECLARATION(ShadowNode, rengine_ShadowNode);
@@ -741,6 +894,38 @@ protected:
     vec4 m_color;
 };
 
+/*!
+    Clips its subtree to geometry(). Axis aligned clips are applied with the
+    scissor test, while rotated and projected ones need a stencil buffer.
+    Inside a 3D subtree, the clip and its subtree are ordered back to front
+    as one, at the depth of the clip's center.
+ */
+class ClipNode : public Node {
+public:
+    rect2d geometry() const { return m_geometry; }
+    void setGeometry(rect2d rect) {
+        if (m_geometry == rect)
+            return;
+        m_geometry = rect;
+        markDirty();
+    }
+
+    RENGINE_ALLOCATION_POOL_DECLARATION(ClipNode, rengine_ClipNode);
+
+    static ClipNode *create(rect2d geometry) {
+        auto node = create();
+        node->setGeometry(geometry);
+        return node;
+    }
+
+    RENGINE_NODE_DEFINE_FROM_FUNCTION(ClipNode, ClipNodeType);
+
+protected:
+    ClipNode() : Node(ClipNodeType) { }
+
+    rect2d m_geometry;
+};
+
 
 class RenderNode : public RectangleNodeBase {
 public:
@@ -751,7 +936,8 @@ public:
         is called:
          - GL_BLEND is enabled
          - GL_DEPTH_TEST is disabled
-         - GL_STENCIL_TEST is disabled
+         - GL_STENCIL_TEST is disabled, unless the node is inside a
+           rotated ClipNode
          - glDepthMask(false) is used
          - glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA) is used
          - No buffers are bound and all attributes are disabled
@@ -780,7 +966,8 @@ protected:
     RENGINE_ALLOCATION_POOL_DEFINITION(rengine::RectangleNode, rengine_RectangleNode);                        \
     RENGINE_ALLOCATION_POOL_DEFINITION(rengine::ColorFilterNode, rengine_ColorFilterNode);                    \
     RENGINE_ALLOCATION_POOL_DEFINITION(rengine::BlurNode, rengine_BlurNode);                                  \
-    RENGINE_ALLOCATION_POOL_DEFINITION(rengine::ShadowNode, rengine_ShadowNode);
+    RENGINE_ALLOCATION_POOL_DEFINITION(rengine::ShadowNode, rengine_ShadowNode);                              \
+    RENGINE_ALLOCATION_POOL_DEFINITION(rengine::ClipNode, rengine_ClipNode);
 
 #define RENGINE_NODE_DEFINE_SIGNALS                                                 \
                                                                                     \
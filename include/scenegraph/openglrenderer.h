@@ -25,78 +25,517 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <stack>
 #include <stdio.h>
-#include <alloca.h>
+#include <stdint.h>
+#include <vector>
 #include <iomanip>
 #include <cstring>
+#include <cstddef>
+
+#if defined(RENGINE_OPENGL_DESKTOP) && !defined(__APPLE__)
+#include <dlfcn.h>
+#endif
 
 #include "openglrenderer_shaders.h"
 
 RENGINE_BEGIN_NAMESPACE
 
+// The maximum number of quads merged into a single draw call.
+#ifndef RENGINE_OPENGL_MAX_BATCH_QUADS
+#define RENGINE_OPENGL_MAX_BATCH_QUADS 4096
+#endif
+
+// Layer textures are allocated in multiples of this size, in pixels.
+#ifndef RENGINE_OPENGL_LAYER_BUCKET_SIZE
+#define RENGINE_OPENGL_LAYER_BUCKET_SIZE 64
+#endif
+
+// The number of bytes held by unused layer textures before they are deleted.
+#ifndef RENGINE_OPENGL_LAYER_POOL_BUDGET
+#define RENGINE_OPENGL_LAYER_POOL_BUDGET (32 * 1024 * 1024)
+#endif
+
+// The maximum number of opaque rectangles and textures used to cull the
+// elements they cover. Only the largest ones are used. Set to 0 to disable.
+#ifndef RENGINE_OPENGL_MAX_OCCLUDERS
+#define RENGINE_OPENGL_MAX_OCCLUDERS 8
+#endif
+
+// Opaque rectangles and textures smaller than this, in pixels, are not used
+// for culling.
+#ifndef RENGINE_OPENGL_MIN_OCCLUDER_AREA
+#define RENGINE_OPENGL_MIN_OCCLUDER_AREA (64 * 64)
+#endif
+
+// The number of frames of damage which is remembered, which limits the buffer
+// age which can be repainted partially.
+#ifndef RENGINE_OPENGL_DAMAGE_HISTORY
+#define RENGINE_OPENGL_DAMAGE_HISTORY 3
+#endif
+
+// The number of vertex buffers which are cycled through. A frame writes into
+// the buffer least recently drawn from, so the driver rarely has to wait for
+// the GPU before updating it.
+#ifndef RENGINE_OPENGL_VERTEX_BUFFER_COUNT
+#define RENGINE_OPENGL_VERTEX_BUFFER_COUNT 3
+#endif
+
+// The largest blur radius, in texels, which is sampled for a BlurNode with
+// NormalQuality and LowQuality respectively. Larger radii are blurred on a
+// copy of the content downsampled by a power of two. HighQuality is limited
+// by OpenGLRenderer::MaxBlurKernelRadius.
+#ifndef RENGINE_OPENGL_BLUR_MAX_RADIUS
+#define RENGINE_OPENGL_BLUR_MAX_RADIUS 16
+#endif
+#ifndef RENGINE_OPENGL_BLUR_MAX_RADIUS_LOW
+#define RENGINE_OPENGL_BLUR_MAX_RADIUS_LOW 6
+#endif
+
+// The number of frames whose GPU timer queries can be waiting for the GPU at
+// once. Frames are not timed while this many are pending.
+#ifndef RENGINE_OPENGL_GPU_TIMER_FRAMES
+#define RENGINE_OPENGL_GPU_TIMER_FRAMES 4
+#endif
+
+// Full rebuilds of trees with at least this many elements are split over the
+// build threads, see OpenGLRenderer::setBuildThreadCount().
+#ifndef RENGINE_OPENGL_PARALLEL_BUILD_MIN_ELEMENTS
+#define RENGINE_OPENGL_PARALLEL_BUILD_MIN_ELEMENTS 1024
+#endif
+
+// Single channel textures, from GL_EXT_texture_rg / GL_ARB_texture_rg
+#ifndef GL_RED
+#define GL_RED 0x1903
+#endif
+
+// Instanced drawing, core in OpenGL 3.3 and OpenGL ES 3.0 and available
+// through the instanced arrays extensions before that.
+#ifndef GL_APIENTRYP
+#define GL_APIENTRYP *
+#endif
+typedef void (GL_APIENTRYP RenginePFNGLDrawArraysInstanced)(GLenum mode, GLint first, GLsizei count, GLsizei instances);
+typedef void (GL_APIENTRYP RenginePFNGLVertexAttribDivisor)(GLuint index, GLuint divisor);
+
+// Reading back into pixel buffer objects, core in OpenGL 3.0 and OpenGL ES 3.0
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT 0x0001
+#endif
+typedef void *(GL_APIENTRYP RenginePFNGLMapBufferRange)(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef GLboolean (GL_APIENTRYP RenginePFNGLUnmapBuffer)(GLenum target);
+
+// Fences, core in OpenGL 3.2 and OpenGL ES 3.0. The GLsync handle is passed
+// as a plain pointer, as older headers don't declare it.
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x0001
+#endif
+#ifndef GL_ALREADY_SIGNALED
+#define GL_ALREADY_SIGNALED 0x911A
+#endif
+#ifndef GL_CONDITION_SATISFIED
+#define GL_CONDITION_SATISFIED 0x911C
+#endif
+typedef void *(GL_APIENTRYP RenginePFNGLFenceSync)(GLenum condition, GLbitfield flags);
+typedef GLenum (GL_APIENTRYP RenginePFNGLClientWaitSync)(void *sync, GLbitfield flags, uint64_t timeout);
+typedef void (GL_APIENTRYP RenginePFNGLDeleteSync)(void *sync);
+
+// Timer queries, from OpenGL 3.3 / GL_ARB_timer_query and
+// GL_EXT_disjoint_timer_query on OpenGL ES
+#ifndef GL_TIMESTAMP
+#define GL_TIMESTAMP 0x8E28
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+typedef void (GL_APIENTRYP RenginePFNGLGenQueries)(GLsizei n, GLuint *ids);
+typedef void (GL_APIENTRYP RenginePFNGLDeleteQueries)(GLsizei n, const GLuint *ids);
+typedef void (GL_APIENTRYP RenginePFNGLQueryCounter)(GLuint id, GLenum target);
+typedef void (GL_APIENTRYP RenginePFNGLGetQueryObjectiv)(GLuint id, GLenum pname, GLint *params);
+typedef void (GL_APIENTRYP RenginePFNGLGetQueryObjectui64v)(GLuint id, GLenum pname, uint64_t *params);
+
+/*!
+    Looks up the GL function \a name, which is not part of OpenGL ES 2.0.
+    Returns 0 if it could not be found.
+ */
+inline void *rengine_resolve_gl_function(const char *name)
+{
+#if !defined(RENGINE_OPENGL_DESKTOP)
+    return (void *) eglGetProcAddress(name);
+#elif defined(__APPLE__)
+    (void) name;
+    return 0;
+#else
+    // We link against libGL.so, which exports the entry points
+    return dlsym(RTLD_DEFAULT, name);
+#endif
+}
+
+inline void rengine_create_texture(int id, int w, int h, GLenum format = GL_RGBA)
+{
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format, GL_UNSIGNED_BYTE, 0);
+}
+
+/*!
+    Reverses the order of the \a height rows of \a width pixels in \a pixels,
+    as GL reads them bottom row first.
+ */
+inline void rengine_flipRows(unsigned *pixels, int width, int height)
+{
+    for (int y=0; y<height/2; ++y) {
+        unsigned *a = pixels + y * width;
+        unsigned *b = pixels + (height - y - 1) * width;
+        int x = 0;
+#if defined(RENGINE_MATH_SSE)
+        for (; x + 4 <= width; x += 4) {
+            __m128 pa = _mm_loadu_ps((const float *) (a + x));
+            __m128 pb = _mm_loadu_ps((const float *) (b + x));
+            _mm_storeu_ps((float *) (a + x), pb);
+            _mm_storeu_ps((float *) (b + x), pa);
+        }
+#elif defined(RENGINE_MATH_NEON)
+        for (; x + 4 <= width; x += 4) {
+            uint32x4_t pa = vld1q_u32(a + x);
+            uint32x4_t pb = vld1q_u32(b + x);
+            vst1q_u32(a + x, pb);
+            vst1q_u32(b + x, pa);
+        }
+#endif
+        for (; x < width; ++x)
+            std::swap(a[x], b[x]);
+    }
+}
+
 class OpenGLRenderer : public Renderer
 {
 public:
 
-    struct TexturePool : public std::vector<GLuint>
+    /*!
+        Keeps the textures used for layers, each with a framebuffer object
+        permanently attached to it. Sizes are rounded up to buckets of
+        RENGINE_OPENGL_LAYER_BUCKET_SIZE pixels so that layers which change
+        size slightly between frames can still reuse the same storage. The
+        storage is kept across frames and free textures are only deleted
+        when the pool grows beyond its budget.
+     */
+    struct TexturePool
     {
+        struct Entry {
+            GLuint texture;
+            GLuint fbo;
+            GLuint stencil;         // renderbuffer, only created when a layer needs it
+            GLenum format;          // GL_RGBA or GL_RED
+            vec2 size;
+            unsigned lastUsed;
+            bool used;
+        };
+
+        TexturePool() : m_budget(RENGINE_OPENGL_LAYER_POOL_BUDGET), m_frame(0) { }
+
         ~TexturePool()
         {
-            glDeleteTextures(size(), data());
+            for (const Entry &e : m_entries)
+                destroy(e);
         }
 
-        GLuint acquire() {
-            GLuint id;
-            if (empty()) {
-                glGenTextures(1, &id);
-                return id;
+        static vec2 bucketSize(vec2 size)
+        {
+            const unsigned b = RENGINE_OPENGL_LAYER_BUCKET_SIZE;
+            return vec2((unsigned(std::ceil(size.x)) + b - 1) / b * b,
+                        (unsigned(std::ceil(size.y)) + b - 1) / b * b);
+        }
+
+        /*!
+            Returns a texture of at least \a size pixels and stores the
+            framebuffer object it is attached to in \a fbo. When \a stencil
+            is set, the framebuffer object also has a stencil buffer.
+            \a format is either GL_RGBA or, when supported, GL_RED.
+         */
+        GLuint acquire(vec2 size, GLuint *fbo, bool stencil = false, GLenum format = GL_RGBA)
+        {
+            vec2 bucket = bucketSize(size);
+            for (Entry &e : m_entries) {
+                if (!e.used && e.size == bucket && e.format == format) {
+                    e.used = true;
+                    e.lastUsed = m_frame;
+                    if (stencil && !e.stencil)
+                        attachStencil(&e);
+                    *fbo = e.fbo;
+                    return e.texture;
+                }
             }
-            id = back();
-            pop_back();
-            return id;
+
+            Entry e;
+            e.size = bucket;
+            e.lastUsed = m_frame;
+            e.used = true;
+            e.stencil = 0;
+            e.format = format;
+            glGenTextures(1, &e.texture);
+            rengine_create_texture(e.texture, bucket.x, bucket.y, format);
+            glGenFramebuffers(1, &e.fbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, e.fbo);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, e.texture, 0);
+            if (stencil)
+                attachStencil(&e);
+            m_entries.push_back(e);
+            *fbo = e.fbo;
+            return e.texture;
         }
 
         void release(GLuint id) {
             assert(id > 0);
-            push_back(id);
+            for (Entry &e : m_entries) {
+                if (e.texture == id) {
+                    assert(e.used);
+                    e.used = false;
+                    return;
+                }
+            }
+            assert(false);
         }
 
-        void compact() {
-            glFlush();
-            for (auto id : *this) {
-                glBindTexture(GL_TEXTURE_2D, id);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        /*!
+            Returns the fraction of a pooled texture which is covered by a
+            layer of \a size pixels. Layers are rendered into the bottom
+            left corner of the texture.
+         */
+        static vec2 textureScale(vec2 size) { return size / bucketSize(size); }
+        static vec2 downsampledSize(vec2 size, unsigned factor) {
+            return vec2(std::ceil(size.x / factor), std::ceil(size.y / factor));
+        }
+
+        /*!
+            Deletes the least recently used free textures until the pool is
+            within \a budget bytes. Textures which are in use are never
+            deleted.
+         */
+        void trim(unsigned budget)
+        {
+            unsigned total = bytes();
+            while (total > budget) {
+                auto lru = m_entries.end();
+                for (auto i = m_entries.begin(); i != m_entries.end(); ++i) {
+                    if (!i->used && (lru == m_entries.end() || i->lastUsed < lru->lastUsed))
+                        lru = i;
+                }
+                if (lru == m_entries.end())
+                    break;
+                total -= bytesOf(*lru);
+                destroy(*lru);
+                m_entries.erase(lru);
             }
         }
+
+        void frameSwapped()
+        {
+            ++m_frame;
+            trim(m_budget);
+        }
+
+        /*!
+            Sets the number of bytes the pool can hold before free textures
+            are deleted at the end of a frame.
+         */
+        void setBudget(unsigned bytes) { m_budget = bytes; }
+        unsigned budget() const { return m_budget; }
+
+        unsigned bytes() const
+        {
+            unsigned total = 0;
+            for (const Entry &e : m_entries)
+                total += bytesOf(e);
+            return total;
+        }
+        unsigned textureCount() const { return m_entries.size(); }
+
+    private:
+        static unsigned bytesOf(const Entry &e) {
+            return e.size.x * e.size.y * ((e.format == GL_RED ? 1 : 4) + (e.stencil ? 1 : 0));
+        }
+
+        static void attachStencil(Entry *e)
+        {
+            glGenRenderbuffers(1, &e->stencil);
+            glBindRenderbuffer(GL_RENDERBUFFER, e->stencil);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8, e->size.x, e->size.y);
+            glBindFramebuffer(GL_FRAMEBUFFER, e->fbo);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, e->stencil);
+        }
+
+        static void destroy(const Entry &e)
+        {
+            glDeleteFramebuffers(1, &e.fbo);
+            if (e.stencil)
+                glDeleteRenderbuffers(1, &e.stencil);
+            glDeleteTextures(1, &e.texture);
+        }
+
+        std::vector<Entry> m_entries;
+        unsigned m_budget;
+        unsigned m_frame;
     };
 
     struct Element {
         Node *node;
         unsigned vboOffset;         // offset into vbo for flattened, rect and layer nodes
         float z;                    // only valid when 'projection' is set
-        unsigned texture;           // only valid during rendering when 'layered' is set.
-        unsigned sourceTexture;     // only valid during rendering when 'layered' is set and we have a shadow node
-        unsigned groupSize : 29;    // The size of this group, used with 'projection' and 'layered'. Packed to ft into 32-bit
+        unsigned texture;           // only valid during rendering when 'layered' is set, or when 'cached' is set.
+        unsigned sourceTexture;     // as 'texture', when we have a shadow node
+        unsigned groupSize : 24;    // The size of this group, used with 'projection', 'layered' and 'clip'. Packed with the flags below
+                                    // to fit into 32-bit, so it is limited to MaxGroupSize.
                                     // The groupSize is the number of nodes inside the group, excluding the parent.
-        unsigned projection : 1;    // 3d subtree
+        unsigned projection : 1;    // 3d subtree, or a clip inside one
         unsigned layered : 1;       // subtree is flattened into a layer (texture)
         unsigned completed : 1;     // used during the actual rendering to know we're done with it
+        unsigned cached : 1;        // the layer's textures are kept for the next frame
+        unsigned clip : 1;          // subtree is clipped to the quad at vboOffset
+        unsigned stencil : 1;       // the clip is not axis aligned and uses the stencil buffer
+        unsigned instanced : 1;     // drawn from the quad's RectInstance rather than its vertices
+    };
+    /*!
+        A rectangle or texture node drawn as an instance of the unit quad. The
+        vertex shader places the quad's corners relative to the origin.
+     */
+    struct RectInstance {
+        vec2 origin;                // device space position of the top left corner
+        vec2 dx;                    // from the top left to the top right corner
+        vec2 dy;                    // from the top left to the bottom left corner
+        vec4 texRect;               // texture coordinates as x, y, width and height, only valid for textures
+        unsigned color;             // RGBA8, premultiplied, only valid for rectangles
+    };
+    struct VertexBuffer {
+        GLuint id;
+        unsigned size;              // in bytes
+        unsigned dirtyFirst;        // the vertices which are out of date in this buffer
+        unsigned dirtyLast;
+    };
+    /*!
+        The state of a traversal of the tree while the render list is built.
+        A parallel build gives each of its threads their own.
+     */
+    struct BuildState {
+        BuildState(const rect2d &viewport)
+            : vertexIndex(0)
+            , elementIndex(0)
+            , occluderIndex(0)
+            , farPlane(0)
+            , clipRect(viewport)
+            , render3d(false)
+            , layered(false)
+        {
+        }
+        unsigned vertexIndex;
+        unsigned elementIndex;
+        unsigned occluderIndex;     // the first occluder in front of the node being visited
+        mat4 m2d;                   // for the 2d world
+        mat4 m3d;                   // below a 3d projection subtree
+        float farPlane;
+        rect2d layerBoundingBox;
+        rect2d clipRect;            // the viewport intersected with the clips being built
+        bool render3d;
+        bool layered;
+    };
+    struct SubtreeStart {
+        Node *node;
+        BuildState state;           // as it is when the build reaches 'node'
+    };
+    /*!
+        The back-to-front order of the elements drawn by a 3D subtree. It is
+        kept for as long as the elements are. Any change inside the subtree
+        rebuilds it as a whole, which drops the order, so a kept order is
+        always up to date.
+     */
+    struct DepthOrder {
+        unsigned element;               // index of the projection element
+        std::vector<unsigned> order;    // indices of the elements it draws
+    };
 
-        bool operator<(const Element &e) const { return e.completed || z < e.z; }
+    /*!
+        A timestamp taken on the GPU, with a timer query, at the start or end
+        of a phase of a frame.
+     */
+    struct GpuTimestamp {
+        enum Type {
+            FrameStart,
+            FrameEnd,
+            LayerStart,
+            LayerContentEnd,    // the children are drawn, the blur is next
+            LayerEnd
+        };
+        Type type;
+        const Node *node;
+        GLuint query;
+    };
+    struct GpuTimer {
+        unsigned frame;
+        std::vector<GpuTimestamp> timestamps;
+    };
+    struct Occluder {
+        Node *node;                 // only compared against, may be gone by the next frame
+        rect2d rect;                // device space, the whole pixels it covers
+        unsigned element;           // the node's element, set during build
+    };
+    // The last values set for a uniform of a program
+    struct UniformValue {
+        int location;
+        float values[16];
     };
     struct Program : OpenGLShaderProgram {
         int matrix;
+        std::vector<UniformValue> uniformValues;   // one per uniform set so far, a handful at most
+    };
+    enum {
+        // Must match the size of the 'k' array in the blur shaders, which
+        // holds two tap pairs per vec4.
+        MaxBlurKernelRadius = 64,
+        // The largest value the 24-bit Element::groupSize can hold
+        MaxGroupSize = (1 << 24) - 1
+    };
+    /*!
+        A normalized, symmetric gaussian kernel. Neighbouring weights are
+        merged into pairs which are sampled with a single linearly
+        interpolated fetch on each side of the center.
+     */
+    struct BlurKernel {
+        int pairs;                                  // 0 until computed
+        float center;                               // weight of the center tap
+        vec4 taps[MaxBlurKernelRadius / 4];         // offset and weight of two pairs each
     };
     enum ProgramUpdate {
-        UpdateSolidProgram          = 0x01,
-        UpdateTextureProgram        = 0x02,
-        UpdateTextureBgrProgram     = 0x04,
-        UpdateAlphaTextureProgram   = 0x08,
-        UpdateColorFilterProgram    = 0x10,
-        UpdateBlurProgram           = 0x20,
-        UpdateShadowProgram         = 0x40,
-        UpdateAllPrograms           = 0xffffffff
+        UpdateSolidProgram               = 0x01,
+        UpdateTextureProgram             = 0x02,
+        UpdateTextureBgrProgram          = 0x04,
+        UpdateAlphaTextureProgram        = 0x08,
+        UpdateColorFilterProgram         = 0x10,
+        UpdateBlurProgram                = 0x20,
+        UpdateShadowProgram              = 0x40,
+        UpdateShadowAlphaProgram         = 0x80,
+        UpdateSolidInstancedProgram      = 0x100,
+        UpdateTextureInstancedProgram    = 0x200,
+        UpdateTextureBgrInstancedProgram = 0x400,
+        UpdateAllPrograms                = 0xffffffff
     };
 
     OpenGLRenderer();
@@ -106,45 +545,230 @@ public:
 
     void initialize() override;
     bool render() override;
-    void frameSwapped() override { m_texturePool.compact(); }
+    void frameSwapped() override { m_texturePool.frameSwapped(); collectReadbacks(); }
     bool readPixels(int x, int y, int w, int h, unsigned *pixels) override;
 
-    void prepass(Node *n);
-    void build(Node *n);
-    void drawColorQuad(unsigned bufferOffset, vec4 color);
-    void drawTextureQuad(unsigned bufferOffset, GLuint texId, float opacity = 1.0, Texture::Format format = Texture::RGBA_32);
+    /*!
+        Reads back into a pixel buffer object without waiting for the GPU.
+        The future is fulfilled once the next frame has been swapped and the
+        GPU is done with the readback, or by finishReadbacks(). Falls back to
+        readPixels() when pixel buffer objects can't be mapped, see
+        readbackSupported().
+     */
+    std::future<std::vector<unsigned>> readPixelsAsync(int x, int y, int w, int h) override;
+
+    /*!
+        Copies out the pixels of all readbacks started with
+        readPixelsAsync() and fulfills their futures. This waits for the GPU
+        if it is not done with them yet.
+     */
+    void finishReadbacks();
+    bool readbackSupported() const { return m_mapBufferRange != 0; }
+
+    /*!
+        Returns true if GPU timing, see setGpuTimingEnabled(), is supported.
+        This requires OpenGL 3.3, GL_ARB_timer_query or
+        GL_EXT_disjoint_timer_query.
+     */
+    bool gpuTimingSupported() const { return m_queryCounter != 0; }
+
+    /*!
+        The arena holding the element and vertex lists. Use it to tune the
+        shrink policy or to query how much memory the render lists use.
+     */
+    FrameArena *frameArena() { return &m_frameArena; }
+    const FrameArena *frameArena() const { return &m_frameArena; }
+
+    /*!
+        The pool holding the layer textures. Use it to adjust the budget or
+        to trim the pool when the system is low on memory.
+     */
+    TexturePool *texturePool() { return &m_texturePool; }
+    const TexturePool *texturePool() const { return &m_texturePool; }
+
+    /*!
+        The number of bytes of vertex data uploaded in the last frame.
+     */
+    unsigned vertexBytesUploaded() const { return m_frameStats.vertexBytesUploaded; }
+
+    /*!
+        The number of GL calls which were skipped in the last frame because
+        they would not have changed the state: shader program, uniform,
+        texture, blend, viewport and vertex attribute changes.
+     */
+    unsigned redundantStateChanges() const { return m_frameStats.redundantStateChanges; }
+
+    /*!
+        When enabled, opaque rectangles and textures are drawn first, front to
+        back with depth writes and without blending, so that the GPU can skip
+        the pixels they cover in everything behind them. The translucent
+        elements are then drawn back to front with depth testing. This
+        requires a depth buffer and is not used for frames with 3D subtrees
+        or render nodes.
+     */
+    void setOpaquePassEnabled(bool enabled) { m_opaquePass = enabled; }
+    bool opaquePassEnabled() const { return m_opaquePass; }
+
+    /*!
+        When enabled, createTextureFromImageData() places textures of up to
+        RENGINE_OPENGL_ATLAS_MAX_TEXTURE_SIZE pixels in shared atlases, so
+        that nodes using different textures can still be batched. The
+        textureId() of such a texture is the atlas and it must be sampled
+        through its subRect(). The atlas can also be compacted, which
+        changes its textureId(), so don't enable this when textures are
+        bound directly, for instance by render nodes. Disabled by default.
+     */
+    void setTextureAtlasEnabled(bool enabled) { m_textureAtlas = enabled; }
+    bool textureAtlasEnabled() const { return m_textureAtlas; }
+
+    /*!
+        When enabled, the textures of opacity, color filter, blur and shadow
+        layers are kept between frames and only rendered again when their
+        subtree changes. Changing the opacity or color matrix of a layer
+        reuses its content. The renderer can't see textures whose content
+        changes in place, like a texture which is uploaded to again or which
+        is rendered to, so call markDirty() on the texture nodes using them
+        when they do. Layers containing render nodes are never cached.
+        Disabled by default.
+     */
+    void setLayerCachingEnabled(bool enabled);
+    bool layerCachingEnabled() const { return m_layerCaching; }
+
+    /*!
+        When enabled, rectangles and textures outside 3D subtrees are drawn as
+        instances of a shared unit quad. Each node then gets a single
+        RectInstance with its position, color and texture coordinates instead
+        of per-vertex colors and texture coordinates, and batches are no
+        longer limited by the size of the quad index buffer. This requires
+        OpenGL 3.3, OpenGL ES 3.0 or the instanced arrays extensions and the
+        per-vertex path is used when they are not available.
+     */
+    void setInstancingEnabled(bool enabled);
+    bool instancingEnabled() const { return m_instancing; }
+    bool instancingSupported() const { return m_drawArraysInstanced != 0; }
+
+    /*!
+        Sets the number of threads, including the render thread, which build
+        the render list when the whole tree is rebuilt. The root's children
+        are split into runs which are built in parallel, each straight into
+        its part of the element and vertex lists, so the result is the same
+        as when built on the render thread. This is only done for trees with
+        at least RENGINE_OPENGL_PARALLEL_BUILD_MIN_ELEMENTS elements whose
+        root is a plain node or a 2D transform. The default is 1.
+     */
+    void setBuildThreadCount(unsigned count);
+    unsigned buildThreadCount() const { return m_buildPool ? m_buildPool->threadCount() : 1; }
+
+    void prepass(BuildState &s, Node *n);
+    void findOccluders(BuildState &s, Node *root);
+    void collectOccluders(BuildState &s, Node *n);
+    bool isOccluder(const BuildState &s, Node *n, rect2d *rect) const;
+    bool isOccluded(const BuildState &s, Node *n) const;
+    bool passOccluder(BuildState &s, Node *n);
+    bool containsOccluder(const Node::RenderRange &range) const;
+    rect2d subtreeBounds(Node *n);
+    bool isOffscreen(const BuildState &s, Node *n);
+    void clearUpdates(Node *n);
+    rect2d clipBoundsFor(const BuildState &s, Node *n) const;
+    void build(BuildState &s, Node *n);
+    void buildNode(BuildState &s, Node *n);
+    bool update(BuildState &s, Node *n);
+    bool rebuild(BuildState &s, Node *n);
+    bool isParallelBuildRoot(Node *root) const;
+    void prepassSubtrees(BuildState &s, Node *root);
+    void buildSubtrees(Node *root);
+    void recount();
+    bool isLayered(Node *n) const;
+    unsigned requiredElementCount() const { return m_numLayeredNodes + m_numTextureNodes + m_numRectangleNodes + m_numTransformNodesWith3d + m_numRenderNodes + m_numClipNodes; }
+    unsigned requiredVertexCount() const { return (m_numTextureNodes + m_numLayeredNodes + m_numRectangleNodes + m_numClipNodes + m_additionalQuads) * 4; }
+    void setVertexOffset(unsigned offset);
+    void setInstanceOffset(unsigned offset);
+    void resetAttribDivisors();
+    unsigned instanceBufferOffset() const { return m_vertexCount * (2 * sizeof(vec2) + sizeof(unsigned)); }
+    void markVerticesDirty(unsigned first, unsigned last);
+    void uploadVertices();
+    Element *drawColorBatch(Element *first, Element *last);
+    Element *drawTextureBatch(Element *first, Element *last);
+    void drawLayerQuad(unsigned bufferOffset, GLuint texId, float opacity = 1.0, unsigned downsampling = 1);
     void drawColorFilterQuad(unsigned bufferOffset, GLuint texId, mat4 cm);
-    void drawBlurQuad(unsigned bufferOffset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step);
-    void drawShadowQuad(unsigned bufferOffset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, vec4 color);
+    struct BlurProgram;
+    void drawBlurQuad(unsigned bufferOffset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, unsigned downsampling = 1);
+    GLuint downsampleShadowContent(Element *e, GLuint texId, vec2 contentSize, unsigned downsampling);
+    void drawShadowAlphaQuad(unsigned bufferOffset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, unsigned downsampling);
+    void drawBlurPass(BlurProgram *p, unsigned bufferOffset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, unsigned downsampling);
+    static unsigned blurDownsampling(unsigned radius, unsigned maxRadius);
+    static unsigned blurDownsampling(const BlurNode *node);
+    static unsigned blurDownsampling(const ShadowNode *node);
+    const BlurKernel &blurKernel(unsigned radius);
+    void drawShadowQuad(unsigned bufferOffset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, unsigned downsampling, vec4 color);
     void activateShader(const Program *shader);
-    void projectQuad(vec2 a, vec2 b, vec2 *v);
+    void projectQuad(const BuildState &s, vec2 a, vec2 b, vec2 *v) const;
     void render(Element *first, Element *last);
+    void renderLayers(Element *first, Element *last);
+    void drawElements(Element *first, Element *last);
+    void drawOpaqueElements(Element *first, Element *last);
+    void drawClippedElements(Element *e);
+    void drawProjectedElements(Element *e);
+    DepthOrder &depthOrderFor(Element *e);
+    void sortByDepth(Element *e, std::vector<unsigned> &order);
+    void releaseDepthOrders(unsigned first, unsigned last);
+    void beginGpuTimer();
+    void markGpuTime(GpuTimestamp::Type type, const Node *node = 0);
+    void endGpuTimer();
+    void collectGpuTimers();
+    void finishStats(std::chrono::steady_clock::time_point renderStart);
+    void drawClipQuad(unsigned bufferOffset);
+    rect2d windowRectFor(rect2d deviceRect) const;
+    bool isOpaque(const Element *e) const;
+    void setDepthFor(const Element *e);
     void renderToLayer(Element *e);
+    void releaseLayer(Element *e);
+    void releaseLayers(Element *first, Element *last);
     void setDefaultOpenGLState();
     rect2d boundingRectFor(unsigned vertexOffset) const { return rect2d(m_vertices[vertexOffset], m_vertices[vertexOffset + 3]); }
+    rect2d boundingRectFor(const Node::RenderRange &range) const;
+    bool isInstanced(unsigned quad) const { return m_instances && (m_instances[quad].dx != vec2() || m_instances[quad].dy != vec2()); }
+    rect2d damageForFrame(bool full);
 
     void ensureMatrixUpdated(ProgramUpdate bit, Program *p);
+    bool uniformChanged(Program *p, int location, const float *values, unsigned count);
+    void setUniform(Program *p, int location, float value);
+    void setUniform(Program *p, int location, vec2 value);
+    void setUniform(Program *p, int location, vec4 value);
+    void setUniform(Program *p, int location, const mat4 &value);
+    void setBlurKernel(BlurProgram *p, unsigned radius);
+    void bindTexture(GLuint texId);
+    void setBlending(bool enabled);
+    void setViewport(vec2 size);
+    void resetStateCache();
 
     Program prog_texture;
     Program prog_texture_bgr;
     struct : public Program {
         int alpha;
+        int texScale;
     } prog_alphaTexture;
-    struct : public Program {
-        int color;
-    } prog_solid;
+    Program prog_solid;
+    Program prog_solidInstanced;
+    Program prog_textureInstanced;
+    Program prog_textureInstancedBgr;
     struct : public Program {
         int colorMatrix;
+        int texScale;
     } prog_colorFilter;
     struct BlurProgram : public Program {
+        unsigned kernelRadius;      // the radius of the uploaded kernel, 0 before the first upload
         int dims;
-        int radius;
-        int sigma;
+        int kernel;
+        int center;
+        int pairs;
         int step;
+        int texScale;
     } prog_blur;
     struct : public BlurProgram {
         int color;
     } prog_shadow;
+    BlurProgram prog_shadowAlpha;
 
     unsigned m_numLayeredNodes;
     unsigned m_numTextureNodes;
@@ -152,52 +776,228 @@ public:
     unsigned m_numTransformNodes;
     unsigned m_numTransformNodesWith3d;
     unsigned m_numRenderNodes;
+    unsigned m_numClipNodes;
     unsigned m_additionalQuads;
+    unsigned m_numOccludedNodes;
 
-    unsigned m_vertexIndex;
-    unsigned m_elementIndex;
+    unsigned m_vertexCount;
+    unsigned m_elementCount;
     vec2 *m_vertices;
+    vec2 *m_texCoords;          // one per vertex, not used by rectangles
+    unsigned *m_colors;         // RGBA8, premultiplied, one per vertex, only valid for rectangles
+    RectInstance *m_instances;  // one per quad, only allocated when instancing is in use, empty for quads which aren't instanced
     Element *m_elements;
+    FrameArena m_frameArena;
+    Node *m_retainedRoot;
     mat4 m_proj;
-    mat4 m_m2d;    // for the 2d world
-    mat4 m_m3d;    // below a 3d projection subtree
-    float m_farPlane;
-    rect2d m_layerBoundingBox;
     vec2 m_surfaceSize;
+    rect2d m_viewport;          // nodes entirely outside it are culled during build
+    rect2d m_scissorRect;       // in window coordinates, valid when 'm_scissor' is set
+
+    rect2d m_frameDamage;       // accumulated by rebuild() while damage tracking
+    rect2d m_damageHistory[RENGINE_OPENGL_DAMAGE_HISTORY];
+    vec4 m_damageFillColor;
 
     TexturePool m_texturePool;
 
     const Program *m_activeShader;
-    GLuint m_texCoordBuffer;
-    GLuint m_vertexBuffer;
+    VertexBuffer m_vertexBuffers[RENGINE_OPENGL_VERTEX_BUFFER_COUNT];
+    unsigned m_currentVertexBuffer;
+    unsigned m_previousVertexBytes;
+    RenderStats m_frameStats;               // collected while rendering, see Renderer::stats()
+    GLenum m_shadowFormat;
+
+    // The GL state as last set by the renderer, to skip redundant calls
+    GLuint m_boundTexture;
+    GLuint m_attribBuffer;
+    unsigned m_attribOffset;
+    unsigned m_attribVertexCount;
+    vec2 m_viewportSize;
+    GLuint m_quadIndexBuffer;
+    GLuint m_unitQuadBuffer;    // the corners of the unit quad, for instanced drawing
+
+    RenginePFNGLDrawArraysInstanced m_drawArraysInstanced;
+    RenginePFNGLVertexAttribDivisor m_vertexAttribDivisor;
+    RenginePFNGLMapBufferRange m_mapBufferRange;
+    RenginePFNGLUnmapBuffer m_unmapBuffer;
+    RenginePFNGLFenceSync m_fenceSync;
+    RenginePFNGLClientWaitSync m_clientWaitSync;
+    RenginePFNGLDeleteSync m_deleteSync;
+
+    // A readback started by readPixelsAsync(), to be copied out when its
+    // pixel buffer object has been filled
+    struct Readback {
+        GLuint buffer;
+        int width;
+        int height;
+        unsigned frame;     // the last frame rendered before it was started
+        void *fence;        // signalled when the buffer is filled, 0 without fences
+        std::promise<std::vector<unsigned>> promise;
+    };
+    void completeReadback(Readback &r);
+    void collectReadbacks();
+    std::vector<Readback> m_readbacks;
+    std::vector<GLuint> m_readbackBuffers;  // pixel buffer objects not in use
+
+    RenginePFNGLGenQueries m_genQueries;
+    RenginePFNGLDeleteQueries m_deleteQueries;
+    RenginePFNGLQueryCounter m_queryCounter;
+    RenginePFNGLGetQueryObjectiv m_getQueryObjectiv;
+    RenginePFNGLGetQueryObjectui64v m_getQueryObjectui64v;
+
+    std::vector<GpuTimer> m_gpuTimers;      // frames waiting for their queries, oldest first
+    std::vector<GLuint> m_freeQueries;
+    unsigned m_gpuFrame;
+    bool m_gpuTimerActive;                  // the current frame is timed
+
+    std::vector<std::shared_ptr<OpenGLTextureAtlas>> m_atlases;
+
+    std::vector<Occluder> m_occluders;      // in paint order
+    std::vector<BlurKernel> m_blurKernels;  // indexed by radius
+    std::vector<SubtreeStart> m_subtrees;   // the root's children, for a parallel build
+    std::vector<DepthOrder> m_depthOrders;  // sorted on 'element'
+    std::vector<unsigned> m_depthKeys;      // indexed by element, scratch for sortByDepth()
+    std::vector<unsigned> m_depthScratch;
+    std::unique_ptr<ThreadPool> m_buildPool;
     GLuint m_fbo;
 
     unsigned m_matrixState;
+    unsigned m_stencilDepth;    // the number of stencil clips currently applied
 
     bool m_render3d : 1;
     bool m_layered : 1;
     bool m_srgb : 1;
+    bool m_scissor : 1;
+    bool m_opaquePass : 1;
+    bool m_depthTest : 1;
+    bool m_hasDepthBuffer : 1;
+    bool m_hasStencilBuffer : 1;
+    bool m_blending : 1;
+    bool m_instancing : 1;
+    bool m_attribDivisors : 1;  // the attributes are set up for instanced drawing
+    bool m_textureAtlas : 1;
+    bool m_layerCaching : 1;
 
 };
 
-inline void OpenGLRenderer::projectQuad(vec2 a, vec2 b, vec2 *v)
+inline void OpenGLRenderer::projectQuad(const BuildState &s, vec2 a, vec2 b, vec2 *v) const
 {
     // The steps involved in each line is as follows.:
     // pt_3d = matrix3D * pt                 // apply the 3D transform
     // pt_proj = pt_3d.project2D()           // project it to 2D based on current farPlane
     // pt_screen = parent_matrix * pt_proj   // Put the output of our local 3D into the scene world coordinate system
-    v[0] = m_m2d * ((m_m3d * vec3(a))       .project2D(m_farPlane));    // top left
-    v[1] = m_m2d * ((m_m3d * vec3(a.x, b.y)).project2D(m_farPlane));    // bottom left
-    v[2] = m_m2d * ((m_m3d * vec3(b.x, a.y)).project2D(m_farPlane));    // top right
-    v[3] = m_m2d * ((m_m3d * vec3(b))       .project2D(m_farPlane));    // bottom right
+    v[0] = s.m2d * ((s.m3d * vec3(a))       .project2D(s.farPlane));    // top left
+    v[1] = s.m2d * ((s.m3d * vec3(a.x, b.y)).project2D(s.farPlane));    // bottom left
+    v[2] = s.m2d * ((s.m3d * vec3(b.x, a.y)).project2D(s.farPlane));    // top right
+    v[3] = s.m2d * ((s.m3d * vec3(b))       .project2D(s.farPlane));    // bottom right
 }
 
 inline void OpenGLRenderer::ensureMatrixUpdated(ProgramUpdate bit, Program *p)
 {
     if (m_matrixState & bit) {
         m_matrixState &= ~bit;
-        glUniformMatrix4fv(p->matrix, 1, true, m_proj.m);
+        setUniform(p, p->matrix, m_proj);
+    }
+}
+
+/*!
+    Returns true if \a values differ from what was last set for the uniform
+    at \a location in \a p and stores them. Counts the call as redundant
+    otherwise. The locations are up to the driver and need not be small or
+    dense, so the values are looked up by location among the few uniforms
+    the program has.
+ */
+inline bool OpenGLRenderer::uniformChanged(Program *p, int location, const float *values, unsigned count)
+{
+    assert(location >= 0);
+    assert(count <= 16);
+    auto it = std::find_if(p->uniformValues.begin(), p->uniformValues.end(), [location](const UniformValue &u) {
+        return u.location == location;
+    });
+    if (it == p->uniformValues.end()) {
+        UniformValue u;
+        u.location = location;
+        std::fill(u.values, u.values + 16, std::numeric_limits<float>::quiet_NaN());
+        it = p->uniformValues.insert(it, u);
+    }
+    float *cached = it->values;
+    if (std::memcmp(cached, values, count * sizeof(float)) == 0) {
+        ++m_frameStats.redundantStateChanges;
+        return false;
+    }
+    std::memcpy(cached, values, count * sizeof(float));
+    return true;
+}
+
+inline void OpenGLRenderer::setUniform(Program *p, int location, float value)
+{
+    if (uniformChanged(p, location, &value, 1))
+        glUniform1f(location, value);
+}
+
+inline void OpenGLRenderer::setUniform(Program *p, int location, vec2 value)
+{
+    float v[] = { value.x, value.y };
+    if (uniformChanged(p, location, v, 2))
+        glUniform2f(location, value.x, value.y);
+}
+
+inline void OpenGLRenderer::setUniform(Program *p, int location, vec4 value)
+{
+    float v[] = { value.x, value.y, value.z, value.w };
+    if (uniformChanged(p, location, v, 4))
+        glUniform4f(location, value.x, value.y, value.z, value.w);
+}
+
+inline void OpenGLRenderer::setUniform(Program *p, int location, const mat4 &value)
+{
+    if (uniformChanged(p, location, value.m, 16))
+        glUniformMatrix4fv(location, 1, true, value.m);
+}
+
+inline void OpenGLRenderer::bindTexture(GLuint texId)
+{
+    if (texId == m_boundTexture) {
+        ++m_frameStats.redundantStateChanges;
+        return;
+    }
+    glBindTexture(GL_TEXTURE_2D, texId);
+    m_boundTexture = texId;
+    ++m_frameStats.textureBinds;
+}
+
+inline void OpenGLRenderer::setBlending(bool enabled)
+{
+    if (enabled == m_blending) {
+        ++m_frameStats.redundantStateChanges;
+        return;
+    }
+    if (enabled)
+        glEnable(GL_BLEND);
+    else
+        glDisable(GL_BLEND);
+    m_blending = enabled;
+}
+
+inline void OpenGLRenderer::setViewport(vec2 size)
+{
+    if (size == m_viewportSize) {
+        ++m_frameStats.redundantStateChanges;
+        return;
     }
+    glViewport(0, 0, size.x, size.y);
+    m_viewportSize = size;
+}
+
+/*!
+    Forgets the cached texture, viewport and vertex attribute state. Called
+    when code outside the renderer may have changed it.
+ */
+inline void OpenGLRenderer::resetStateCache()
+{
+    m_boundTexture = ~GLuint(0);
+    m_attribBuffer = 0;
+    m_viewportSize = vec2(-1, -1);
 }
 
 inline OpenGLRenderer::OpenGLRenderer()
@@ -206,43 +1006,200 @@ inline OpenGLRenderer::OpenGLRenderer()
     , m_numRectangleNodes(0)
     , m_numTransformNodes(0)
     , m_numTransformNodesWith3d(0)
+    , m_numRenderNodes(0)
+    , m_numClipNodes(0)
     , m_additionalQuads(0)
-    , m_vertexIndex(0)
-    , m_elementIndex(0)
+    , m_numOccludedNodes(0)
+    , m_vertexCount(0)
+    , m_elementCount(0)
     , m_vertices(0)
+    , m_texCoords(0)
+    , m_colors(0)
+    , m_instances(0)
     , m_elements(0)
-    , m_farPlane(0)
+    , m_retainedRoot(0)
     , m_activeShader(0)
-    , m_texCoordBuffer(0)
-    , m_vertexBuffer(0)
+    , m_currentVertexBuffer(0)
+    , m_previousVertexBytes(0)
+    , m_shadowFormat(GL_RGBA)
+    , m_boundTexture(0)
+    , m_attribBuffer(0)
+    , m_attribOffset(0)
+    , m_attribVertexCount(0)
+    , m_quadIndexBuffer(0)
+    , m_unitQuadBuffer(0)
+    , m_drawArraysInstanced(0)
+    , m_vertexAttribDivisor(0)
+    , m_mapBufferRange(0)
+    , m_unmapBuffer(0)
+    , m_fenceSync(0)
+    , m_clientWaitSync(0)
+    , m_deleteSync(0)
+    , m_genQueries(0)
+    , m_deleteQueries(0)
+    , m_queryCounter(0)
+    , m_getQueryObjectiv(0)
+    , m_getQueryObjectui64v(0)
+    , m_gpuFrame(0)
+    , m_gpuTimerActive(false)
     , m_fbo(0)
     , m_matrixState(UpdateAllPrograms)
+    , m_stencilDepth(0)
     , m_render3d(false)
     , m_layered(false)
     , m_srgb(false)
+    , m_scissor(false)
+    , m_opaquePass(false)
+    , m_depthTest(false)
+    , m_hasDepthBuffer(false)
+    , m_hasStencilBuffer(false)
+    , m_blending(false)
+    , m_instancing(false)
+    , m_attribDivisors(false)
+    , m_textureAtlas(false)
+    , m_layerCaching(false)
 {
     initialize();
 }
 
 inline OpenGLRenderer::~OpenGLRenderer()
 {
-    glDeleteBuffers(1, &m_texCoordBuffer);
-    glDeleteBuffers(1, &m_vertexBuffer);
+    releaseLayers(m_elements, m_elements + m_elementCount);
+
+    finishReadbacks();
+    if (!m_readbackBuffers.empty())
+        glDeleteBuffers(m_readbackBuffers.size(), m_readbackBuffers.data());
+
+    for (const GpuTimer &timer : m_gpuTimers)
+        for (const GpuTimestamp &t : timer.timestamps)
+            m_freeQueries.push_back(t.query);
+    if (!m_freeQueries.empty())
+        m_deleteQueries(m_freeQueries.size(), m_freeQueries.data());
+
+    for (VertexBuffer &b : m_vertexBuffers)
+        glDeleteBuffers(1, &b.id);
+    glDeleteBuffers(1, &m_quadIndexBuffer);
+    if (m_unitQuadBuffer)
+        glDeleteBuffers(1, &m_unitQuadBuffer);
 
     assert(m_fbo == 0);
 }
 
 inline bool OpenGLRenderer::readPixels(int x, int y, int w, int h, unsigned *bytes)
 {
-    // Read line-by-line and flip it so we get what we want out..
-    // Slow as hell, but this is used for autotesting, so who cares..
-    for (int i=0; i<h; ++i)
-        glReadPixels(x, y + h - i - 1, w, 1, GL_RGBA, GL_UNSIGNED_BYTE, bytes + i * w);
+    glReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, bytes);
+    rengine_flipRows(bytes, w, h);
     return true;
 }
 
+inline std::future<std::vector<unsigned>> OpenGLRenderer::readPixelsAsync(int x, int y, int w, int h)
+{
+    if (!readbackSupported())
+        return Renderer::readPixelsAsync(x, y, w, h);
+
+    Readback r;
+    r.width = w;
+    r.height = h;
+    r.frame = stats().frame;
+    if (m_readbackBuffers.empty()) {
+        glGenBuffers(1, &r.buffer);
+    } else {
+        r.buffer = m_readbackBuffers.back();
+        m_readbackBuffers.pop_back();
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, w * h * sizeof(unsigned), 0, GL_STREAM_READ);
+    glReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    r.fence = m_fenceSync ? m_fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+
+    std::future<std::vector<unsigned>> future = r.promise.get_future();
+    m_readbacks.push_back(std::move(r));
+    return future;
+}
+
+/*!
+    Maps the pixel buffer object of \a r, copies the pixels out and
+    fulfills its future. This waits for the GPU if it is not done yet.
+ */
+inline void OpenGLRenderer::completeReadback(Readback &r)
+{
+    std::vector<unsigned> pixels(r.width * r.height);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer);
+    const unsigned *data = (const unsigned *) m_mapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixels.size() * sizeof(unsigned), GL_MAP_READ_BIT);
+    if (data) {
+        // Flip it while copying out, as GL has the bottom row first
+        for (int i=0; i<r.height; ++i)
+            std::memcpy(pixels.data() + i * r.width, data + (r.height - i - 1) * r.width, r.width * sizeof(unsigned));
+        m_unmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        logw << "failed to map pixel buffer object" << std::endl;
+        pixels.clear();
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (r.fence)
+        m_deleteSync(r.fence);
+    r.promise.set_value(std::move(pixels));
+    m_readbackBuffers.push_back(r.buffer);
+}
+
+inline void OpenGLRenderer::finishReadbacks()
+{
+    for (Readback &r : m_readbacks)
+        completeReadback(r);
+    m_readbacks.clear();
+}
+
+/*!
+    Completes the readbacks which can be mapped without stalling. These were
+    started before the frame which was just swapped, so the GPU has had that
+    frame to fill them, and their fence has been signalled if there is one.
+ */
+inline void OpenGLRenderer::collectReadbacks()
+{
+    unsigned frame = stats().frame;
+    auto pending = std::remove_if(m_readbacks.begin(), m_readbacks.end(), [this, frame](Readback &r) {
+        if (r.frame >= frame)
+            return false;
+        if (r.fence) {
+            GLenum status = m_clientWaitSync(r.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                return false;
+        }
+        completeReadback(r);
+        return true;
+    });
+    m_readbacks.erase(pending, m_readbacks.end());
+}
+
+/*!
+    Creates a texture from \a data. When enabled, see
+    setTextureAtlasEnabled(), small textures are placed in a shared atlas.
+ */
 inline Texture *OpenGLRenderer::createTextureFromImageData(vec2 size, Texture::Format format, void *data)
 {
+    if (m_textureAtlas
+        && size.x <= RENGINE_OPENGL_ATLAS_MAX_TEXTURE_SIZE && size.y <= RENGINE_OPENGL_ATLAS_MAX_TEXTURE_SIZE) {
+        for (auto atlas : m_atlases) {
+            if (atlas->format() != format)
+                continue;
+            bool compacted = false;
+            OpenGLAtlasTexture *texture = atlas->create(size, data, &compacted);
+            // Compacting moves the other textures, so the texture coordinates
+            // in the retained render list are no longer valid.
+            if (compacted)
+                m_retainedRoot = 0;
+            if (texture)
+                return texture;
+        }
+        std::shared_ptr<OpenGLTextureAtlas> atlas = std::make_shared<OpenGLTextureAtlas>(RENGINE_OPENGL_ATLAS_SIZE, format);
+        m_atlases.push_back(atlas);
+        bool compacted = false;
+        OpenGLAtlasTexture *texture = atlas->create(size, data, &compacted);
+        assert(texture);
+        return texture;
+    }
+
     OpenGLTexture *texture = new OpenGLTexture();
     texture->setFormat(format);
     texture->upload(size.x, size.y, data);
@@ -251,23 +1208,44 @@ inline Texture *OpenGLRenderer::createTextureFromImageData(vec2 size, Texture::F
 
 inline void OpenGLRenderer::initialize()
 {
-    {   // Create a texture coordinate buffer
-        const float data[] = { 0, 0, 0, 1, 1, 0, 1, 1 };
-        glGenBuffers(1, &m_texCoordBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
-        glBufferData(GL_ARRAY_BUFFER, 8 * sizeof(float), data, GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    {   // Create the index buffer used to draw batches of quads as triangles
+        std::vector<unsigned short> data(RENGINE_OPENGL_MAX_BATCH_QUADS * 6);
+        for (unsigned i=0; i<RENGINE_OPENGL_MAX_BATCH_QUADS; ++i) {
+            unsigned short *q = data.data() + i * 6;
+            unsigned short v = i * 4;
+            q[0] = v;
+            q[1] = v + 1;
+            q[2] = v + 2;
+            q[3] = v + 2;
+            q[4] = v + 1;
+            q[5] = v + 3;
+        }
+        glGenBuffers(1, &m_quadIndexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadIndexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.size() * sizeof(unsigned short), data.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     }
 
-    // Create the vertex coordinate buffer
-    glGenBuffers(1, &m_vertexBuffer);
+    // Create the vertex buffers. They hold the vertex coordinates, followed
+    // by the texture coordinates, the colors and, when instancing, one
+    // RectInstance per quad.
+    for (VertexBuffer &b : m_vertexBuffers) {
+        glGenBuffers(1, &b.id);
+        b.size = 0;
+        b.dirtyFirst = 0;
+        b.dirtyLast = 0;
+    }
 
     std::vector<const char *> attrsVT;
     attrsVT.push_back("aV");
     attrsVT.push_back("aT");
 
-    std::vector<const char *> attrsV;
-    attrsV.push_back("aV");
+    // The color goes into attribute 2 so that attribute 1 can stay
+    // assigned to the texture coordinates.
+    std::vector<const char *> attrsVTC;
+    attrsVTC.push_back("aV");
+    attrsVTC.push_back("aT");
+    attrsVTC.push_back("aC");
 
     // Default texture shader
     prog_texture.initialize(openglrenderer_vsh_texture(), openglrenderer_fsh_texture(), attrsVT);
@@ -278,37 +1256,77 @@ inline void OpenGLRenderer::initialize()
     prog_texture_bgr.matrix = prog_texture.resolve("m");
 
     // Alpha texture shader
-    prog_alphaTexture.initialize(openglrenderer_vsh_texture(), openglrenderer_fsh_texture_alpha(), attrsVT);
+    prog_alphaTexture.initialize(openglrenderer_vsh_texture_scaled(), openglrenderer_fsh_texture_alpha(), attrsVT);
     prog_alphaTexture.matrix = prog_alphaTexture.resolve("m");
     prog_alphaTexture.alpha = prog_alphaTexture.resolve("alpha");
+    prog_alphaTexture.texScale = prog_alphaTexture.resolve("ts");
 
     // Solid color shader...
-    prog_solid.initialize(openglrenderer_vsh_solid(), openglrenderer_fsh_solid(), attrsV);
+    prog_solid.initialize(openglrenderer_vsh_solid(), openglrenderer_fsh_solid(), attrsVTC);
     prog_solid.matrix = prog_solid.resolve("m");
-    prog_solid.color = prog_solid.resolve("color");
+
+    // Instanced shaders, the attributes follow the layout of RectInstance
+    std::vector<const char *> attrsInstanced;
+    attrsInstanced.push_back("aV");
+    attrsInstanced.push_back("aR");
+    attrsInstanced.push_back("aC");
+    attrsInstanced.push_back("aO");
+    attrsInstanced.push_back("aX");
+    attrsInstanced.push_back("aY");
+    prog_solidInstanced.initialize(openglrenderer_vsh_solid_instanced(), openglrenderer_fsh_solid(), attrsInstanced);
+    prog_solidInstanced.matrix = prog_solidInstanced.resolve("m");
+    prog_textureInstanced.initialize(openglrenderer_vsh_texture_instanced(), openglrenderer_fsh_texture(), attrsInstanced);
+    prog_textureInstanced.matrix = prog_textureInstanced.resolve("m");
+    prog_textureInstancedBgr.initialize(openglrenderer_vsh_texture_instanced(), openglrenderer_fsh_texture_bgra(), attrsInstanced);
+    prog_textureInstancedBgr.matrix = prog_textureInstancedBgr.resolve("m");
 
     // Color filter shader..
-    prog_colorFilter.initialize(openglrenderer_vsh_texture(), openglrenderer_fsh_texture_colorfilter(), attrsVT);
-    prog_colorFilter.matrix = prog_solid.resolve("m");
+    prog_colorFilter.initialize(openglrenderer_vsh_texture_scaled(), openglrenderer_fsh_texture_colorfilter(), attrsVT);
+    prog_colorFilter.matrix = prog_colorFilter.resolve("m");
     prog_colorFilter.colorMatrix = prog_colorFilter.resolve("CM");
+    prog_colorFilter.texScale = prog_colorFilter.resolve("ts");
 
     // Blur shader
     prog_blur.initialize(openglrenderer_vsh_blur(), openglrenderer_fsh_blur(), attrsVT);
     prog_blur.matrix = prog_blur.resolve("m");
     prog_blur.dims = prog_blur.resolve("dims");
-    prog_blur.radius = prog_blur.resolve("radius");
-    prog_blur.sigma = prog_blur.resolve("sigma");
+    prog_blur.kernel = prog_blur.resolve("k");
+    prog_blur.kernelRadius = 0;
+    prog_blur.center = prog_blur.resolve("k0");
+    prog_blur.pairs = prog_blur.resolve("pairs");
     prog_blur.step = prog_blur.resolve("step");
+    prog_blur.texScale = prog_blur.resolve("ts");
 
     // Shadow shader
     prog_shadow.initialize(openglrenderer_vsh_blur(), openglrenderer_fsh_shadow(), attrsVT);
     prog_shadow.matrix = prog_shadow.resolve("m");
     prog_shadow.dims = prog_shadow.resolve("dims");
-    prog_shadow.radius = prog_shadow.resolve("radius");
-    prog_shadow.sigma = prog_shadow.resolve("sigma");
+    prog_shadow.kernel = prog_shadow.resolve("k");
+    prog_shadow.kernelRadius = 0;
+    prog_shadow.center = prog_shadow.resolve("k0");
+    prog_shadow.pairs = prog_shadow.resolve("pairs");
     prog_shadow.step = prog_shadow.resolve("step");
+    prog_shadow.texScale = prog_shadow.resolve("ts");
     prog_shadow.color = prog_shadow.resolve("color");
 
+    // First pass of the shadow, blurs the alpha of the content
+    prog_shadowAlpha.initialize(openglrenderer_vsh_blur(), openglrenderer_fsh_shadow_alpha(), attrsVT);
+    prog_shadowAlpha.matrix = prog_shadowAlpha.resolve("m");
+    prog_shadowAlpha.dims = prog_shadowAlpha.resolve("dims");
+    prog_shadowAlpha.kernel = prog_shadowAlpha.resolve("k");
+    prog_shadowAlpha.kernelRadius = 0;
+    prog_shadowAlpha.center = prog_shadowAlpha.resolve("k0");
+    prog_shadowAlpha.pairs = prog_shadowAlpha.resolve("pairs");
+    prog_shadowAlpha.step = prog_shadowAlpha.resolve("step");
+    prog_shadowAlpha.texScale = prog_shadowAlpha.resolve("ts");
+
+    GLint depthBits = 0;
+    glGetIntegerv(GL_DEPTH_BITS, &depthBits);
+    m_hasDepthBuffer = depthBits > 0;
+    GLint stencilBits = 0;
+    glGetIntegerv(GL_STENCIL_BITS, &stencilBits);
+    m_hasStencilBuffer = stencilBits > 0;
+
     // Using srgb for everything needs a bit more thought as it results in
     // really washed out colors for rectangles and image textures.
     const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
@@ -316,6 +1334,88 @@ inline void OpenGLRenderer::initialize()
         m_srgb = true;
         // glEnable(GL_FRAMEBUFFER_SRGB);
     }
+    // Shadows only need the alpha, which fits in a single channel texture
+    if (std::strstr(extensions, "GL_EXT_texture_rg") || std::strstr(extensions, "GL_ARB_texture_rg"))
+        m_shadowFormat = GL_RED;
+
+    // Instanced drawing
+    int major = 0;
+    int minor = 0;
+    if (const char *version = std::strpbrk((const char *) glGetString(GL_VERSION), "0123456789"))
+        sscanf(version, "%d.%d", &major, &minor);
+    const char *suffix = 0;
+#ifdef RENGINE_OPENGL_DESKTOP
+    if (major * 10 + minor >= 33)
+        suffix = "";
+    else if (std::strstr(extensions, "GL_ARB_instanced_arrays") && std::strstr(extensions, "GL_ARB_draw_instanced"))
+        suffix = "ARB";
+#else
+    if (major >= 3)
+        suffix = "";
+    else if (std::strstr(extensions, "GL_EXT_instanced_arrays"))
+        suffix = "EXT";
+    else if (std::strstr(extensions, "GL_ANGLE_instanced_arrays"))
+        suffix = "ANGLE";
+#endif
+    if (suffix) {
+        m_drawArraysInstanced = (RenginePFNGLDrawArraysInstanced) rengine_resolve_gl_function((std::string("glDrawArraysInstanced") + suffix).c_str());
+        m_vertexAttribDivisor = (RenginePFNGLVertexAttribDivisor) rengine_resolve_gl_function((std::string("glVertexAttribDivisor") + suffix).c_str());
+        if (!m_drawArraysInstanced || !m_vertexAttribDivisor) {
+            m_drawArraysInstanced = 0;
+            m_vertexAttribDivisor = 0;
+        }
+    }
+
+    // Asynchronous readback
+#ifdef RENGINE_OPENGL_DESKTOP
+    bool mapBufferRange = major >= 3 || std::strstr(extensions, "GL_ARB_map_buffer_range");
+#else
+    bool mapBufferRange = major >= 3;
+#endif
+    if (mapBufferRange) {
+        m_mapBufferRange = (RenginePFNGLMapBufferRange) rengine_resolve_gl_function("glMapBufferRange");
+        m_unmapBuffer = (RenginePFNGLUnmapBuffer) rengine_resolve_gl_function("glUnmapBuffer");
+        if (!m_mapBufferRange || !m_unmapBuffer) {
+            m_mapBufferRange = 0;
+            m_unmapBuffer = 0;
+        }
+    }
+#ifdef RENGINE_OPENGL_DESKTOP
+    bool fences = major * 10 + minor >= 32 || std::strstr(extensions, "GL_ARB_sync");
+#else
+    bool fences = major >= 3;
+#endif
+    if (m_mapBufferRange && fences) {
+        m_fenceSync = (RenginePFNGLFenceSync) rengine_resolve_gl_function("glFenceSync");
+        m_clientWaitSync = (RenginePFNGLClientWaitSync) rengine_resolve_gl_function("glClientWaitSync");
+        m_deleteSync = (RenginePFNGLDeleteSync) rengine_resolve_gl_function("glDeleteSync");
+        if (!m_fenceSync || !m_clientWaitSync || !m_deleteSync)
+            m_fenceSync = 0;
+    }
+
+    // GPU timing
+#ifdef RENGINE_OPENGL_DESKTOP
+    const char *querySuffix = major * 10 + minor >= 33 || std::strstr(extensions, "GL_ARB_timer_query") ? "" : 0;
+#else
+    const char *querySuffix = std::strstr(extensions, "GL_EXT_disjoint_timer_query") ? "EXT" : 0;
+#endif
+    if (querySuffix) {
+        m_genQueries = (RenginePFNGLGenQueries) rengine_resolve_gl_function((std::string("glGenQueries") + querySuffix).c_str());
+        m_deleteQueries = (RenginePFNGLDeleteQueries) rengine_resolve_gl_function((std::string("glDeleteQueries") + querySuffix).c_str());
+        m_queryCounter = (RenginePFNGLQueryCounter) rengine_resolve_gl_function((std::string("glQueryCounter") + querySuffix).c_str());
+        m_getQueryObjectiv = (RenginePFNGLGetQueryObjectiv) rengine_resolve_gl_function((std::string("glGetQueryObjectiv") + querySuffix).c_str());
+        m_getQueryObjectui64v = (RenginePFNGLGetQueryObjectui64v) rengine_resolve_gl_function((std::string("glGetQueryObjectui64v") + querySuffix).c_str());
+        if (!m_genQueries || !m_deleteQueries || !m_queryCounter || !m_getQueryObjectiv || !m_getQueryObjectui64v)
+            m_queryCounter = 0;
+    }
+
+    if (m_drawArraysInstanced) {
+        const vec2 corners[] = { vec2(0, 0), vec2(0, 1), vec2(1, 0), vec2(1, 1) };
+        glGenBuffers(1, &m_unitQuadBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, m_unitQuadBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
 
 #ifdef RENGINE_LOG_INFO
     static bool logged = false;
@@ -339,6 +1439,10 @@ inline void OpenGLRenderer::initialize()
         logi << " - Samples ..........: " << samples << std::endl;
         logi << " - Max Texture Size .: " << maxTexSize << std::endl;
         logi << " - SRGB Rendering ...: " << (m_srgb ? "yes" : "no") << std::endl;
+        logi << " - Shadow Textures ..: " << (m_shadowFormat == GL_RED ? "red" : "rgba") << std::endl;
+        logi << " - Instancing .......: " << (m_drawArraysInstanced ? "yes" : "no") << std::endl;
+        logi << " - Async Readback ...: " << (m_mapBufferRange ? (m_fenceSync ? "yes, fenced" : "yes") : "no") << std::endl;
+        logi << " - GPU Timing .......: " << (m_queryCounter ? "yes" : "no") << std::endl;
         logi << " - Extensions .......: " << glGetString(GL_EXTENSIONS) << std::endl;
     }
 #endif
@@ -346,89 +1450,457 @@ inline void OpenGLRenderer::initialize()
 }
 
 /*!
+    Points the vertex attributes at the quad starting at \a offset in the
+    vertex buffer.
+ */
+inline void OpenGLRenderer::setVertexOffset(unsigned offset)
+{
+    GLuint buffer = m_vertexBuffers[m_currentVertexBuffer].id;
+    if (!m_attribDivisors && buffer == m_attribBuffer && offset == m_attribOffset && m_vertexCount == m_attribVertexCount) {
+        ++m_frameStats.redundantStateChanges;
+        return;
+    }
+    resetAttribDivisors();
+    m_attribBuffer = buffer;
+    m_attribOffset = offset;
+    m_attribVertexCount = m_vertexCount;
 
-    Draws a quad using the 'solid' program. \a v is a vector of 8 floats,
-    composed of four interleaved x/y points. \a c is the color.
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void *) ((m_vertexCount + offset) * sizeof(vec2)));
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void *) (m_vertexCount * 2 * sizeof(vec2) + offset * sizeof(unsigned)));
+}
 
+/*!
+    Points the vertex attributes of the instanced programs at the unit quad
+    and at the instances from the quad starting at \a offset in the vertex
+    buffer onwards.
  */
-inline void OpenGLRenderer::drawColorQuad(unsigned offset, vec4 c)
+inline void OpenGLRenderer::setInstanceOffset(unsigned offset)
 {
-    activateShader(&prog_solid);
-    ensureMatrixUpdated(UpdateSolidProgram, &prog_solid);
-    glUniform4f(prog_solid.color, c.x * c.w, c.y * c.w, c.z * c.w, c.w);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    GLuint buffer = m_vertexBuffers[m_currentVertexBuffer].id;
+    if (m_attribDivisors && buffer == m_attribBuffer && offset == m_attribOffset && m_vertexCount == m_attribVertexCount) {
+        ++m_frameStats.redundantStateChanges;
+        return;
+    }
+    if (!m_attribDivisors) {
+        for (GLuint i=1; i<6; ++i)
+            m_vertexAttribDivisor(i, 1);
+        m_attribDivisors = true;
+    }
+    m_attribBuffer = buffer;
+    m_attribOffset = offset;
+    m_attribVertexCount = m_vertexCount;
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_unitQuadBuffer);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+    const GLsizei stride = sizeof(RectInstance);
+    size_t instance = instanceBufferOffset() + offset / 4 * sizeof(RectInstance);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void *) (instance + offsetof(RectInstance, texRect)));
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void *) (instance + offsetof(RectInstance, color)));
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, stride, (void *) (instance + offsetof(RectInstance, origin)));
+    glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, stride, (void *) (instance + offsetof(RectInstance, dx)));
+    glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, stride, (void *) (instance + offsetof(RectInstance, dy)));
 }
 
-inline void OpenGLRenderer::drawColorFilterQuad(unsigned offset, GLuint texId, mat4 matrix)
+/*!
+    Makes all vertex attributes advance per vertex again after instanced
+    drawing.
+ */
+inline void OpenGLRenderer::resetAttribDivisors()
 {
-    activateShader(&prog_colorFilter);
-    ensureMatrixUpdated(UpdateColorFilterProgram, &prog_colorFilter);
-    glUniformMatrix4fv(prog_colorFilter.colorMatrix, 1, true, matrix.m);
-    // std::cout << prog_colorFilter.colorMatrix << matrix;
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
-    glBindTexture(GL_TEXTURE_2D, texId);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    if (!m_attribDivisors)
+        return;
+    for (GLuint i=1; i<6; ++i)
+        m_vertexAttribDivisor(i, 0);
+    m_attribDivisors = false;
+    m_attribBuffer = 0;
 }
 
-inline void OpenGLRenderer::drawTextureQuad(unsigned offset, GLuint texId, float opacity, Texture::Format format)
+/*!
+    Records that the vertices from \a first up to, but not including, \a last
+    have changed and need to be uploaded to all the vertex buffers.
+ */
+inline void OpenGLRenderer::markVerticesDirty(unsigned first, unsigned last)
 {
-    if (opacity == 1) {
-        if (format == Texture::BGRA_32 || format == Texture::BGRx_32) {
-            activateShader(&prog_texture_bgr);
-            ensureMatrixUpdated(UpdateTextureBgrProgram, &prog_texture_bgr);
+    if (first >= last)
+        return;
+    for (VertexBuffer &b : m_vertexBuffers) {
+        if (b.dirtyFirst >= b.dirtyLast) {
+            b.dirtyFirst = first;
+            b.dirtyLast = last;
         } else {
-            activateShader(&prog_texture);
-            ensureMatrixUpdated(UpdateTextureProgram, &prog_texture);
+            b.dirtyFirst = std::min(b.dirtyFirst, first);
+            b.dirtyLast = std::max(b.dirtyLast, last);
         }
-    } else {
-        activateShader(&prog_alphaTexture);
-        ensureMatrixUpdated(UpdateAlphaTextureProgram, &prog_alphaTexture);
-        glUniform1f(prog_alphaTexture.alpha, opacity);
     }
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
-    glBindTexture(GL_TEXTURE_2D, texId);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
 
-inline void OpenGLRenderer::drawBlurQuad(unsigned offset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step)
+/*!
+    Brings a vertex buffer up to date with the vertices and binds it. If
+    nothing has changed, the current buffer is used as is. Otherwise the next
+    buffer in the ring is updated with the changes made since it was last
+    used, which after a partial rebuild is only a small range. Uploading all
+    the vertices orphans the buffer's storage, sized for the larger of this
+    and the previous frame.
+ */
+inline void OpenGLRenderer::uploadVertices()
 {
-    activateShader(&prog_blur);
-    ensureMatrixUpdated(UpdateBlurProgram, &prog_blur);
+    m_frameStats.vertexBytesUploaded = 0;
+    unsigned quadCount = m_instances ? m_vertexCount / 4 : 0;
+    unsigned bytes = instanceBufferOffset() + quadCount * sizeof(RectInstance);
+
+    VertexBuffer *b = m_vertexBuffers + m_currentVertexBuffer;
+    if (b->dirtyFirst < b->dirtyLast) {
+        m_currentVertexBuffer = (m_currentVertexBuffer + 1) % RENGINE_OPENGL_VERTEX_BUFFER_COUNT;
+        b = m_vertexBuffers + m_currentVertexBuffer;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, b->id);
+
+    unsigned first = std::min(b->dirtyFirst, m_vertexCount);
+    unsigned last = std::min(b->dirtyLast, m_vertexCount);
+    b->dirtyFirst = 0;
+    b->dirtyLast = 0;
+
+    if (bytes > b->size || (first == 0 && last == m_vertexCount)) {
+        b->size = std::max(bytes, m_previousVertexBytes);
+        glBufferData(GL_ARRAY_BUFFER, b->size, 0, GL_DYNAMIC_DRAW);
+        first = 0;
+        last = m_vertexCount;
+    }
+    m_previousVertexBytes = bytes;
 
-    glUniform1i(prog_blur.radius, radius);
-    glUniform4f(prog_blur.dims, renderSize.x, renderSize.y, textureSize.x, textureSize.y);
-    float sigma = 0.3 * radius + 0.8;
-    glUniform1f(prog_blur.sigma, sigma * sigma * 2.0);
-    glUniform2f(prog_blur.step, step.x, step.y);
+    if (first >= last)
+        return;
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
-    glBindTexture(GL_TEXTURE_2D, texId);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    // Ranges are whole quads. Instanced quads only upload their instance and
+    // the others only their vertices, each in runs of adjacent quads.
+    unsigned vertexBytes = m_vertexCount * sizeof(vec2);
+    unsigned lastQuad = (last + 3) / 4;
+    for (unsigned quad = first / 4; quad < lastQuad; ) {
+        bool instanced = isInstanced(quad);
+        unsigned end = quad + 1;
+        while (end < lastQuad && isInstanced(end) == instanced)
+            ++end;
+        if (instanced) {
+            glBufferSubData(GL_ARRAY_BUFFER, instanceBufferOffset() + quad * sizeof(RectInstance), (end - quad) * sizeof(RectInstance), m_instances + quad);
+            m_frameStats.vertexBytesUploaded += (end - quad) * sizeof(RectInstance);
+        } else {
+            unsigned v = quad * 4;
+            unsigned count = std::min(end * 4, last) - v;
+            glBufferSubData(GL_ARRAY_BUFFER, v * sizeof(vec2), count * sizeof(vec2), m_vertices + v);
+            glBufferSubData(GL_ARRAY_BUFFER, vertexBytes + v * sizeof(vec2), count * sizeof(vec2), m_texCoords + v);
+            glBufferSubData(GL_ARRAY_BUFFER, vertexBytes * 2 + v * sizeof(unsigned), count * sizeof(unsigned), m_colors + v);
+            m_frameStats.vertexBytesUploaded += count * (2 * sizeof(vec2) + sizeof(unsigned));
+        }
+        quad = end;
+    }
 }
 
-inline void OpenGLRenderer::drawShadowQuad(unsigned offset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, vec4 color)
-{
-    activateShader(&prog_shadow);
-    ensureMatrixUpdated(UpdateShadowProgram, &prog_shadow);
+/*!
 
-    glUniform1i(prog_shadow.radius, radius);
-    glUniform4f(prog_shadow.dims, renderSize.x, renderSize.y, textureSize.x, textureSize.y);
-    float sigma = 0.3 * radius + 0.8;
-    glUniform1f(prog_shadow.sigma, sigma * sigma * 2.0);
-    glUniform2f(prog_shadow.step, step.x, step.y);
-    glUniform4f(prog_shadow.color, color.x, color.y, color.z, color.w);
+    Draws the rectangle at \a first together with the rectangles following it
+    using the 'solid' program in a single draw call. The batch continues for as
+    long as the elements are rectangles whose quads follow each other in the
+    vertex buffer. The color comes from the per-vertex color buffer, or from
+    the rectangles' RectInstance when they are instanced.
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) (offset * sizeof(vec2)));
-    glBindTexture(GL_TEXTURE_2D, texId);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-}
+    Returns the first element after the batch.
 
-inline void OpenGLRenderer::activateShader(const Program *shader)
+ */
+inline OpenGLRenderer::Element *OpenGLRenderer::drawColorBatch(Element *first, Element *last)
+{
+    Element *e = first + 1;
+    unsigned count = 1;
+    while (e < last
+           && (first->instanced || count < RENGINE_OPENGL_MAX_BATCH_QUADS)
+           && !e->completed
+           && e->node->type() == Node::RectangleNodeType
+           && e->instanced == first->instanced
+           && e->vboOffset == first->vboOffset + count * 4) {
+        e->completed = true;
+        ++count;
+        ++e;
+    }
+
+    if (first->instanced) {
+        activateShader(&prog_solidInstanced);
+        ensureMatrixUpdated(UpdateSolidInstancedProgram, &prog_solidInstanced);
+        setInstanceOffset(first->vboOffset);
+        m_drawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    } else {
+        activateShader(&prog_solid);
+        ensureMatrixUpdated(UpdateSolidProgram, &prog_solid);
+        setVertexOffset(first->vboOffset);
+        glDrawElements(GL_TRIANGLES, count * 6, GL_UNSIGNED_SHORT, 0);
+    }
+    ++m_frameStats.drawCalls;
+
+    first->completed = true;
+    return e;
+}
+
+/*!
+
+    Draws the texture node at \a first together with the texture nodes
+    following it which use the same texture in a single draw call.
+
+    Returns the first element after the batch.
+
+ */
+inline OpenGLRenderer::Element *OpenGLRenderer::drawTextureBatch(Element *first, Element *last)
+{
+    const Texture *texture = static_cast<TextureNode *>(first->node)->texture();
+    GLuint texId = texture->textureId();
+
+    Element *e = first + 1;
+    unsigned count = 1;
+    while (e < last
+           && (first->instanced || count < RENGINE_OPENGL_MAX_BATCH_QUADS)
+           && !e->completed
+           && e->node->type() == Node::TextureNodeType
+           && static_cast<TextureNode *>(e->node)->texture()->textureId() == texId
+           && e->instanced == first->instanced
+           && e->vboOffset == first->vboOffset + count * 4) {
+        e->completed = true;
+        ++count;
+        ++e;
+    }
+
+    bool bgr = texture->format() == Texture::BGRA_32 || texture->format() == Texture::BGRx_32;
+    if (first->instanced && bgr) {
+        activateShader(&prog_textureInstancedBgr);
+        ensureMatrixUpdated(UpdateTextureBgrInstancedProgram, &prog_textureInstancedBgr);
+    } else if (first->instanced) {
+        activateShader(&prog_textureInstanced);
+        ensureMatrixUpdated(UpdateTextureInstancedProgram, &prog_textureInstanced);
+    } else if (bgr) {
+        activateShader(&prog_texture_bgr);
+        ensureMatrixUpdated(UpdateTextureBgrProgram, &prog_texture_bgr);
+    } else {
+        activateShader(&prog_texture);
+        ensureMatrixUpdated(UpdateTextureProgram, &prog_texture);
+    }
+    bindTexture(texId);
+    if (first->instanced) {
+        setInstanceOffset(first->vboOffset);
+        m_drawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    } else {
+        setVertexOffset(first->vboOffset);
+        glDrawElements(GL_TRIANGLES, count * 6, GL_UNSIGNED_SHORT, 0);
+    }
+    ++m_frameStats.drawCalls;
+
+    first->completed = true;
+    return e;
+}
+
+inline void OpenGLRenderer::drawColorFilterQuad(unsigned offset, GLuint texId, mat4 matrix)
+{
+    activateShader(&prog_colorFilter);
+    ensureMatrixUpdated(UpdateColorFilterProgram, &prog_colorFilter);
+    setUniform(&prog_colorFilter, prog_colorFilter.colorMatrix, matrix);
+    setUniform(&prog_colorFilter, prog_colorFilter.texScale, TexturePool::textureScale(boundingRectFor(offset).size()));
+    // std::cout << prog_colorFilter.colorMatrix << matrix;
+    setVertexOffset(offset);
+    bindTexture(texId);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    ++m_frameStats.drawCalls;
+}
+
+/*!
+    Draws the layer texture \a texId onto the quad at \a offset. The layer
+    only covers a part of the pooled texture, so the texture coordinates
+    are scaled accordingly. \a downsampling is the factor by which the
+    texture is smaller than the quad.
+ */
+inline void OpenGLRenderer::drawLayerQuad(unsigned offset, GLuint texId, float opacity, unsigned downsampling)
+{
+    vec2 textureSize = TexturePool::downsampledSize(boundingRectFor(offset).size(), downsampling);
+    activateShader(&prog_alphaTexture);
+    ensureMatrixUpdated(UpdateAlphaTextureProgram, &prog_alphaTexture);
+    setUniform(&prog_alphaTexture, prog_alphaTexture.alpha, opacity);
+    setUniform(&prog_alphaTexture, prog_alphaTexture.texScale, TexturePool::textureScale(textureSize));
+
+    setVertexOffset(offset);
+    bindTexture(texId);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    ++m_frameStats.drawCalls;
+}
+
+/*!
+    Returns the power of two by which content is downsampled before it is
+    blurred, so that \a radius in downsampled texels is at most \a maxRadius.
+ */
+inline unsigned OpenGLRenderer::blurDownsampling(unsigned radius, unsigned maxRadius)
+{
+    unsigned factor = 1;
+    while (radius > maxRadius * factor)
+        factor *= 2;
+    return factor;
+}
+
+/*!
+    Returns the factor by which the content of \a node is downsampled before
+    it is blurred, according to the node's quality.
+ */
+inline unsigned OpenGLRenderer::blurDownsampling(const BlurNode *node)
+{
+    unsigned maxRadius = MaxBlurKernelRadius;
+    if (node->quality() == BlurNode::LowQuality)
+        maxRadius = RENGINE_OPENGL_BLUR_MAX_RADIUS_LOW;
+    else if (node->quality() == BlurNode::NormalQuality)
+        maxRadius = RENGINE_OPENGL_BLUR_MAX_RADIUS;
+    return blurDownsampling(node->radius(), maxRadius);
+}
+
+/*!
+    Returns the factor by which the shadow of \a node is downsampled. Only
+    the blurred alpha is downsampled, the content itself is drawn at full
+    resolution.
+
+    \sa downsampleShadowContent()
+ */
+inline unsigned OpenGLRenderer::blurDownsampling(const ShadowNode *node)
+{
+    return blurDownsampling(node->radius(), RENGINE_OPENGL_BLUR_MAX_RADIUS);
+}
+
+/*!
+    Returns the kernel for \a radius, computing it the first time it is
+    asked for. The sigma follows the same rule of thumb as OpenCV's
+    getGaussianKernel.
+ */
+inline const OpenGLRenderer::BlurKernel &OpenGLRenderer::blurKernel(unsigned radius)
+{
+    assert(radius > 0 && radius <= MaxBlurKernelRadius);
+    if (m_blurKernels.size() <= radius)
+        m_blurKernels.resize(radius + 1, BlurKernel());
+    BlurKernel &kernel = m_blurKernels[radius];
+    if (kernel.pairs > 0)
+        return kernel;
+
+    float sigma = 0.3f * radius + 0.8f;
+    float weights[MaxBlurKernelRadius + 2];
+    float sum = 0;
+    for (unsigned i=0; i<=radius; ++i) {
+        weights[i] = std::exp(-float(i * i) / (2.0f * sigma * sigma));
+        sum += i == 0 ? weights[i] : 2.0f * weights[i];
+    }
+    weights[radius + 1] = 0;
+
+    kernel.center = weights[0] / sum;
+    float *tap = &kernel.taps[0].x;
+    std::fill(tap, tap + MaxBlurKernelRadius, 0.0f);
+    for (unsigned i=1; i<=radius; i += 2) {
+        float w = weights[i] + weights[i + 1];
+        tap[0] = (i * weights[i] + (i + 1) * weights[i + 1]) / w;
+        tap[1] = w / sum;
+        tap += 2;
+        ++kernel.pairs;
+    }
+    return kernel;
+}
+
+/*!
+    Uploads the kernel for \a radius to \a p, unless it is already there.
+ */
+inline void OpenGLRenderer::setBlurKernel(BlurProgram *p, unsigned radius)
+{
+    if (p->kernelRadius == radius) {
+        ++m_frameStats.redundantStateChanges;
+        return;
+    }
+    p->kernelRadius = radius;
+    const BlurKernel &kernel = blurKernel(radius);
+    glUniform1f(p->center, kernel.center);
+    glUniform1i(p->pairs, kernel.pairs);
+    glUniform4fv(p->kernel, (kernel.pairs + 1) / 2, &kernel.taps[0].x);
+}
+
+/*!
+    Draws one pass of the blur using \a p, which must be active. \a radius
+    and \a step are given in texels of \a texId, which holds \a textureSize
+    downsampled by \a downsampling.
+ */
+inline void OpenGLRenderer::drawBlurPass(BlurProgram *p, unsigned offset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, unsigned downsampling)
+{
+    setBlurKernel(p, radius);
+    setUniform(p, p->dims, vec4(renderSize.x, renderSize.y, textureSize.x, textureSize.y));
+    vec2 scale = TexturePool::textureScale(TexturePool::downsampledSize(textureSize, downsampling));
+    setUniform(p, p->step, step * scale);
+    setUniform(p, p->texScale, scale);
+
+    setVertexOffset(offset);
+    bindTexture(texId);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    ++m_frameStats.drawCalls;
+}
+
+inline void OpenGLRenderer::drawBlurQuad(unsigned offset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, unsigned downsampling)
+{
+    activateShader(&prog_blur);
+    ensureMatrixUpdated(UpdateBlurProgram, &prog_blur);
+    drawBlurPass(&prog_blur, offset, texId, radius, renderSize, textureSize, step, downsampling);
+}
+
+/*!
+    Reduces the full resolution shadow content in \a texId by
+    \a downsampling, halving it in each pass so every bilinear fetch
+    averages 2x2 texels, like the blur's reduced content does. Returns
+    \a texId when there is nothing to reduce, otherwise a pooled texture
+    which the caller releases.
+
+    The content's projection must still be current.
+ */
+inline GLuint OpenGLRenderer::downsampleShadowContent(Element *e, GLuint texId, vec2 contentSize, unsigned downsampling)
+{
+    GLuint source = texId;
+    for (unsigned factor = 2; factor <= downsampling; factor *= 2) {
+        vec2 size = TexturePool::downsampledSize(contentSize, factor);
+        GLuint target = m_texturePool.acquire(size, &m_fbo);
+        m_boundTexture = ~GLuint(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+        ++m_frameStats.framebufferSwitches;
+        glClear(GL_COLOR_BUFFER_BIT);
+        setViewport(size);
+        drawLayerQuad(e->vboOffset + 12, source, 1.0f, factor / 2);
+        if (source != texId)
+            m_texturePool.release(source);
+        source = target;
+    }
+    return source;
+}
+
+/*!
+    Blurs the alpha of the content in \a texId, downsampled by
+    \a downsampling, into the first channel of the target.
+ */
+inline void OpenGLRenderer::drawShadowAlphaQuad(unsigned offset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, unsigned downsampling)
+{
+    activateShader(&prog_shadowAlpha);
+    ensureMatrixUpdated(UpdateShadowAlphaProgram, &prog_shadowAlpha);
+    drawBlurPass(&prog_shadowAlpha, offset, texId, radius, renderSize, textureSize, step, downsampling);
+}
+
+/*!
+    Blurs the first channel of \a texId and draws it in \a color.
+ */
+inline void OpenGLRenderer::drawShadowQuad(unsigned offset, GLuint texId, int radius, vec2 renderSize, vec2 textureSize, vec2 step, unsigned downsampling, vec4 color)
+{
+    activateShader(&prog_shadow);
+    ensureMatrixUpdated(UpdateShadowProgram, &prog_shadow);
+    setUniform(&prog_shadow, prog_shadow.color, color);
+    drawBlurPass(&prog_shadow, offset, texId, radius, renderSize, textureSize, step, downsampling);
+}
+
+inline void OpenGLRenderer::activateShader(const Program *shader)
 {
-    if (shader == m_activeShader)
+    if (shader == m_activeShader) {
+        ++m_frameStats.redundantStateChanges;
         return;
+    }
 
     int oldCount = m_activeShader ? m_activeShader->attributeCount() : 0;
     int newCount = 0;
@@ -439,64 +1911,348 @@ inline void OpenGLRenderer::activateShader(const Program *shader)
     } else {
         glUseProgram(0);
     }
-
-    // std::cout << " --- switching shader: old=" << (m_activeShader ? m_activeShader->id() : 0)
-    //           << " (" << oldCount << " attr)"
-    //           << " new=" << (shader ? shader->id() : 0)
-    //           << " (" << newCount << " attr)"
-    //           << std::endl;
+    ++m_frameStats.shaderSwitches;
 
     // Enable new ones
-    for (int i=oldCount; i<newCount; ++i) {
-        // std::cout << "    - enable " << i << estd::ndl;
+    for (int i=oldCount; i<newCount; ++i)
         glEnableVertexAttribArray(i);
-    }
-    for (int i=oldCount-1; i>=newCount; --i) {
-        // std::cout << "    - disable " << i << std::endl;
+    for (int i=oldCount-1; i>=newCount; --i)
         glDisableVertexAttribArray(i);
-    }
 
     m_activeShader = shader;
 }
 
-inline void OpenGLRenderer::prepass(Node *n)
+inline bool OpenGLRenderer::isLayered(Node *n) const
+{
+    switch (n->type()) {
+    case Node::OpacityNodeType: return static_cast<OpacityNode *>(n)->opacity() < 1.0f;
+    case Node::ColorFilterNodeType: return !static_cast<ColorFilterNode *>(n)->colorMatrix().isIdentity();
+    case Node::BlurNodeType: return static_cast<BlurNode *>(n)->radius() > 0;
+    case Node::ShadowNodeType: return static_cast<ShadowNode *>(n)->color().w > 0;
+    default: return false;
+    }
+}
+
+/*!
+    Returns true if \a n is an opaque rectangle or texture which covers an
+    axis aligned area of the screen, and stores the whole pixels it covers in
+    \a rect.
+ */
+inline bool OpenGLRenderer::isOccluder(const BuildState &s, Node *n, rect2d *rect) const
 {
+    if (n->type() == Node::RectangleNodeType) {
+        if (static_cast<RectangleNode *>(n)->color().w < 1.0f)
+            return false;
+    } else if (n->type() == Node::TextureNodeType) {
+        const Texture *texture = static_cast<TextureNode *>(n)->texture();
+        if (!texture || texture->hasAlpha())
+            return false;
+    } else {
+        return false;
+    }
+
+    if ((s.m2d.type & ~(mat4::Translation2D | mat4::Scale2D)) != 0)
+        return false;
+
+    // Only the part inside the viewport is of interest. This also rules out
+    // nodes which are culled for being offscreen.
+    rect2d geometry = static_cast<RectangleNodeBase *>(n)->geometry();
+    rect2d r = rect2d(s.m2d * geometry.tl, s.m2d * geometry.br).normalized();
+    *rect = rect2d(std::max(std::ceil(r.left()), m_viewport.left()),
+                   std::max(std::ceil(r.top()), m_viewport.top()),
+                   std::min(std::floor(r.right()), m_viewport.right()),
+                   std::min(std::floor(r.bottom()), m_viewport.bottom()));
+    return rect->width() > 0 && rect->height() > 0
+           && rect->width() * rect->height() >= RENGINE_OPENGL_MIN_OCCLUDER_AREA;
+}
+
+/*!
+    Collects the opaque, axis aligned rectangles and textures in the 2D parts
+    of the tree which can hide the elements drawn before them. Layers and 3D
+    subtrees are skipped.
+ */
+inline void OpenGLRenderer::findOccluders(BuildState &s, Node *root)
+{
+    m_occluders.clear();
+    s.occluderIndex = 0;
+    if (RENGINE_OPENGL_MAX_OCCLUDERS == 0)
+        return;
+
+    collectOccluders(s, root);
+
+    // Occluders inside a later occluder don't hide anything it doesn't
+    // hide already. Dropping them also means that no occluder is culled.
+    for (int i=m_occluders.size() - 1; i>=0; --i) {
+        const rect2d &r = m_occluders[i].rect;
+        for (unsigned j=i+1; j<m_occluders.size(); ++j) {
+            const rect2d &o = m_occluders[j].rect;
+            if (r.left() >= o.left() && r.top() >= o.top() && r.right() <= o.right() && r.bottom() <= o.bottom()) {
+                m_occluders.erase(m_occluders.begin() + i);
+                break;
+            }
+        }
+    }
+
+    // Keep the largest ones, in paint order
+    while (m_occluders.size() > RENGINE_OPENGL_MAX_OCCLUDERS) {
+        auto smallest = std::min_element(m_occluders.begin(), m_occluders.end(), [](const Occluder &a, const Occluder &b) {
+            return a.rect.width() * a.rect.height() < b.rect.width() * b.rect.height();
+        });
+        m_occluders.erase(smallest);
+    }
+}
+
+inline void OpenGLRenderer::collectOccluders(BuildState &s, Node *n)
+{
+    Occluder o;
+    if (isOccluder(s, n, &o.rect)) {
+        o.node = n;
+        o.element = 0;
+        m_occluders.push_back(o);
+    }
+
+    // Only the visible part of a clipped node hides anything
+    if (isLayered(n) || n->type() == Node::ClipNodeType)
+        return;
+
+    TransformNode *tn = TransformNode::from(n);
+    if (tn && tn->projectionDepth() > 0)
+        return;
+
+    mat4 old = s.m2d;
+    if (tn)
+        s.m2d = s.m2d * tn->matrix();
+    for (Node *c = n->child(); c; c = c->sibling())
+        collectOccluders(s, c);
+    s.m2d = old;
+}
+
+/*!
+    Advances past \a n if it is the next occluder in paint order. Returns true
+    if it was.
+ */
+inline bool OpenGLRenderer::passOccluder(BuildState &s, Node *n)
+{
+    if (s.occluderIndex < m_occluders.size() && m_occluders[s.occluderIndex].node == n) {
+        ++s.occluderIndex;
+        return true;
+    }
+    return false;
+}
+
+/*!
+    Returns true if the rectangle or texture \a n is hidden behind one of the
+    occluders which are drawn after it.
+ */
+inline bool OpenGLRenderer::isOccluded(const BuildState &s, Node *n) const
+{
+    if (s.occluderIndex >= m_occluders.size() || s.render3d || s.layered)
+        return false;
+
+    rect2d geometry = static_cast<RectangleNodeBase *>(n)->geometry();
+    const float inf = std::numeric_limits<float>::infinity();
+    rect2d bounds(inf, inf, -inf, -inf);
+    bounds |= s.m2d * geometry.tl;
+    bounds |= s.m2d * vec2(geometry.left(), geometry.bottom());
+    bounds |= s.m2d * vec2(geometry.right(), geometry.top());
+    bounds |= s.m2d * geometry.br;
+
+    for (unsigned i=s.occluderIndex; i<m_occluders.size(); ++i) {
+        const rect2d &o = m_occluders[i].rect;
+        if (bounds.left() >= o.left() && bounds.top() >= o.top() && bounds.right() <= o.right() && bounds.bottom() <= o.bottom())
+            return true;
+    }
+    return false;
+}
+
+/*!
+    Returns true if one of the occluders was built into the elements of
+    \a range. The occluders are matched by their element rather than their
+    node, as a node which has been removed from the tree since the previous
+    frame may already be destroyed. Removing a node changes its parent, so
+    the range which is rebuilt for it still covers its old element.
+ */
+inline bool OpenGLRenderer::containsOccluder(const Node::RenderRange &range) const
+{
+    for (const Occluder &o : m_occluders) {
+        if (o.element >= range.element && o.element < range.element + range.elementCount)
+            return true;
+    }
+    return false;
+}
+
+/*!
+    Returns the bounds of \a n's subtree in the coordinate system of its
+    parent. The bounds are cached in the nodes and only the parts of the tree
+    which have changed since they were calculated are visited. Subtrees which
+    can draw outside the geometry of their nodes, like 3D, blur and shadow,
+    are unbounded.
+ */
+inline rect2d OpenGLRenderer::subtreeBounds(Node *n)
+{
+    if (!n->boundsDirty())
+        return n->cachedBounds();
+
+    // Preprocessing may change the geometry
     n->preprocess();
+
+    const float inf = std::numeric_limits<float>::infinity();
+    rect2d bounds(inf, inf, -inf, -inf);
+    if (n->type() & Node::RectangleNodeBaseType)
+        bounds = static_cast<RectangleNodeBase *>(n)->geometry().normalized();
+    for (Node *c = n->child(); c; c = c->sibling())
+        bounds |= subtreeBounds(c);
+    if (ClipNode *cn = ClipNode::from(n))
+        bounds &= cn->geometry().normalized();
+
+    TransformNode *tn = TransformNode::from(n);
+    if (n->type() == Node::BlurNodeType || n->type() == Node::ShadowNodeType || (tn && tn->projectionDepth() > 0)) {
+        bounds = rect2d(-inf, -inf, inf, inf);
+    } else if (tn && bounds.left() <= bounds.right() && !std::isinf(bounds.width()) && !std::isinf(bounds.height())) {
+        const mat4 &m = tn->matrix();
+        rect2d r(inf, inf, -inf, -inf);
+        r |= m * bounds.tl;
+        r |= m * vec2(bounds.left(), bounds.bottom());
+        r |= m * vec2(bounds.right(), bounds.top());
+        r |= m * bounds.br;
+        bounds = r;
+    }
+
+    n->setCachedBounds(bounds);
+    return bounds;
+}
+
+/*!
+    Returns true if \a n's subtree is entirely outside the viewport or the
+    clips it is inside of, in which case it is skipped during the build.
+    Layers are culled as a whole, but not their content, as blur and
+    shadows can spread content into view.
+ */
+inline bool OpenGLRenderer::isOffscreen(const BuildState &s, Node *n)
+{
+    if (s.render3d || s.layered)
+        return false;
+
+    rect2d b = subtreeBounds(n);
+    if (!(b.left() <= b.right()) || std::isinf(b.width()))
+        return false;
+
+    vec2 corners[] = { s.m2d * b.tl, s.m2d * vec2(b.left(), b.bottom()), s.m2d * vec2(b.right(), b.top()), s.m2d * b.br };
+    bool left = true, top = true, right = true, bottom = true;
+    for (const vec2 &p : corners) {
+        left &= p.x <= s.clipRect.left();
+        top &= p.y <= s.clipRect.top();
+        right &= p.x >= s.clipRect.right();
+        bottom &= p.y >= s.clipRect.bottom();
+    }
+    return left || top || right || bottom;
+}
+
+/*!
+    Returns the device space bounds of the clip node \a n intersected with the
+    current clip rect. Children outside it are culled.
+ */
+inline rect2d OpenGLRenderer::clipBoundsFor(const BuildState &s, Node *n) const
+{
+    rect2d g = static_cast<ClipNode *>(n)->geometry();
+    const float inf = std::numeric_limits<float>::infinity();
+    rect2d bounds(inf, inf, -inf, -inf);
+    bounds |= s.m2d * g.tl;
+    bounds |= s.m2d * vec2(g.left(), g.bottom());
+    bounds |= s.m2d * vec2(g.right(), g.top());
+    bounds |= s.m2d * g.br;
+    return bounds & s.clipRect;
+}
+
+/*!
+    Clears the changes in a subtree which was culled, so it isn't revisited
+    by the next update.
+ */
+inline void OpenGLRenderer::clearUpdates(Node *n)
+{
+    n->clearDirty();
+    for (Node *c = n->child(); c; c = c->sibling()) {
+        if (c->isDirty() || c->hasDirtyDescendants())
+            clearUpdates(c);
+    }
+    n->setDirtyDescendants(false);
+}
+
+inline void OpenGLRenderer::prepass(BuildState &s, Node *n)
+{
+    n->preprocess();
+    if (isOffscreen(s, n))
+        return;
     switch (n->type()) {
     case Node::TextureNodeType: {
         TextureNode *tn = static_cast<TextureNode *>(n);
-        if (tn->width() != 0.0f && tn->height() != 0.0f && tn->texture() != nullptr)
-            ++m_numTextureNodes;
+        if (tn->width() != 0.0f && tn->height() != 0.0f && tn->texture() != nullptr) {
+            if (!passOccluder(s, n) && isOccluded(s, n))
+                ++m_numOccludedNodes;
+            else
+                ++m_numTextureNodes;
+        }
     }   break;
     case Node::RectangleNodeType: {
         RectangleNode *rn = static_cast<RectangleNode *>(n);
-        if (rn->width() != 0.0f && rn->height() != 0.0f && !(rn->color().w < RENGINE_RENDERER_ALPHA_THRESHOLD))
-            ++m_numRectangleNodes;
+        if (rn->width() != 0.0f && rn->height() != 0.0f && !(rn->color().w < RENGINE_RENDERER_ALPHA_THRESHOLD)) {
+            if (!passOccluder(s, n) && isOccluded(s, n))
+                ++m_numOccludedNodes;
+            else
+                ++m_numRectangleNodes;
+        }
     }   break;
     case Node::TransformNodeType:
         ++m_numTransformNodes;
-        if (static_cast<TransformNode *>(n)->projectionDepth() > 0)
+        // Only the outermost projection gets an element, nested ones are
+        // flattened into it.
+        if (static_cast<TransformNode *>(n)->projectionDepth() > 0 && !s.render3d) {
             ++m_numTransformNodesWith3d;
+            s.render3d = true;
+            for (Node *c = n->child(); c; c = c->sibling())
+                prepass(s, c);
+            s.render3d = false;
+            return;
+        }
+        // Track the device space geometry for culling
+        if (!s.render3d) {
+            mat4 old = s.m2d;
+            s.m2d = s.m2d * static_cast<TransformNode *>(n)->matrix();
+            for (Node *c = n->child(); c; c = c->sibling())
+                prepass(s, c);
+            s.m2d = old;
+            return;
+        }
+        break;
+    case Node::ClipNodeType:
+        ++m_numClipNodes;
+        // Nothing is culled inside 3D subtrees
+        if (!s.render3d) {
+            rect2d storedClip = s.clipRect;
+            s.clipRect = clipBoundsFor(s, n);
+            for (Node *c = n->child(); c; c = c->sibling())
+                prepass(s, c);
+            s.clipRect = storedClip;
+            return;
+        }
         break;
     // All layered nodes take this path..
     case Node::ColorFilterNodeType:
-        if (!static_cast<ColorFilterNode *>(n)->colorMatrix().isIdentity())
-            ++m_numLayeredNodes;
-        break;
     case Node::OpacityNodeType:
-        if (static_cast<OpacityNode *>(n)->opacity() < 1)
-            ++m_numLayeredNodes;
-        break;
     case Node::BlurNodeType:
-        if (static_cast<BlurNode *>(n)->radius() > 0) {
-            ++m_numLayeredNodes;
-            m_additionalQuads += 2;
-        }
-        break;
     case Node::ShadowNodeType:
-        if (static_cast<ShadowNode *>(n)->color().w > 0) {
+        if (isLayered(n)) {
             ++m_numLayeredNodes;
-            m_additionalQuads += 3;
+            if (n->type() == Node::BlurNodeType)
+                m_additionalQuads += 2;
+            else if (n->type() == Node::ShadowNodeType)
+                m_additionalQuads += 3;
+            bool storedLayered = s.layered;
+            s.layered = true;
+            for (Node *c = n->child(); c; c = c->sibling())
+                prepass(s, c);
+            s.layered = storedLayered;
+            return;
         }
         break;
     case Node::RenderNodeType:
@@ -509,10 +2265,38 @@ inline void OpenGLRenderer::prepass(Node *n)
     }
 
     for (Node *c = n->child(); c; c = c->sibling())
-        prepass(c);
+        prepass(s, c);
 }
 
-inline void OpenGLRenderer::build(Node *n)
+inline void OpenGLRenderer::build(BuildState &s, Node *n)
+{
+    Node::RenderRange range;
+    range.element = s.elementIndex;
+    range.vertex = s.vertexIndex;
+    n->clearDirty();
+
+    if (isOffscreen(s, n)) {
+        range.elementCount = 0;
+        range.vertexCount = 0;
+        n->setRenderRange(range);
+        clearUpdates(n);
+        return;
+    }
+
+    buildNode(s, n);
+
+    range.elementCount = s.elementIndex - range.element;
+    range.vertexCount = s.vertexIndex - range.vertex;
+    n->setRenderRange(range);
+
+    // Preprocessing may have requested another round for the next frame.
+    bool dirty = false;
+    for (Node *c = n->child(); c && !dirty; c = c->sibling())
+        dirty = c->needsUpdate();
+    n->setDirtyDescendants(dirty);
+}
+
+inline void OpenGLRenderer::buildNode(BuildState &s, Node *n)
 {
     switch (n->type()) {
     case Node::TextureNodeType:
@@ -525,33 +2309,82 @@ inline void OpenGLRenderer::build(Node *n)
             || (n->type() == Node::RectangleNodeType && static_cast<RectangleNode *>(n)->color().w < RENGINE_RENDERER_ALPHA_THRESHOLD))
             break;
 
-        Element *e = m_elements + m_elementIndex;
+        // Skip if hidden behind an opaque node drawn after it
+        bool occluder = passOccluder(s, n);
+        if (occluder)
+            m_occluders[s.occluderIndex - 1].element = s.elementIndex;
+        else if (isOccluded(s, n))
+            break;
+
+        Element *e = m_elements + s.elementIndex;
         e->node = n;
-        e->vboOffset = m_vertexIndex;
+        e->vboOffset = s.vertexIndex;
         vec2 p1 = geometry.tl;
         vec2 p2 = geometry.br;
-        vec2 *v = m_vertices + m_vertexIndex;
+        vec2 corners[4];
+        vec2 *v = corners;
 
         // std::cout << " -- building rect from " << p1 << " " << p2 << " into " << m_vertices << " " << e << std::endl;
 
-        if (m_render3d) {
-            e->z = (m_m3d * vec3((p1 + p2) / 2.0f)).z;
-            projectQuad(p1, p2, v);
+        if (s.render3d) {
+            e->z = (s.m3d * vec3((p1 + p2) / 2.0f)).z;
+            v = m_vertices + s.vertexIndex;
+            projectQuad(s, p1, p2, v);
 
         } else {
-            v[0] = m_m2d * p1;
-            v[1] = m_m2d * vec2(p1.x, p2.y);
-            v[2] = m_m2d * vec2(p2.x, p1.y);
-            v[3] = m_m2d * p2;
+            s.m2d.mapQuad2D(p1, p2, v);
         }
-        m_vertexIndex += 4;
-        m_elementIndex += 1;
+
+        // An instance replaces the quad's vertices altogether. A quad which
+        // has collapsed to a point keeps its vertices, as an empty instance
+        // marks a quad which isn't instanced.
+        RectInstance *instance = 0;
+        if (m_instances && !s.render3d && (v[2] != v[0] || v[1] != v[0])) {
+            e->instanced = true;
+            instance = m_instances + s.vertexIndex / 4;
+            instance->origin = v[0];
+            instance->dx = v[2] - v[0];
+            instance->dy = v[1] - v[0];
+        } else if (!s.render3d) {
+            std::copy(corners, corners + 4, m_vertices + s.vertexIndex);
+        }
+
+        if (n->type() == Node::TextureNodeType) {
+            rect2d r = static_cast<TextureNode *>(n)->texture()->subRect();
+            if (instance) {
+                instance->texRect = vec4(r.left(), r.top(), r.width(), r.height());
+            } else {
+                vec2 *t = m_texCoords + s.vertexIndex;
+                t[0] = r.tl;
+                t[1] = vec2(r.left(), r.bottom());
+                t[2] = vec2(r.right(), r.top());
+                t[3] = r.br;
+            }
+        } else {
+            vec4 c = static_cast<RectangleNode *>(n)->color();
+            unsigned rgba;
+            unsigned char *bytes = (unsigned char *) &rgba;
+            bytes[0] = c.x * c.w * 255.0f + 0.5f;
+            bytes[1] = c.y * c.w * 255.0f + 0.5f;
+            bytes[2] = c.z * c.w * 255.0f + 0.5f;
+            bytes[3] = c.w * 255.0f + 0.5f;
+            if (instance) {
+                instance->color = rgba;
+            } else {
+                unsigned *colors = m_colors + s.vertexIndex;
+                colors[0] = rgba;
+                colors[1] = rgba;
+                colors[2] = rgba;
+                colors[3] = rgba;
+            }
+        }
+        s.vertexIndex += 4;
+        s.elementIndex += 1;
 
         // Add to the bounding box if we're in inside a layer
-        if (m_layered) {
+        if (s.layered) {
             for (int i=0; i<4; ++i)
-                m_layerBoundingBox |= v[i];
-            // std::cout << " ----> bounds: " << m_layerBoundingBox << std::endl;
+                s.layerBoundingBox |= v[i];
         }
 
     } break;
@@ -561,153 +2394,477 @@ inline void OpenGLRenderer::build(Node *n)
 
         Element *e = 0;
 
-        if (tn->projectionDepth() && !m_render3d) {
-            m_render3d = true;
-            m_farPlane = tn->projectionDepth();
-            e = m_elements + m_elementIndex++;
+        if (tn->projectionDepth() && !s.render3d) {
+            s.render3d = true;
+            s.farPlane = tn->projectionDepth();
+            e = m_elements + s.elementIndex++;
             e->node = n;
             e->z = 0;
             e->projection = true;
         }
 
-        mat4 *m = m_render3d ? &m_m3d : &m_m2d;
+        mat4 *m = s.render3d ? &s.m3d : &s.m2d;
         mat4 old = *m;
         *m = *m * tn->matrix();
 
         for (Node *c = n->child(); c; c = c->sibling())
-            build(c);
+            build(s, c);
 
         // restore previous state
         *m = old;
         if (e) {
-            m_render3d = false;
-            m_farPlane = 0;
-            e->groupSize = (m_elements + m_elementIndex) - e - 1;
+            s.render3d = false;
+            s.farPlane = 0;
+            assert((m_elements + s.elementIndex) - e - 1 <= MaxGroupSize);
+            e->groupSize = (m_elements + s.elementIndex) - e - 1;
         }
     } return;
 
+    case Node::ClipNodeType: {
+        ClipNode *cn = static_cast<ClipNode *>(n);
+        Element *e = m_elements + s.elementIndex++;
+        e->node = n;
+        e->clip = true;
+        e->vboOffset = s.vertexIndex;
+        rect2d g = cn->geometry();
+        vec2 *v = m_vertices + s.vertexIndex;
+        s.vertexIndex += 4;
+
+        // A projected clip is sorted as one element at its own depth and
+        // sorts its children among themselves when it is drawn.
+        if (s.render3d) {
+            e->projection = true;
+            e->stencil = true;
+            e->z = (s.m3d * vec3((g.tl + g.br) / 2.0f)).z;
+            projectQuad(s, g.tl, g.br, v);
+            for (Node *c = n->child(); c; c = c->sibling())
+                build(s, c);
+        } else {
+            e->stencil = (s.m2d.type & ~(mat4::Translation2D | mat4::Scale2D)) != 0;
+            s.m2d.mapQuad2D(g.tl, g.br, v);
+            rect2d storedClip = s.clipRect;
+            s.clipRect = clipBoundsFor(s, n);
+            for (Node *c = n->child(); c; c = c->sibling())
+                build(s, c);
+            s.clipRect = storedClip;
+        }
+
+        assert((m_elements + s.elementIndex) - e - 1 <= MaxGroupSize);
+        e->groupSize = (m_elements + s.elementIndex) - e - 1;
+    } return;
+
     // all layered node types take this code path
     case Node::ShadowNodeType:
     case Node::BlurNodeType:
     case Node::ColorFilterNodeType:
     case Node::OpacityNodeType: {
 
-        bool useTexture =
-            (n->type() == Node::OpacityNodeType && static_cast<OpacityNode *>(n)->opacity() < 1.0f)
-            || (n->type() == Node::ColorFilterNodeType && !static_cast<ColorFilterNode *>(n)->colorMatrix().isIdentity())
-            || (n->type() == Node::BlurNodeType && static_cast<BlurNode *>(n)->radius() > 0)
-            || (n->type() == Node::ShadowNodeType && static_cast<ShadowNode *>(n)->color().w > 0);
+        bool useTexture = isLayered(n);
 
-        bool storedTextureed = m_layered;
+        bool storedTextureed = s.layered;
         Element *e = 0;
-        rect2d storedBox = m_layerBoundingBox;
+        rect2d storedBox = s.layerBoundingBox;
 
         if (useTexture) {
-            m_layered = true;
-            e = m_elements + m_elementIndex++;
+            s.layered = true;
+            e = m_elements + s.elementIndex++;
             e->node = n;
-            e->projection = m_render3d;
+            e->projection = s.render3d;
             e->layered = true;
             const float inf = std::numeric_limits<float>::infinity();
-            m_layerBoundingBox = rect2d(inf, inf, -inf, -inf);
+            s.layerBoundingBox = rect2d(inf, inf, -inf, -inf);
         }
         // std::cout << " -- building layered node into " << e << std::endl;
 
         for (Node *c = n->child(); c; c = c->sibling())
-            build(c);
+            build(s, c);
 
         if (e) {
-            m_layered = storedTextureed;
-            e->groupSize = (m_elements + m_elementIndex) - e - 1;
-            // std::cout << "groupSize of " << e << " is " << e->groupSize << " based on: " << m_elements << " " << m_elementIndex << " " << e << std::endl;
-            e->vboOffset = m_vertexIndex;
-            rect2d box = m_layerBoundingBox.aligned();
-            vec2 *v = m_vertices + m_vertexIndex;
+            s.layered = storedTextureed;
+            assert((m_elements + s.elementIndex) - e - 1 <= MaxGroupSize);
+            e->groupSize = (m_elements + s.elementIndex) - e - 1;
+            e->vboOffset = s.vertexIndex;
+            rect2d box = s.layerBoundingBox.aligned();
+            vec2 *v = m_vertices + s.vertexIndex;
             v[0] = box.tl;
             v[1] = vec2(box.left(), box.bottom());
             v[2] = vec2(box.right(), box.top());
             v[3] = box.br;
-            m_vertexIndex += 4;
+            s.vertexIndex += 4;
 
             if (n->type() == Node::BlurNodeType || n->type() == Node::ShadowNodeType) {
                 float radius = n->type() == Node::BlurNodeType
                                ? static_cast<BlurNode *>(n)->radius()
                                : static_cast<ShadowNode *>(n)->radius();
-                float t1 = box.tl.y - 1;
-                float b1 = box.br.y + 1;
+                float border = n->type() == Node::BlurNodeType
+                               ? blurDownsampling(static_cast<BlurNode *>(n))
+                               : blurDownsampling(static_cast<ShadowNode *>(n));
+                float t1 = box.tl.y - border;
+                float b1 = box.br.y + border;
                 vec2 tlr = box.tl - vec2(radius);
                 vec2 brr = box.br + vec2(radius);
                 v[ 4] = vec2(tlr.x, t1);
                 v[ 5] = vec2(tlr.x, b1);
                 v[ 6] = vec2(brr.x, t1);
                 v[ 7] = vec2(brr.x, b1);
-                v[ 8] = vec2(tlr.x, tlr.y);
-                v[ 9] = vec2(tlr.x, brr.y);
-                v[10] = vec2(brr.x, tlr.y);
-                v[11] = vec2(brr.x, brr.y);
-                m_vertexIndex += 8;
+                // The shadow is drawn at its offset
+                vec2 offset;
+                if (n->type() == Node::ShadowNodeType) {
+                    offset = static_cast<ShadowNode *>(n)->offset();
+                    offset = vec2(std::round(offset.x), std::round(offset.y));
+                }
+                v[ 8] = vec2(tlr.x, tlr.y) + offset;
+                v[ 9] = vec2(tlr.x, brr.y) + offset;
+                v[10] = vec2(brr.x, tlr.y) + offset;
+                v[11] = vec2(brr.x, brr.y) + offset;
+                s.vertexIndex += 8;
 
+                // The shadow's content, with its transparent border
                 if (n->type() == Node::ShadowNodeType) {
-                    v[12] = box.tl - 1.0;
-                    v[13] = vec2(box.left() - 1, box.bottom() + 1);
-                    v[14] = vec2(box.right() + 1, box.top() - 1);
-                    v[15] = box.br + 1;
+                    v[12] = box.tl - border;
+                    v[13] = vec2(box.left() - border, box.bottom() + border);
+                    v[14] = vec2(box.right() + border, box.top() - border);
+                    v[15] = box.br + border;
+                    s.vertexIndex += 4;
                 }
             }
 
+            // All the layer's quads cover their textures fully
+            for (vec2 *t = m_texCoords + e->vboOffset; t < m_texCoords + s.vertexIndex; t += 4) {
+                t[0] = vec2(0, 0);
+                t[1] = vec2(0, 1);
+                t[2] = vec2(1, 0);
+                t[3] = vec2(1, 1);
+            }
+
             // We're a nested layer, accumulate the layered bounding box into
             // the stored one..
             if (storedTextureed)
-                storedBox |= m_layerBoundingBox;
+                storedBox |= s.layerBoundingBox;
+
+            s.layerBoundingBox = storedBox;
+            if (s.render3d) {
+                // Let the opacity layer's z be the average of all its children..
+                float z = 0;
+                for (unsigned i=0; i<=e->groupSize; ++i)
+                    z += (e+i)->z;
+                e->z = z / e->groupSize;
+            }
+        }
+
+    } return;
+
+    case Node::RenderNodeType: {
+        Element *e = m_elements + s.elementIndex++;
+        e->node = n;
+        rect2d geometry = static_cast<RectangleNodeBase *>(n)->geometry();
+        vec2 p1 = geometry.tl;
+        vec2 p2 = geometry.br;
+        // This will "kinda" work. As long as our 3d support is based on back-
+        // to-front ordering of the center of primitives, we might as well
+        // order render nodes back-to-front as well. The usercase is a bit
+        // broken though..
+        if (s.render3d)
+            e->z = (s.m3d * vec3((p1 + p2) / 2.0f)).z;
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    for (Node *c = n->child(); c; c = c->sibling())
+        build(s, c);
+
+
+}
+
+/*!
+    Returns true if the children of \a root can be built independently of
+    each other, which is the case when \a root does not need any state of its
+    own during the build.
+ */
+inline bool OpenGLRenderer::isParallelBuildRoot(Node *root) const
+{
+    if (root->type() == Node::BasicNodeType)
+        return true;
+    TransformNode *tn = TransformNode::from(root);
+    return tn && tn->projectionDepth() == 0;
+}
+
+/*!
+    Does the same as prepass() for \a root, but also records the build state
+    at each of its children, which is where their builds start.
+ */
+inline void OpenGLRenderer::prepassSubtrees(BuildState &s, Node *root)
+{
+    m_subtrees.clear();
+    root->preprocess();
+    if (isOffscreen(s, root))
+        return;
+
+    TransformNode *tn = TransformNode::from(root);
+    mat4 old = s.m2d;
+    if (tn) {
+        ++m_numTransformNodes;
+        s.m2d = s.m2d * tn->matrix();
+    }
+    for (Node *c = root->child(); c; c = c->sibling()) {
+        SubtreeStart start = { c, s };
+        start.state.elementIndex = requiredElementCount();
+        start.state.vertexIndex = requiredVertexCount();
+        m_subtrees.push_back(start);
+        prepass(s, c);
+    }
+    s.m2d = old;
+}
+
+/*!
+    Does the same as build() for \a root, with its children built on the
+    build threads. Consecutive children are grouped into runs of about the
+    same number of elements. There are several runs per thread, so that the
+    threads which finish early can take over runs from the others.
+ */
+inline void OpenGLRenderer::buildSubtrees(Node *root)
+{
+    root->clearDirty();
+
+    unsigned size = std::max(m_elementCount / (m_buildPool->threadCount() * 4), 1u);
+    std::vector<unsigned> runs;
+    unsigned next = 0;
+    for (unsigned i=0; i<m_subtrees.size(); ++i) {
+        if (m_subtrees[i].state.elementIndex >= next) {
+            runs.push_back(i);
+            next = m_subtrees[i].state.elementIndex + size;
+        }
+    }
+    runs.push_back(m_subtrees.size());
+
+    m_buildPool->run(runs.size() - 1, [this, &runs] (unsigned run) {
+        BuildState s = m_subtrees[runs[run]].state;
+        for (unsigned i=runs[run]; i<runs[run + 1]; ++i)
+            build(s, m_subtrees[i].node);
+        assert(runs[run + 1] == m_subtrees.size() || s.elementIndex == m_subtrees[runs[run + 1]].state.elementIndex);
+        assert(runs[run + 1] == m_subtrees.size() || s.vertexIndex == m_subtrees[runs[run + 1]].state.vertexIndex);
+        assert(runs[run + 1] < m_subtrees.size() || s.elementIndex == m_elementCount);
+        assert(runs[run + 1] < m_subtrees.size() || s.vertexIndex == m_vertexCount);
+    });
+
+    Node::RenderRange range = { 0, m_elementCount, 0, m_vertexCount };
+    root->setRenderRange(range);
+
+    bool dirty = false;
+    for (Node *c = root->child(); c && !dirty; c = c->sibling())
+        dirty = c->needsUpdate();
+    root->setDirtyDescendants(dirty);
+}
+
+/*!
+    Walks the parts of the tree which have changed since the previous frame
+    and rebuilds them in place. Returns false if the changes could not be
+    applied in place, in which case the whole tree needs to be rebuilt.
+ */
+inline bool OpenGLRenderer::update(BuildState &s, Node *n)
+{
+    n->preprocess();
+
+    // The opacity and color matrix are applied when the layer is drawn, so
+    // a change to only these keeps the layer and its cached content.
+    const Node::RenderRange &range = n->renderRange();
+    if (n->isDirty()
+        && !n->childrenChanged()
+        && !n->hasDirtyDescendants()
+        && (n->type() == Node::OpacityNodeType || n->type() == Node::ColorFilterNodeType)
+        && isLayered(n)
+        && range.elementCount > 0
+        && m_elements[range.element].layered) {
+        n->clearDirty();
+        if (damageTrackingEnabled())
+            m_frameDamage |= boundingRectFor(range);
+        return true;
+    }
+
+    // The bounds of a layer and the back-to-front ordering of a 3D subtree
+    // depend on all of its children, so these are rebuilt as a whole. The
+    // same goes for subtrees which were culled, as their children were never
+    // placed.
+    if (n->isDirty()
+        || isLayered(n)
+        || (n->type() == Node::TransformNodeType && static_cast<TransformNode *>(n)->projectionDepth() > 0)
+        || range.elementCount == 0)
+        return rebuild(s, n);
+
+    TransformNode *tn = TransformNode::from(n);
+    mat4 old = s.m2d;
+    if (tn)
+        s.m2d = s.m2d * tn->matrix();
+    rect2d storedClip = s.clipRect;
+    if (n->type() == Node::ClipNodeType)
+        s.clipRect = clipBoundsFor(s, n);
+
+    bool dirty = false;
+    for (Node *c = n->child(); c; c = c->sibling()) {
+        if (c->needsUpdate() && !update(s, c))
+            return false;
+        dirty |= c->needsUpdate();
+    }
+
+    s.m2d = old;
+    s.clipRect = storedClip;
+    n->setDirtyDescendants(dirty);
+    return true;
+}
+
+/*!
+    Rebuilds the subtree of \a n into the range it occupied in the previous
+    frame. Returns false if the subtree no longer fits into that range.
+ */
+inline bool OpenGLRenderer::rebuild(BuildState &s, Node *n)
+{
+    const Node::RenderRange range = n->renderRange();
+
+    // Changing an occluder affects the culling of everything behind it
+    if (containsOccluder(range))
+        return false;
+    s.occluderIndex = 0;
+    while (s.occluderIndex < m_occluders.size() && m_occluders[s.occluderIndex].element < range.element)
+        ++s.occluderIndex;
+
+    // prepass(s, ) accumulates into the frame's counters. These are recounted
+    // once the update is completed, except for the transform nodes which
+    // don't produce elements of their own.
+    unsigned elementCount = requiredElementCount();
+    unsigned vertexCount = requiredVertexCount();
+    unsigned transformCount = m_numTransformNodes;
+    unsigned occluderIndex = s.occluderIndex;
+    prepass(s, n);
+    m_numTransformNodes = transformCount;
+    s.occluderIndex = occluderIndex;
+
+    if (requiredElementCount() - elementCount != range.elementCount
+        || requiredVertexCount() - vertexCount != range.vertexCount)
+        return false;
 
-            m_layerBoundingBox = storedBox;
-            if (m_render3d) {
-                // Let the opacity layer's z be the average of all its children..
-                float z = 0;
-                for (unsigned i=0; i<=e->groupSize; ++i)
-                    z += (e+i)->z;
-                e->z = z / e->groupSize;
-            }
-        }
+    // Both where the subtree was and where it is now need to be repainted
+    if (damageTrackingEnabled())
+        m_frameDamage |= boundingRectFor(range);
+
+    releaseLayers(m_elements + range.element, m_elements + range.element + range.elementCount);
+    releaseDepthOrders(range.element, range.element + range.elementCount);
+    memset(m_elements + range.element, 0, range.elementCount * sizeof(Element));
+    if (m_instances)
+        std::fill(m_instances + range.vertex / 4, m_instances + (range.vertex + range.vertexCount) / 4, RectInstance());
+    s.elementIndex = range.element;
+    s.vertexIndex = range.vertex;
+    build(s, n);
+    assert(s.elementIndex == range.element + range.elementCount);
+    assert(s.vertexIndex == range.vertex + range.vertexCount);
+    markVerticesDirty(range.vertex, range.vertex + range.vertexCount);
+
+    if (damageTrackingEnabled())
+        m_frameDamage |= boundingRectFor(range);
 
-    } return;
+    return true;
+}
 
-    case Node::RenderNodeType: {
-        Element *e = m_elements + m_elementIndex++;
-        e->node = n;
-        rect2d geometry = static_cast<RectangleNodeBase *>(n)->geometry();
-        vec2 p1 = geometry.tl;
-        vec2 p2 = geometry.br;
-        // This will "kinda" work. As long as our 3d support is based on back-
-        // to-front ordering of the center of primitives, we might as well
-        // order render nodes back-to-front as well. The usercase is a bit
-        // broken though..
-        if (m_render3d)
-            e->z = (m_m3d * vec3((p1 + p2) / 2.0f)).z;
-        break;
+/*!
+    Returns the bounding rect of all the quads in \a range. This covers
+    everything the range draws to the screen. Instanced quads have no
+    vertices, so their corners come from the instance.
+ */
+inline rect2d OpenGLRenderer::boundingRectFor(const Node::RenderRange &range) const
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    rect2d bounds(inf, inf, -inf, -inf);
+    for (unsigned i=range.vertex; i<range.vertex + range.vertexCount; i += 4) {
+        if (isInstanced(i / 4)) {
+            const RectInstance &r = m_instances[i / 4];
+            bounds |= r.origin;
+            bounds |= r.origin + r.dx;
+            bounds |= r.origin + r.dy;
+            bounds |= r.origin + r.dx + r.dy;
+        } else {
+            for (unsigned j=i; j<i+4; ++j)
+                bounds |= m_vertices[j];
+        }
     }
+    return bounds;
+}
 
-    default:
-        break;
+/*!
+    Returns the area of the surface which needs to be repainted this frame.
+    This is the damage accumulated during the update combined with the damage
+    of the frames rendered since the one in the back buffer. The whole
+    surface is repainted when \a full is set or when the buffer age is not
+    known.
+ */
+inline rect2d OpenGLRenderer::damageForFrame(bool full)
+{
+    vec2 size = targetSurface()->size();
+    rect2d surfaceRect(vec2(0, 0), size);
+
+    rect2d damage;
+    if (full || m_frameDamage.width() > size.x || m_frameDamage.height() > size.y) {
+        damage = surfaceRect;
+    } else if (m_frameDamage.width() > 0 && m_frameDamage.height() > 0) {
+        // Include a pixel around the edges for antialiasing and filtering
+        rect2d r = m_frameDamage.aligned();
+        damage = rect2d(std::max(r.left() - 1, 0.0f), std::max(r.top() - 1, 0.0f),
+                        std::min(r.right() + 1, size.x), std::min(r.bottom() + 1, size.y));
+        if (damage.width() <= 0 || damage.height() <= 0)
+            damage = rect2d();
     }
 
-    for (Node *c = n->child(); c; c = c->sibling())
-        build(c);
+    rect2d repaint = damage;
+    unsigned age = bufferAge();
+    if (age == 0 || age > RENGINE_OPENGL_DAMAGE_HISTORY + 1) {
+        repaint = surfaceRect;
+    } else {
+        for (unsigned i=0; i<age-1; ++i) {
+            const rect2d &d = m_damageHistory[i];
+            if (d.width() <= 0 || d.height() <= 0)
+                continue;
+            if (repaint.width() <= 0 || repaint.height() <= 0)
+                repaint = d;
+            else
+                repaint |= d;
+        }
+    }
 
+    for (int i=RENGINE_OPENGL_DAMAGE_HISTORY-1; i>0; --i)
+        m_damageHistory[i] = m_damageHistory[i-1];
+    m_damageHistory[0] = damage;
 
+    return repaint;
 }
 
-inline void rengine_create_texture(int id, int w, int h)
+inline void OpenGLRenderer::recount()
 {
-    glBindTexture(GL_TEXTURE_2D, id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    m_numLayeredNodes = 0;
+    m_numTextureNodes = 0;
+    m_numRectangleNodes = 0;
+    m_numTransformNodesWith3d = 0;
+    m_numRenderNodes = 0;
+    m_numClipNodes = 0;
+    for (unsigned i=0; i<m_elementCount; ++i) {
+        const Element &e = m_elements[i];
+        if (e.layered) {
+            ++m_numLayeredNodes;
+        } else if (e.clip) {
+            ++m_numClipNodes;
+        } else {
+            switch (e.node->type()) {
+            case Node::TextureNodeType: ++m_numTextureNodes; break;
+            case Node::RectangleNodeType: ++m_numRectangleNodes; break;
+            case Node::RenderNodeType: ++m_numRenderNodes; break;
+            case Node::TransformNodeType: ++m_numTransformNodesWith3d; break;
+            default: break;
+            }
+        }
+    }
+    m_additionalQuads = m_vertexCount / 4 - m_numTextureNodes - m_numLayeredNodes - m_numRectangleNodes - m_numClipNodes;
 }
 
-
 // static int recursion;
 
 inline void OpenGLRenderer::renderToLayer(Element *e)
@@ -718,7 +2875,6 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
     // std::cout << space << "- doing layered rendering for: element=" << e << " node=" << e->node << std::endl;
     assert(e->layered);
 
-    // Create the FBO
     rect2d devRect = boundingRectFor(e->vboOffset);
 
     // Abort the render to layer pass if the dev rect happens to be zero..
@@ -726,12 +2882,22 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
         return;
     }
 
+    markGpuTime(GpuTimestamp::LayerStart, e->node);
+
     // Store current state...
     bool stored3d = m_render3d;
     bool storedTextureed = m_layered;
     GLuint storedFbo = m_fbo;
     mat4 storedProjection = m_proj;
     vec2 storedSize = m_surfaceSize;
+    bool storedScissor = m_scissor;
+    rect2d storedScissorRect = m_scissorRect;
+
+    // The damage only applies to the surface, layers are always rendered in full
+    if (m_scissor) {
+        glDisable(GL_SCISSOR_TEST);
+        m_scissor = false;
+    }
 
     m_render3d |= e->projection;
     m_layered = true;
@@ -740,21 +2906,32 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
     BlurNode *blurNode = BlurNode::from(e->node);
     ShadowNode *shadowNode = ShadowNode::from(e->node);
 
+    // Large blurs render their content at a reduced resolution. The
+    // projection is the same, only the viewport shrinks. A shadow draws its
+    // content as is, so its content is reduced after it has been rendered
+    // and only the blurred alpha is kept at the lower resolution.
+    unsigned downsampling = 1;
+    if (blurNode)
+        downsampling = blurDownsampling(blurNode);
+    else if (shadowNode)
+        downsampling = blurDownsampling(shadowNode);
+    unsigned contentDownsampling = blurNode ? downsampling : 1;
+
+    // Leave a transparent texel around the content for the blur to clamp to
     if (blurNode || shadowNode) {
-        devRect.tl -= 1.0f;
-        devRect.br += 1.0f;
+        devRect.tl -= float(downsampling);
+        devRect.br += float(downsampling);
     }
 
     // std::cout << space << " ---> from " << e->vboOffset << " " << m_vertices[e->vboOffset] << " " << m_vertices[e->vboOffset+3] << std::endl;
 
-    m_surfaceSize = devRect.size();
+    m_surfaceSize = TexturePool::downsampledSize(devRect.size(), contentDownsampling);
 
-    e->texture = m_texturePool.acquire();
-    rengine_create_texture(e->texture, devRect.width(), devRect.height());
-
-    glGenFramebuffers(1, &m_fbo);
+    bool stencil = std::any_of(e + 1, e + e->groupSize + 1, [](const Element &c) { return c.stencil; });
+    e->texture = m_texturePool.acquire(m_surfaceSize, &m_fbo, stencil);
+    m_boundTexture = ~GLuint(0);
     glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, e->texture, 0);
+    ++m_frameStats.framebufferSwitches;
 
 #ifndef NDEBUG
     // Only enabled in debug mode because it syncs the GL stack and takes forever..
@@ -780,34 +2957,49 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
     glClearColor(0, 0, 0, 0);
     glClear(GL_COLOR_BUFFER_BIT);
     render(e + 1, e + e->groupSize + 1);
+    markGpuTime(GpuTimestamp::LayerContentEnd, e->node);
 
     if (blurNode || shadowNode) {
         int tmpTex = e->texture;
-        e->texture = m_texturePool.acquire();
+        GLuint alphaTex = shadowNode ? downsampleShadowContent(e, tmpTex, devRect.size(), downsampling) : GLuint(tmpTex);
         rect2d expandedWidth = boundingRectFor(e->vboOffset + 4);
+        vec2 targetSize = TexturePool::downsampledSize(expandedWidth.size(), downsampling);
+        e->texture = m_texturePool.acquire(targetSize, &m_fbo, false, shadowNode ? m_shadowFormat : GL_RGBA);
+        m_boundTexture = ~GLuint(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+        ++m_frameStats.framebufferSwitches;
         m_proj = mat4::scale2D(1.0, -1.0)
                  * mat4::translate2D(-1.0, 1.0)
                  * mat4::scale2D(2.0f / expandedWidth.width(), -2.0f / expandedWidth.height())
                  * mat4::translate2D(-expandedWidth.tl.x, -expandedWidth.tl.y);
         m_matrixState = UpdateAllPrograms;
-        rengine_create_texture(e->texture, expandedWidth.width(), expandedWidth.height());
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, e->texture, 0);
         glClear(GL_COLOR_BUFFER_BIT);
-        glViewport(0, 0, expandedWidth.width(), expandedWidth.height());
+        setViewport(targetSize);
+        vec2 step(downsampling / expandedWidth.width(), 0);
         if (blurNode) {
-            drawBlurQuad(e->vboOffset + 4, tmpTex, blurNode->radius(), expandedWidth.size(), devRect.size(), vec2(1/expandedWidth.width(), 0));
+            unsigned radius = (blurNode->radius() + downsampling - 1) / downsampling;
+            drawBlurQuad(e->vboOffset + 4, tmpTex, radius, expandedWidth.size(), devRect.size(), step, downsampling);
             m_texturePool.release(tmpTex);
         } else if (shadowNode) {
-            drawShadowQuad(e->vboOffset + 4, tmpTex, shadowNode->radius(), expandedWidth.size(), devRect.size(), vec2(1/expandedWidth.width(), 0), vec4(0, 0, 0, 1));
+            // The color and offset are applied when the shadow is drawn
+            unsigned radius = (shadowNode->radius() + downsampling - 1) / downsampling;
+            drawShadowAlphaQuad(e->vboOffset + 4, alphaTex, radius, expandedWidth.size(), devRect.size(), step, downsampling);
+            if (alphaTex != GLuint(tmpTex))
+                m_texturePool.release(alphaTex);
             e->sourceTexture = tmpTex;
         }
     }
+    markGpuTime(GpuTimestamp::LayerEnd, e->node);
 
     // Reset the GL state..
-    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
     glBindFramebuffer(GL_FRAMEBUFFER, storedFbo);
-    glDeleteFramebuffers(1, &m_fbo);
+    ++m_frameStats.framebufferSwitches;
+
+    // Keep the layer until the subtree changes, unless it contains render
+    // nodes which can change their output without us knowing about it.
+    e->cached = m_layerCaching && (m_numRenderNodes == 0 || std::none_of(e + 1, e + e->groupSize + 1, [](const Element &c) {
+        return c.node->type() == Node::RenderNodeType;
+    }));
 
     // Reset the old state...
     m_fbo = storedFbo;
@@ -816,10 +3008,42 @@ inline void OpenGLRenderer::renderToLayer(Element *e)
     m_proj = storedProjection;
     m_matrixState = UpdateAllPrograms;
     m_surfaceSize = storedSize;
+    m_scissorRect = storedScissorRect;
+    if (storedScissor) {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(m_scissorRect.x(), m_scissorRect.y(), m_scissorRect.width(), m_scissorRect.height());
+        m_scissor = true;
+    }
 
     // std::cout << space << "- layer is completed..." << std::endl;
 }
 
+/*!
+    Returns the textures of the layered element \a e to the pool.
+ */
+inline void OpenGLRenderer::releaseLayer(Element *e)
+{
+    if (e->texture)
+        m_texturePool.release(e->texture);
+    if (e->sourceTexture)
+        m_texturePool.release(e->sourceTexture);
+    e->texture = 0;
+    e->sourceTexture = 0;
+    e->cached = false;
+}
+
+/*!
+    Releases the cached layers in the range \a first to \a last. Called
+    before the elements are rebuilt.
+ */
+inline void OpenGLRenderer::releaseLayers(Element *first, Element *last)
+{
+    for (Element *e = first; e < last; ++e) {
+        if (e->layered)
+            releaseLayer(e);
+    }
+}
+
 /*!
     Render the elements, starting at \a first and all elements up to, but not including \a last.
  */
@@ -830,25 +3054,44 @@ inline void OpenGLRenderer::render(Element *first, Element *last)
     //     space += "    ";
     // std::cout << space << "render " << first << " -> " << last - 1 << std::endl;
 
+    renderLayers(first, last);
+    drawElements(first, last);
+}
+
+/*!
+    Renders the layers in the range \a first to \a last into their textures,
+    unless they are cached from a previous frame.
+ */
+inline void OpenGLRenderer::renderLayers(Element *first, Element *last)
+{
     // Check if we need to flatten something in this range
     if (m_numLayeredNodes > 0) {
         Element *e = first;
         // std::cout << space << "- checking layering for " << e << std::endl;
         while (e < last) {
             if (e->layered) {
-                // std::cout << space << "- needs layering: " << e << std::endl;
-                // ++recursion;
-                renderToLayer(e);
-                // --recursion;
+                if (e->cached) {
+                    // The children are already in the layer's texture
+                    for (Element *c = e + 1; c <= e + e->groupSize; ++c)
+                        c->completed = true;
+                } else {
+                    renderToLayer(e);
+                }
                 e = e + e->groupSize + 1;
             } else {
                 ++e;
             }
         }
     }
+}
 
-    //
-    glViewport(0, 0, m_surfaceSize.x, m_surfaceSize.y);
+/*!
+    Draws the elements in the range \a first to \a last which have not been
+    completed yet, back to front. The layers must have been rendered.
+ */
+inline void OpenGLRenderer::drawElements(Element *first, Element *last)
+{
+    setViewport(m_surfaceSize);
 
     Element *e = first;
     while (e < last) {
@@ -858,55 +3101,64 @@ inline void OpenGLRenderer::render(Element *first, Element *last)
             continue;
         }
 
+        if (m_depthTest)
+            setDepthFor(e);
+
         if (e->node->type() == Node::RectangleNodeType) {
-            // std::cout << space << "---> rect quad, vbo=" << e->vboOffset
-            //      << " " << m_proj * m_vertices[e->vboOffset] << " " << m_proj * m_vertices[e->vboOffset+3] << std::endl;
-            drawColorQuad(e->vboOffset, static_cast<RectangleNode *>(e->node)->color());
+            e = drawColorBatch(e, last);
+            continue;
         } else if (e->node->type() == Node::TextureNodeType) {
-            // std::cout << space << "---> texture quad, vbo=" << e->vboOffset << std::endl;
-            const Texture *texture = static_cast<TextureNode *>(e->node)->texture();
-            drawTextureQuad(e->vboOffset, texture->textureId(), 1.0f, texture->format());
+            e = drawTextureBatch(e, last);
+            continue;
         } else if (e->node->type() == Node::OpacityNodeType && e->layered && e->texture) {
             // std::cout << space << "---> layered texture quad, vbo=" << e->vboOffset << " texture=" << e->texture << std::endl;
-            drawTextureQuad(e->vboOffset, e->texture, static_cast<OpacityNode *>(e->node)->opacity());
-            m_texturePool.release(e->texture);
+            drawLayerQuad(e->vboOffset, e->texture, static_cast<OpacityNode *>(e->node)->opacity());
+            if (!e->cached)
+                releaseLayer(e);
         } else if (e->node->type() == Node::ColorFilterNodeType && e->layered && e->texture) {
             // std::cout << space << "---> layered texture quad, vbo=" << e->vboOffset << " texture=" << e->texture << std::endl;
             drawColorFilterQuad(e->vboOffset, e->texture, static_cast<ColorFilterNode *>(e->node)->colorMatrix());
-            m_texturePool.release(e->texture);
+            if (!e->cached)
+                releaseLayer(e);
         } else if (e->node->type() == Node::BlurNodeType && e->layered && e->texture) {
             // std::cout << space << "---> blur texture quad, vbo=" << e->vboOffset << " texture=" << e->texture << std::endl;
             BlurNode *blurNode = static_cast<BlurNode *>(e->node);
             vec2 textureSize = boundingRectFor(e->vboOffset + 4).size();
             vec2 renderSize = boundingRectFor(e->vboOffset + 8).size();
             // std::cout << " - radius: " << blurNode->radius() << " textureSize=" << textureSize << ", renderSize=" << renderSize << std::endl;
-            drawBlurQuad(e->vboOffset + 8, e->texture, blurNode->radius(), renderSize, textureSize, vec2(0, 1/renderSize.y));
-            m_texturePool.release(e->texture);
+            unsigned downsampling = blurDownsampling(blurNode);
+            unsigned radius = (blurNode->radius() + downsampling - 1) / downsampling;
+            drawBlurQuad(e->vboOffset + 8, e->texture, radius, renderSize, textureSize, vec2(0, downsampling / renderSize.y), downsampling);
+            if (!e->cached)
+                releaseLayer(e);
         } else if (e->node->type() == Node::ShadowNodeType && e->layered && e->texture) {
             // std::cout << "---> shadow texture quad, vbo=" << e->vboOffset << " texture=" << e->texture << std::endl;
             ShadowNode *shadowNode = static_cast<ShadowNode *>(e->node);
             vec2 textureSize = boundingRectFor(e->vboOffset + 4).size();
             vec2 renderSize = boundingRectFor(e->vboOffset + 8).size();
-            mat4 storedProj = m_proj;
-            m_proj = m_proj * mat4::translate2D(std::round(shadowNode->offset().x), std::round(shadowNode->offset().y));
-            m_matrixState |= UpdateShadowProgram;
             // std::cout << " - radius: " << shadowNode->radius() << " textureSize=" << textureSize << ", renderSize=" << renderSize << std::endl;
-            drawShadowQuad(e->vboOffset + 8, e->texture, shadowNode->radius(), renderSize, textureSize, vec2(0, 1/renderSize.y), shadowNode->color());
-            m_proj = storedProj;
-            m_matrixState |= UpdateShadowProgram;
-            drawTextureQuad(e->vboOffset + 12, e->sourceTexture);
-            m_texturePool.release(e->texture);
-            m_texturePool.release(e->sourceTexture);
+            unsigned downsampling = blurDownsampling(shadowNode);
+            unsigned radius = (shadowNode->radius() + downsampling - 1) / downsampling;
+            drawShadowQuad(e->vboOffset + 8, e->texture, radius, renderSize, textureSize, vec2(0, downsampling / renderSize.y), downsampling, shadowNode->color());
+            drawLayerQuad(e->vboOffset + 12, e->sourceTexture);
+            if (!e->cached)
+                releaseLayer(e);
+        } else if (e->clip) {
+            drawClippedElements(e);
         } else if (e->projection) {
-            std::sort(e + 1, e + e->groupSize + 1);
             // std::cout << space << "---> projection, sorting range: " << (e+1) << " -> " << (e+e->groupSize) << std::endl;
+            drawProjectedElements(e);
         } else if (e->node->type() == Node::RenderNodeType) {
             RenderNode *rn = static_cast<RenderNode *>(e->node);
             if (rn->width() != 0 && rn->height() != 0) {
                 activateShader(0);
+                resetAttribDivisors();
                 glBindBuffer(GL_ARRAY_BUFFER, 0);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
                 rn->render();
                 setDefaultOpenGLState();
+                if (m_stencilDepth > 0)
+                    glEnable(GL_STENCIL_TEST);
             }
         }
 
@@ -915,14 +3167,474 @@ inline void OpenGLRenderer::render(Element *first, Element *last)
     }
 }
 
-inline void OpenGLRenderer::setDefaultOpenGLState()
+/*!
+    Draws the elements of the 3D subtree at the projection element \a e back
+    to front. The elements are drawn in place, in runs of the ones which are
+    next to each other in both the order and the element list, so these are
+    still batched.
+ */
+inline void OpenGLRenderer::drawProjectedElements(Element *e)
+{
+    // Clips inside sort their children when they are drawn. Creating their
+    // orders up front keeps this one from moving while it is in use.
+    for (Element *c = e + 1; c <= e + e->groupSize; ++c) {
+        if (c->clip && c->projection)
+            depthOrderFor(c);
+    }
+
+    const std::vector<unsigned> &order = depthOrderFor(e).order;
+    unsigned i = 0;
+    while (i < order.size()) {
+        unsigned first = order[i];
+        unsigned last = first + 1;
+        while (++i < order.size() && order[i] == last)
+            ++last;
+        drawElements(m_elements + first, m_elements + last);
+    }
+
+    // The children of layers are already completed
+    for (Element *c = e + 1; c <= e + e->groupSize; ++c)
+        c->completed = true;
+}
+
+/*!
+    Returns the back-to-front order of the projection element \a e. The
+    elements are only sorted when there is no order from the previous frame.
+ */
+inline OpenGLRenderer::DepthOrder &OpenGLRenderer::depthOrderFor(Element *e)
+{
+    unsigned element = e - m_elements;
+    auto it = std::lower_bound(m_depthOrders.begin(), m_depthOrders.end(), element, [](const DepthOrder &d, unsigned i) {
+        return d.element < i;
+    });
+    if (it == m_depthOrders.end() || it->element != element) {
+        DepthOrder d;
+        d.element = element;
+        it = m_depthOrders.insert(it, d);
+        sortByDepth(e, it->order);
+    }
+    return *it;
+}
+
+/*!
+    Puts the elements drawn by the projection element \a e into \a order,
+    back to front, where layers and clips count as one element. The depth is quantized to 16 bits across the range
+    of the subtree and sorted in two stable 8-bit radix passes, so elements
+    at the same depth are drawn in tree order.
+ */
+inline void OpenGLRenderer::sortByDepth(Element *e, std::vector<unsigned> &order)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    float minZ = inf;
+    float maxZ = -inf;
+    for (Element *c = e + 1; c <= e + e->groupSize; ++c) {
+        minZ = std::min(minZ, c->z);
+        maxZ = std::max(maxZ, c->z);
+        if (c->layered || c->clip)
+            c += c->groupSize;
+    }
+    float scale = maxZ > minZ ? 65535.0f / (maxZ - minZ) : 0.0f;
+
+    if (m_depthKeys.size() < m_elementCount)
+        m_depthKeys.resize(m_elementCount);
+    unsigned *keys = m_depthKeys.data();
+
+    unsigned count = 0;
+    for (Element *c = e + 1; c <= e + e->groupSize; ++c) {
+        keys[c - m_elements] = unsigned((c->z - minZ) * scale);
+        ++count;
+        if (c->layered || c->clip)
+            c += c->groupSize;
+    }
+
+    order.clear();
+    for (Element *c = e + 1; c <= e + e->groupSize; ++c) {
+        order.push_back(c - m_elements);
+        if (c->layered || c->clip)
+            c += c->groupSize;
+    }
+
+    m_depthScratch.resize(count);
+    unsigned *from = order.data();
+    unsigned *to = m_depthScratch.data();
+    for (unsigned shift=0; shift<16; shift += 8) {
+        unsigned offsets[256] = { 0 };
+        for (unsigned i=0; i<count; ++i)
+            ++offsets[(keys[from[i]] >> shift) & 0xff];
+        unsigned sum = 0;
+        for (unsigned &o : offsets) {
+            unsigned n = o;
+            o = sum;
+            sum += n;
+        }
+        for (unsigned i=0; i<count; ++i)
+            to[offsets[(keys[from[i]] >> shift) & 0xff]++] = from[i];
+        std::swap(from, to);
+    }
+    // An even number of passes ends up back in 'order'
+    assert(from == order.data());
+}
+
+/*!
+    Forgets the depth orders of the projection elements in the range \a first
+    to \a last, as these are about to be rebuilt.
+ */
+inline void OpenGLRenderer::releaseDepthOrders(unsigned first, unsigned last)
+{
+    m_depthOrders.erase(std::remove_if(m_depthOrders.begin(), m_depthOrders.end(), [first, last](const DepthOrder &d) {
+        return d.element >= first && d.element < last;
+    }), m_depthOrders.end());
+}
+
+/*!
+    Returns the rect in window coordinates which covers \a deviceRect in the
+    current render target, rounded to whole pixels.
+ */
+inline rect2d OpenGLRenderer::windowRectFor(rect2d deviceRect) const
+{
+    vec2 a = (m_proj * deviceRect.tl + 1.0f) * 0.5f * m_surfaceSize;
+    vec2 b = (m_proj * deviceRect.br + 1.0f) * 0.5f * m_surfaceSize;
+    rect2d r = rect2d(a, b).normalized();
+    return rect2d(std::floor(r.left() + 0.5f), std::floor(r.top() + 0.5f),
+                  std::floor(r.right() + 0.5f), std::floor(r.bottom() + 0.5f));
+}
+
+/*!
+    Starts timing the frame on the GPU, when enabled and there is room for
+    another frame of timer queries.
+ */
+inline void OpenGLRenderer::beginGpuTimer()
+{
+    m_gpuTimerActive = gpuTimingEnabled() && gpuTimingSupported() && m_gpuTimers.size() < RENGINE_OPENGL_GPU_TIMER_FRAMES;
+    if (!m_gpuTimerActive)
+        return;
+    m_gpuTimers.push_back(GpuTimer());
+    m_gpuTimers.back().frame = ++m_gpuFrame;
+    markGpuTime(GpuTimestamp::FrameStart);
+}
+
+/*!
+    Takes a timestamp on the GPU once the commands issued so far are done.
+ */
+inline void OpenGLRenderer::markGpuTime(GpuTimestamp::Type type, const Node *node)
+{
+    if (!m_gpuTimerActive)
+        return;
+    GpuTimestamp t;
+    t.type = type;
+    t.node = node;
+    if (m_freeQueries.empty()) {
+        m_genQueries(1, &t.query);
+    } else {
+        t.query = m_freeQueries.back();
+        m_freeQueries.pop_back();
+    }
+    m_queryCounter(t.query, GL_TIMESTAMP);
+    m_gpuTimers.back().timestamps.push_back(t);
+}
+
+inline void OpenGLRenderer::endGpuTimer()
+{
+    markGpuTime(GpuTimestamp::FrameEnd);
+    m_gpuTimerActive = false;
+}
+
+/*!
+    Reads the timer queries of the frames whose queries have completed and
+    reports the latest of them through gpuTimes(). Never waits for the GPU.
+ */
+inline void OpenGLRenderer::collectGpuTimers()
+{
+    if (m_gpuTimers.empty())
+        return;
+
+    // The timestamps are meaningless if the GPU was reset or changed clock
+    // while they were taken.
+    GLint disjoint = 0;
+#ifndef RENGINE_OPENGL_DESKTOP
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+#endif
+
+    unsigned collected = 0;
+    for (const GpuTimer &timer : m_gpuTimers) {
+        // Queries complete in order, so the last one says it all
+        GLint available = 0;
+        m_getQueryObjectiv(timer.timestamps.back().query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        ++collected;
+        for (const GpuTimestamp &t : timer.timestamps)
+            m_freeQueries.push_back(t.query);
+        if (disjoint)
+            continue;
+
+        GpuTimes times;
+        times.frame = timer.frame;
+        std::vector<std::pair<unsigned, uint64_t>> open; // index into layerTimes and start of the layers being rendered
+        uint64_t start = 0;
+        uint64_t contentEnd = 0;
+        double topLevelLayers = 0;
+        for (const GpuTimestamp &t : timer.timestamps) {
+            uint64_t time = 0;
+            m_getQueryObjectui64v(t.query, GL_QUERY_RESULT, &time);
+            switch (t.type) {
+            case GpuTimestamp::FrameStart:
+                start = time;
+                break;
+            case GpuTimestamp::FrameEnd:
+                times.total = (time - start) / 1000000.0;
+                break;
+            case GpuTimestamp::LayerStart: {
+                GpuTimes::Layer layer = { t.node, 0, 0 };
+                open.push_back(std::make_pair(unsigned(times.layerTimes.size()), time));
+                times.layerTimes.push_back(layer);
+            } break;
+            case GpuTimestamp::LayerContentEnd:
+                assert(!open.empty());
+                times.layerTimes[open.back().first].content = (time - open.back().second) / 1000000.0;
+                contentEnd = time;
+                break;
+            case GpuTimestamp::LayerEnd: {
+                assert(!open.empty());
+                GpuTimes::Layer &layer = times.layerTimes[open.back().first];
+                layer.blur = (time - contentEnd) / 1000000.0;
+                times.blur += layer.blur;
+                if (open.size() == 1)
+                    topLevelLayers += (time - open.back().second) / 1000000.0;
+                open.pop_back();
+            } break;
+            }
+        }
+        times.layers = topLevelLayers - times.blur;
+        times.mainPass = times.total - topLevelLayers;
+
+        logi << "GPU frame " << times.frame << ": " << times.total << " ms, main pass: " << times.mainPass
+             << " ms, " << times.layerTimes.size() << " layers: " << times.layers
+             << " ms, blur: " << times.blur << " ms" << std::endl;
+        setGpuTimes(std::move(times));
+    }
+    m_gpuTimers.erase(m_gpuTimers.begin(), m_gpuTimers.begin() + collected);
+}
+
+/*!
+    Completes the counters of the frame, which started issuing GL calls at
+    \a renderStart, and makes them available through stats().
+ */
+inline void OpenGLRenderer::finishStats(std::chrono::steady_clock::time_point renderStart)
+{
+    RenderStats &s = m_frameStats;
+    s.rectangleNodes = m_numRectangleNodes;
+    s.textureNodes = m_numTextureNodes;
+    s.transformNodes = m_numTransformNodes;
+    s.transformNodes3D = m_numTransformNodesWith3d;
+    s.layeredNodes = m_numLayeredNodes;
+    s.clipNodes = m_numClipNodes;
+    s.renderNodes = m_numRenderNodes;
+    s.occludedNodes = m_numOccludedNodes;
+    s.layerTextures = m_texturePool.textureCount();
+    s.layerTextureBytes = m_texturePool.bytes();
+    s.renderTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - renderStart).count();
+
+    logd << "frame " << s.frame << (s.fullRebuild ? " (rebuilt): " : ": ")
+         << s.rectangleNodes << " rects, " << s.textureNodes << " textures, "
+         << s.transformNodes << " xforms, " << s.transformNodes3D << " xforms3D, "
+         << s.layeredNodes << " layers, " << s.clipNodes << " clips, " << s.occludedNodes << " occluded, "
+         << s.drawCalls << " draw calls, " << s.shaderSwitches << " shader switches, "
+         << s.textureBinds << " texture binds, " << s.framebufferSwitches << " fbo switches, "
+         << s.vertexBytesUploaded << " vertex bytes, " << s.layerTextureBytes << " layer bytes, "
+         << "prepass: " << s.prepassTime << " ms, build: " << s.buildTime << " ms, render: " << s.renderTime << " ms"
+         << std::endl;
+    setStats(s);
+}
+
+/*!
+    Marks the area covered by the clip quad at \a offset in the stencil
+    buffer, according to the current stencil op.
+ */
+inline void OpenGLRenderer::drawClipQuad(unsigned offset)
+{
+    glColorMask(false, false, false, false);
+    activateShader(&prog_solid);
+    ensureMatrixUpdated(UpdateSolidProgram, &prog_solid);
+    setVertexOffset(offset);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    ++m_frameStats.drawCalls;
+    glColorMask(true, true, true, true);
+}
+
+/*!
+    Draws the children of the clip element \a e, clipped to its quad. The
+    scissor is set to the bounds of the quad, which is enough for axis
+    aligned clips. Other clips also increment the stencil buffer inside the
+    quad and only draw where it matches the number of nested stencil clips.
+    The increment is undone afterwards, so the stencil buffer only needs to
+    be cleared for the outermost clip.
+ */
+inline void OpenGLRenderer::drawClippedElements(Element *e)
+{
+    bool stencil = e->stencil;
+    if (stencil && !m_layered && !m_hasStencilBuffer) {
+        static bool warned = false;
+        if (!warned) {
+            warned = true;
+            logw << "rotated and projected clips require a stencil buffer, clipping to their bounds" << std::endl;
+        }
+        stencil = false;
+    }
+
+    if (stencil) {
+        if (m_stencilDepth == 0) {
+            glEnable(GL_STENCIL_TEST);
+            glStencilMask(0xff);
+            glClearStencil(0);
+            glClear(GL_STENCIL_BUFFER_BIT);
+        }
+        glStencilFunc(GL_EQUAL, m_stencilDepth, 0xff);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+        drawClipQuad(e->vboOffset);
+        ++m_stencilDepth;
+        glStencilFunc(GL_EQUAL, m_stencilDepth, 0xff);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    }
+
+    bool storedScissor = m_scissor;
+    rect2d storedScissorRect = m_scissorRect;
+    rect2d r = windowRectFor(boundingRectFor(Node::RenderRange { 0, 0, e->vboOffset, 4 }));
+    if (m_scissor)
+        r &= m_scissorRect;
+    m_scissorRect = rect2d(r.tl, max(r.tl, r.br));
+    m_scissor = true;
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(m_scissorRect.x(), m_scissorRect.y(), m_scissorRect.width(), m_scissorRect.height());
+
+    if (e->projection)
+        drawProjectedElements(e);
+    else
+        drawElements(e + 1, e + e->groupSize + 1);
+
+    m_scissor = storedScissor;
+    m_scissorRect = storedScissorRect;
+    if (m_scissor)
+        glScissor(m_scissorRect.x(), m_scissorRect.y(), m_scissorRect.width(), m_scissorRect.height());
+    else
+        glDisable(GL_SCISSOR_TEST);
+
+    if (stencil) {
+        glStencilFunc(GL_EQUAL, m_stencilDepth, 0xff);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_DECR);
+        drawClipQuad(e->vboOffset);
+        --m_stencilDepth;
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        if (m_stencilDepth == 0)
+            glDisable(GL_STENCIL_TEST);
+        else
+            glStencilFunc(GL_EQUAL, m_stencilDepth, 0xff);
+    }
+}
+
+/*!
+    Returns true if the element \a e covers its quad fully with opaque
+    pixels, meaning it can be drawn without blending.
+ */
+inline bool OpenGLRenderer::isOpaque(const Element *e) const
+{
+    if (e->layered || e->projection)
+        return false;
+    switch (e->node->type()) {
+    case Node::RectangleNodeType:
+        return static_cast<RectangleNode *>(e->node)->color().w >= 1.0f;
+    case Node::TextureNodeType:
+        return !static_cast<TextureNode *>(e->node)->texture()->hasAlpha();
+    default:
+        return false;
+    }
+}
+
+/*!
+    Puts the quads drawn for \a e at a depth which is in front of all the
+    elements before it.
+ */
+inline void OpenGLRenderer::setDepthFor(const Element *e)
 {
-    // Assign our static texture coordinate buffer to attribute 1.
-    glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    float depth = 1.0f - 2.0f * (e - m_elements + 1) / float(m_elementCount + 1);
+    if (m_proj.m[11] != depth) {
+        m_proj.m[11] = depth;
+        m_matrixState = UpdateAllPrograms;
+    }
+}
+
+/*!
+    Draws the opaque elements in the range \a first to \a last front to
+    back with depth writes enabled. Consecutive elements which can be batched
+    are drawn in a single call, in their original order and at the depth of
+    the first one.
+ */
+inline void OpenGLRenderer::drawOpaqueElements(Element *first, Element *last)
+{
+    setViewport(m_surfaceSize);
+
+    Element *e = last - 1;
+    while (e >= first) {
+        if (e->completed || !isOpaque(e)) {
+            --e;
+            continue;
+        }
+
+        Node::Type type = e->node->type();
+        GLuint texId = type == Node::TextureNodeType
+                       ? static_cast<TextureNode *>(e->node)->texture()->textureId()
+                       : 0;
+        Element *b = e;
+        while (b > first
+               && e - b + 1 < RENGINE_OPENGL_MAX_BATCH_QUADS
+               && !(b-1)->completed
+               && (b-1)->node->type() == type
+               && (b-1)->vboOffset + 4 == b->vboOffset
+               && (b-1)->instanced == b->instanced
+               && isOpaque(b-1)
+               && (type != Node::TextureNodeType || static_cast<TextureNode *>((b-1)->node)->texture()->textureId() == texId))
+            --b;
+
+        setDepthFor(b);
+        if (type == Node::RectangleNodeType)
+            drawColorBatch(b, e + 1);
+        else
+            drawTextureBatch(b, e + 1);
+        e = b - 1;
+    }
+}
+
+inline void OpenGLRenderer::setLayerCachingEnabled(bool enabled)
+{
+    m_layerCaching = enabled;
+    if (!enabled)
+        releaseLayers(m_elements, m_elements + m_elementCount);
+}
 
-    // Bind the vertices
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+inline void OpenGLRenderer::setInstancingEnabled(bool enabled)
+{
+    if (enabled == m_instancing)
+        return;
+    m_instancing = enabled;
+    // The nodes are laid out differently, so the render list is rebuilt
+    m_retainedRoot = 0;
+}
+
+inline void OpenGLRenderer::setBuildThreadCount(unsigned count)
+{
+    if (count == buildThreadCount())
+        return;
+    if (count > 1)
+        m_buildPool.reset(new ThreadPool(count));
+    else
+        m_buildPool.reset();
+}
+
+inline void OpenGLRenderer::setDefaultOpenGLState()
+{
+    // Bind the vertices and the indices used for batched quads
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffers[m_currentVertexBuffer].id);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadIndexBuffer);
 
     // Set our default GL state..
     glDisable(GL_DEPTH_TEST);
@@ -930,56 +3642,165 @@ inline void OpenGLRenderer::setDefaultOpenGLState()
     glDepthMask(false);
     glEnable(GL_BLEND);
     glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    m_blending = true;
 
+    resetStateCache();
 }
 
 inline bool OpenGLRenderer::render()
 {
-    if (sceneRoot() == 0) {
+    Node *root = sceneRoot();
+    if (root == 0) {
         logw << " - no 'sceneRoot', surely this is not what you intended?" << std::endl;
         return false;
     }
 
-    vec4 c = fillColor();
-    glClearColor(c.x, c.y, c.z, c.w);
-    glClear(GL_COLOR_BUFFER_BIT);
-
     logd << std::endl;
 
-    m_numLayeredNodes = 0;
-    m_numTextureNodes = 0;
-    m_numRectangleNodes = 0;
-    m_numTransformNodes = 0;
-    m_numTransformNodesWith3d = 0;
-    m_numRenderNodes = 0;
-    m_additionalQuads = 0;
-    m_vertexIndex = 0;
-    m_elementIndex = 0;
-    prepass(sceneRoot());
-
-    unsigned vertexCount = (m_numTextureNodes
-                            + m_numLayeredNodes
-                            + m_numRectangleNodes
-                            + m_additionalQuads) * 4;
-    if (vertexCount == 0)
+    collectGpuTimers();
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point buildStart = Clock::now();
+    m_frameStats = RenderStats();
+    m_frameStats.frame = stats().frame + 1;
+
+    const float inf = std::numeric_limits<float>::infinity();
+    m_frameDamage = rect2d(inf, inf, -inf, -inf);
+
+    // What is culled depends on the size of the surface
+    rect2d viewport(vec2(0, 0), targetSurface()->size());
+    if (viewport.br != m_viewport.br) {
+        m_viewport = viewport;
+        m_retainedRoot = 0;
+    }
+
+    // Reuse the elements and vertices from the previous frame and only
+    // rebuild the parts of the tree which have changed since then.
+    BuildState state(m_viewport);
+    if (root == m_retainedRoot && !root->isDirty()) {
+        if (root->needsUpdate()) {
+            if (update(state, root))
+                recount();
+            else
+                m_retainedRoot = 0;
+        }
+    } else {
+        m_retainedRoot = 0;
+    }
+
+    bool fullRebuild = !m_retainedRoot;
+    if (fullRebuild) {
+        releaseLayers(m_elements, m_elements + m_elementCount);
+        m_depthOrders.clear();
+        m_numLayeredNodes = 0;
+        m_numTextureNodes = 0;
+        m_numRectangleNodes = 0;
+        m_numTransformNodes = 0;
+        m_numTransformNodesWith3d = 0;
+        m_numRenderNodes = 0;
+        m_numClipNodes = 0;
+        m_additionalQuads = 0;
+        m_numOccludedNodes = 0;
+        state = BuildState(m_viewport);
+        findOccluders(state, root);
+        bool parallel = m_buildPool && isParallelBuildRoot(root);
+        if (parallel)
+            prepassSubtrees(state, root);
+        else
+            prepass(state, root);
+        state = BuildState(m_viewport);
+        Clock::time_point prepassEnd = Clock::now();
+        m_frameStats.prepassTime = std::chrono::duration<double, std::milli>(prepassEnd - buildStart).count();
+        buildStart = prepassEnd;
+
+        unsigned vertexCount = requiredVertexCount();
+        unsigned elementCount = requiredElementCount();
+        unsigned instanceCount = m_instancing && instancingSupported() ? vertexCount / 4 : 0;
+        m_frameArena.reset(FrameArena::sizeOf<Element>(elementCount)
+                           + FrameArena::sizeOf<vec2>(vertexCount) * 2
+                           + FrameArena::sizeOf<unsigned>(vertexCount)
+                           + FrameArena::sizeOf<RectInstance>(instanceCount));
+        m_elements = m_frameArena.allocate<Element>(elementCount);
+        m_vertices = m_frameArena.allocate<vec2>(vertexCount);
+        m_texCoords = m_frameArena.allocate<vec2>(vertexCount);
+        m_colors = m_frameArena.allocate<unsigned>(vertexCount);
+        m_instances = instanceCount > 0 ? m_frameArena.allocate<RectInstance>(instanceCount) : 0;
+        memset(m_elements, 0, elementCount * sizeof(Element));
+        std::fill(m_texCoords, m_texCoords + vertexCount, vec2());
+        memset(m_colors, 0, vertexCount * sizeof(unsigned));
+        if (m_instances)
+            std::fill(m_instances, m_instances + instanceCount, RectInstance());
+        m_elementCount = elementCount;
+        m_vertexCount = vertexCount;
+        if (parallel && elementCount >= RENGINE_OPENGL_PARALLEL_BUILD_MIN_ELEMENTS && m_subtrees.size() > 1) {
+            buildSubtrees(root);
+        } else {
+            build(state, root);
+            assert(state.elementIndex == elementCount);
+            assert(state.vertexIndex == vertexCount);
+        }
+        markVerticesDirty(0, vertexCount);
+        m_retainedRoot = root;
+    }
+    Clock::time_point renderStart = Clock::now();
+    m_frameStats.fullRebuild = fullRebuild;
+    m_frameStats.buildTime = std::chrono::duration<double, std::milli>(renderStart - buildStart).count();
+
+    vec4 c = fillColor();
+    rect2d damage(vec2(0, 0), targetSurface()->size());
+    if (damageTrackingEnabled()) {
+        // Render nodes can change their output without us knowing about it
+        bool full = fullRebuild
+                    || m_numRenderNodes > 0
+                    || damage.size() != m_surfaceSize
+                    || !(c == m_damageFillColor);
+        m_damageFillColor = c;
+        damage = damageForFrame(full);
+        if (damage.width() > 0 && damage.height() > 0 && damage.size() != targetSurface()->size()) {
+            glEnable(GL_SCISSOR_TEST);
+            m_scissorRect = rect2d::fromXywh(damage.left(), targetSurface()->size().y - damage.bottom(), damage.width(), damage.height());
+            glScissor(m_scissorRect.x(), m_scissorRect.y(), m_scissorRect.width(), m_scissorRect.height());
+            m_scissor = true;
+        }
+    } else {
+        // The whole surface is repainted, so it is all damaged
+        for (rect2d &d : m_damageHistory)
+            d = damage;
+    }
+    setDamageRect(damage);
+
+    bool repaint = damage.width() > 0 && damage.height() > 0;
+    bool opaquePass = m_opaquePass && m_numTransformNodesWith3d == 0 && m_numRenderNodes == 0 && m_numClipNodes == 0;
+    if (opaquePass && !m_hasDepthBuffer) {
+        logw << "the opaque pass requires a depth buffer" << std::endl;
+        opaquePass = false;
+        m_opaquePass = false;
+    }
+    beginGpuTimer();
+    if (repaint) {
+        glClearColor(c.x, c.y, c.z, c.w);
+        if (opaquePass) {
+            glDepthMask(true);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        } else {
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+    }
+
+    unsigned vertexCount = m_vertexCount;
+    unsigned elementCount = m_elementCount;
+    if (vertexCount == 0) {
+        if (m_scissor) {
+            glDisable(GL_SCISSOR_TEST);
+            m_scissor = false;
+        }
+        m_surfaceSize = targetSurface()->size();
+        endGpuTimer();
+        finishStats(renderStart);
         return true;
+    }
 
-    m_vertices = (vec2 *) alloca(vertexCount * sizeof(vec2));
-    unsigned elementCount = (m_numLayeredNodes + m_numTextureNodes + m_numRectangleNodes + m_numTransformNodesWith3d + m_numRenderNodes);
-    m_elements = (Element *) alloca(elementCount * sizeof(Element));
-    memset(m_elements, 0, elementCount * sizeof(Element));
-    // std::cout << "render: " << m_numTextureNodes << " textures, "
-    //                    << m_numRectangleNodes << " rects, "
-    //                    << m_numTransformNodes << " xforms, "
-    //                    << m_numTransformNodesWith3d << " xforms3D, "
-    //                    << m_numLayeredNodes << " layered nodes (opacity, colorfilter, blur or shadow), "
-    //                    << vertexCount * sizeof(vec2) << " bytes (" << vertexCount << " vertices), "
-    //                    << elementCount * sizeof(Element) << " bytes (" << elementCount << " elements)"
-    //                    << std::endl;
-    build(sceneRoot());
-    assert(elementCount > 0);
-    assert(m_elementIndex == elementCount);
-    // for (unsigned i=0; i<m_elementIndex; ++i) {
+    // for (unsigned i=0; i<elementCount; ++i) {
     //     const Element &e = m_elements[i];
     //     std::cout << " " << std::setw(5) << i << ": " << "element=" << &e << " node=" << e.node << " " << e.node->type() << " "
     //          << (e.projection ? "projection " : "")
@@ -987,13 +3808,15 @@ inline bool OpenGLRenderer::render()
     //          << "groupSize=" << std::setw(3) << e.groupSize << " "
     //          << "z=" << e.z << " " << std::endl;
     // }
-    // for (unsigned i=0; i<m_vertexIndex; ++i)
+    // for (unsigned i=0; i<vertexCount; ++i)
     //     std::cout << "vertex[" << std::setw(5) << i << "]=" << m_vertices[i] << std::endl;
 
-    setDefaultOpenGLState();
+    // The per-frame rendering state of retained elements must be reset..
+    for (unsigned i=0; i<elementCount; ++i)
+        m_elements[i].completed = false;
 
-    // setDefaultOpenGLState will leave m_vertexBuffer bound, so we just upload into it..
-    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(vec2), m_vertices, GL_STATIC_DRAW);
+    uploadVertices();
+    setDefaultOpenGLState();
 
     m_surfaceSize = targetSurface()->size();
     m_proj = mat4::translate2D(-1.0, 1.0)
@@ -1001,13 +3824,41 @@ inline bool OpenGLRenderer::render()
 
     assert(!m_layered);
     assert(!m_render3d);
-    render(m_elements, m_elements + elementCount);
+    if (repaint && opaquePass) {
+        Element *first = m_elements;
+        Element *last = m_elements + elementCount;
+        renderLayers(first, last);
+
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(true);
+        setBlending(false);
+        m_depthTest = true;
+        drawOpaqueElements(first, last);
+
+        setBlending(true);
+        glDepthMask(false);
+        drawElements(first, last);
+
+        m_depthTest = false;
+        glDisable(GL_DEPTH_TEST);
+        m_proj.m[11] = 0;
+        m_matrixState = UpdateAllPrograms;
+    } else if (repaint) {
+        render(m_elements, m_elements + elementCount);
+    }
+
+    if (m_scissor) {
+        glDisable(GL_SCISSOR_TEST);
+        m_scissor = false;
+    }
 
     activateShader(0);
+    resetAttribDivisors();
+    endGpuTimer();
+    finishStats(renderStart);
 
     assert(m_fbo == 0);
-    m_vertices = 0;
-    m_elements = 0;
 
     logd << std::endl;
 
@@ -29,16 +29,49 @@
 
 inline const char *openglrenderer_vsh_solid() { return RENGINE_GLSL(
    attribute highp vec2 aV;
+   attribute lowp vec4 aC;
    uniform highp mat4 m;
+   varying lowp vec4 vC;
    void main() {
        gl_Position = m * vec4(aV, 0, 1);
+       vC = aC;
    }
 ); }
 
+// Rectangles and textures drawn as instances of the unit quad in 'aV'. The
+// other attributes are per instance, see OpenGLRenderer::RectInstance.
+inline const char *openglrenderer_vsh_solid_instanced() { return RENGINE_GLSL(
+   attribute highp vec2 aV;
+   attribute lowp vec4 aC;
+   attribute highp vec2 aO;
+   attribute highp vec2 aX;
+   attribute highp vec2 aY;
+   uniform highp mat4 m;
+   varying lowp vec4 vC;
+   void main() {
+       gl_Position = m * vec4(aO + aV.x * aX + aV.y * aY, 0, 1);
+       vC = aC;
+   }
+); }
+
+inline const char *openglrenderer_vsh_texture_instanced() { return RENGINE_GLSL(
+    attribute highp vec2 aV;
+    attribute highp vec4 aR;
+    attribute highp vec2 aO;
+    attribute highp vec2 aX;
+    attribute highp vec2 aY;
+    uniform highp mat4 m;
+    varying highp vec2 vT;
+    void main() {
+        gl_Position = m * vec4(aO + aV.x * aX + aV.y * aY, 0, 1);
+        vT = aR.xy + aV * aR.zw;
+    }
+); }
+
 inline const char *openglrenderer_fsh_solid() { return RENGINE_GLSL(
-    uniform lowp vec4 color;
+    varying lowp vec4 vC;
     void main() {
-        gl_FragColor = color;
+        gl_FragColor = vC;
     }
 ); }
 
@@ -53,6 +86,19 @@ inline const char *openglrenderer_vsh_texture() { return RENGINE_GLSL(
     }
 ); }
 
+// Used for layers, which only cover the bottom left part of their texture
+inline const char *openglrenderer_vsh_texture_scaled() { return RENGINE_GLSL(
+    attribute highp vec2 aV;
+    attribute highp vec2 aT;
+    uniform highp mat4 m;
+    uniform highp vec2 ts;
+    varying highp vec2 vT;
+    void main() {
+        gl_Position = m * vec4(aV, 0, 1);
+        vT = aT * ts;
+    }
+); }
+
 inline const char *openglrenderer_fsh_texture() { return RENGINE_GLSL(
     uniform lowp sampler2D t;
     varying highp vec2 vT;
@@ -87,77 +133,91 @@ inline const char *openglrenderer_fsh_texture_colorfilter() { return RENGINE_GLS
     }
 ); }
 
-// ### Naive implementation with a lot of room for improvement...
+// Separable gaussian, one direction per pass. The weights are computed by the
+// renderer and neighbouring taps are merged into a single linearly
+// interpolated fetch. 'k' holds the offset and weight of two such pairs per
+// vec4, which are sampled on both sides of the center. The renderer
+// downsamples the content for large radii, so the loop stays short.
 //
-// Compatibility wise, there are several older and lower-end chips that do not
-// support using a uniform in a loop condition. This is not mandated by the
-// GLSL spec, so it won't work everywhere.
+// The loop has a constant bound so that it can be unrolled on chips which
+// do not support a uniform in a loop condition.
 inline const char *openglrenderer_vsh_blur() { return RENGINE_GLSL(
     attribute highp vec2 aV;
     attribute highp vec2 aT;
     uniform highp mat4 m;
-    uniform int radius;
     uniform highp vec4 dims;
+    uniform highp vec2 ts;
     varying highp vec2 vT;
     void main() {
         gl_Position = m * vec4(aV, 0, 1);
         highp vec2 aw = dims.xy;
         highp vec2 cw = dims.zw;
         highp vec2 diff = (aw - cw) / aw;
-        vT = (aT - diff/2.0) * (aw / cw);
+        vT = (aT - diff/2.0) * (aw / cw) * ts;
     }
 ); }
 
 inline const char *openglrenderer_fsh_blur() { return RENGINE_GLSL(
     uniform lowp sampler2D t;
-    uniform highp vec4 dims;
     uniform highp vec2 step;
-    uniform highp float sigma;
-    uniform int radius;
+    uniform highp vec4 k[16];
+    uniform highp float k0;
+    uniform int pairs;
+    varying highp vec2 vT;
+    void main() {
+        highp vec4 result = k0 * texture2D(t, vT);
+        for (int i=0; i<16; ++i) {
+            if (2 * i >= pairs)
+                break;
+            highp vec4 p = k[i];
+            result += p.y * (texture2D(t, vT + p.x * step) + texture2D(t, vT - p.x * step));
+            result += p.w * (texture2D(t, vT + p.z * step) + texture2D(t, vT - p.z * step));
+        }
+        gl_FragColor = result;
+    }
+); }
+
+// The first pass of a shadow blurs the alpha of the content into the first
+// channel, so the target can be a single channel texture.
+inline const char *openglrenderer_fsh_shadow_alpha() { return RENGINE_GLSL(
+    uniform lowp sampler2D t;
+    uniform highp vec2 step;
+    uniform highp vec4 k[16];
+    uniform highp float k0;
+    uniform int pairs;
     varying highp vec2 vT;
-    highp float gauss(float x) { return exp(-(x*x)/sigma); }
     void main() {
-        highp float r = float(radius);
-        highp float weights = 0.5 * gauss(r);
-        highp vec4 result = weights * texture2D(t, vT - float(radius) * step);
-        for (int i=-radius+1; i<=radius; i+=2) {
-            highp float p1 = float(i);
-            highp float w1 = gauss(p1);
-            highp float p2 = float(i+1);
-            highp float w2 = gauss(p2);
-            highp float w = w1 + w2;
-            highp float p = (p1 * w1 + p2 * w2) / w;
-            result += w * texture2D(t, vT + p * step);
-            weights += w;
+        highp float result = k0 * texture2D(t, vT).a;
+        for (int i=0; i<16; ++i) {
+            if (2 * i >= pairs)
+                break;
+            highp vec4 p = k[i];
+            result += p.y * (texture2D(t, vT + p.x * step).a + texture2D(t, vT - p.x * step).a);
+            result += p.w * (texture2D(t, vT + p.z * step).a + texture2D(t, vT - p.z * step).a);
         }
-        gl_FragColor = result / weights;
+        gl_FragColor = vec4(result);
     }
 ); }
 
+// The second pass blurs the first channel and applies the shadow color.
 inline const char *openglrenderer_fsh_shadow() { return RENGINE_GLSL(
     uniform lowp sampler2D t;
     uniform highp vec4 color;
-    uniform highp vec4 dims;
     uniform highp vec2 step;
-    uniform highp float sigma;
-    uniform int radius;
+    uniform highp vec4 k[16];
+    uniform highp float k0;
+    uniform int pairs;
     varying highp vec2 vT;
-    highp float gauss(float x) { return exp(-(x*x)/sigma); }
     void main() {
-        highp float r = float(radius);
-        highp float weights = 0.5 * gauss(r);
-        highp float result = weights * texture2D(t, vT - float(radius) * step).a;
-        for (int i=-radius+1; i<=radius; i+=2) {
-            highp float p1 = float(i);
-            highp float w1 = gauss(p1);
-            highp float p2 = float(i+1);
-            highp float w2 = gauss(p2);
-            highp float w = w1 + w2;
-            highp float p = (p1 * w1 + p2 * w2) / w;
-            result += w * texture2D(t, vT + p * step).a;
-            weights += w;
+        highp float result = k0 * texture2D(t, vT).r;
+        for (int i=0; i<16; ++i) {
+            if (2 * i >= pairs)
+                break;
+            highp vec4 p = k[i];
+            result += p.y * (texture2D(t, vT + p.x * step).r + texture2D(t, vT - p.x * step).r);
+            result += p.w * (texture2D(t, vT + p.z * step).r + texture2D(t, vT - p.z * step).r);
         }
-        gl_FragColor = color * (result / weights);
+        gl_FragColor = color * result;
     }
 ); }
 
@@ -0,0 +1,355 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+RENGINE_BEGIN_NAMESPACE
+
+// The size of each atlas and the largest texture that will be placed in one
+#ifndef RENGINE_OPENGL_ATLAS_SIZE
+#define RENGINE_OPENGL_ATLAS_SIZE 1024
+#endif
+#ifndef RENGINE_OPENGL_ATLAS_MAX_TEXTURE_SIZE
+#define RENGINE_OPENGL_ATLAS_MAX_TEXTURE_SIZE 256
+#endif
+
+class OpenGLTextureAtlas;
+
+/*!
+    A texture which lives in a sub-region of an OpenGLTextureAtlas. The region
+    is returned to the atlas when the texture is deleted.
+ */
+class OpenGLAtlasTexture : public Texture
+{
+public:
+    ~OpenGLAtlasTexture();
+
+    vec2 size() const override { return m_size; }
+    Format format() const override;
+    GLuint textureId() const override;
+    rect2d subRect() const override;
+
+    /*!
+        The position of the padded region inside the atlas, in pixels.
+     */
+    vec2 position() const { return m_position; }
+
+private:
+    friend class OpenGLTextureAtlas;
+    OpenGLAtlasTexture(const std::shared_ptr<OpenGLTextureAtlas> &atlas, vec2 position, vec2 size)
+        : m_atlas(atlas)
+        , m_position(position)
+        , m_size(size)
+    {
+    }
+
+    std::shared_ptr<OpenGLTextureAtlas> m_atlas;
+    vec2 m_position;
+    vec2 m_size;
+};
+
+/*!
+    Packs many small textures into one large texture so that nodes using them
+    can be batched together.
+
+    Regions are allocated using a skyline packer. Each region has a one pixel
+    border holding a copy of the texture's edge pixels so that linear
+    filtering doesn't pick up the neighbours. Regions belonging to deleted
+    textures are not reused directly. Instead, the atlas is compacted when it
+    runs out of space and enough dead space has accumulated.
+ */
+class OpenGLTextureAtlas : public std::enable_shared_from_this<OpenGLTextureAtlas>
+{
+public:
+    OpenGLTextureAtlas(unsigned size, Texture::Format format)
+        : m_id(0)
+        , m_size(size)
+        , m_format(format)
+        , m_usedArea(0)
+        , m_allocatedArea(0)
+        , m_compactCount(0)
+    {
+        glGenTextures(1, &m_id);
+        createStorage(m_id);
+        m_skyline.push_back(Segment { 0, 0, size });
+    }
+
+    ~OpenGLTextureAtlas()
+    {
+        assert(m_textures.empty());
+        glDeleteTextures(1, &m_id);
+    }
+
+    /*!
+        Creates a texture of \a size from \a data inside the atlas. Returns 0
+        if there is no room for it. \a compacted is set to true if the atlas
+        had to be compacted to make room, which moves all the other textures
+        in it.
+     */
+    OpenGLAtlasTexture *create(vec2 size, const void *data, bool *compacted);
+
+    /*!
+        Repacks the live textures to reclaim the space of deleted ones. Returns
+        false if the textures could not be repacked.
+     */
+    bool compact();
+
+    GLuint textureId() const { return m_id; }
+    unsigned size() const { return m_size; }
+    Texture::Format format() const { return m_format; }
+    unsigned textureCount() const { return m_textures.size(); }
+
+    /*!
+        The area in pixels, including padding, used by live textures and the
+        area which has been handed out in total, including regions of deleted
+        textures which have not yet been reclaimed.
+     */
+    unsigned usedArea() const { return m_usedArea; }
+    unsigned allocatedArea() const { return m_allocatedArea; }
+    unsigned compactCount() const { return m_compactCount; }
+
+private:
+    friend class OpenGLAtlasTexture;
+    struct Segment {
+        unsigned x;
+        unsigned y;
+        unsigned width;
+    };
+
+    void createStorage(GLuint id);
+    void release(OpenGLAtlasTexture *texture);
+    static bool allocate(std::vector<Segment> &skyline, unsigned atlasSize, unsigned w, unsigned h, unsigned *x, unsigned *y);
+
+    GLuint m_id;
+    unsigned m_size;
+    Texture::Format m_format;
+    unsigned m_usedArea;
+    unsigned m_allocatedArea;
+    unsigned m_compactCount;
+    std::vector<Segment> m_skyline;
+    std::vector<OpenGLAtlasTexture *> m_textures;
+};
+
+inline OpenGLAtlasTexture::~OpenGLAtlasTexture()
+{
+    m_atlas->release(this);
+}
+
+inline Texture::Format OpenGLAtlasTexture::format() const
+{
+    return m_atlas->format();
+}
+
+inline GLuint OpenGLAtlasTexture::textureId() const
+{
+    return m_atlas->textureId();
+}
+
+inline rect2d OpenGLAtlasTexture::subRect() const
+{
+    float s = m_atlas->size();
+    vec2 tl = m_position + 1.0f;
+    return rect2d(tl / s, (tl + m_size) / s);
+}
+
+inline void OpenGLTextureAtlas::createStorage(GLuint id)
+{
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_size, m_size, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+}
+
+/*!
+    Finds the lowest position along the skyline where a \a w by \a h region
+    fits and raises the skyline accordingly.
+ */
+inline bool OpenGLTextureAtlas::allocate(std::vector<Segment> &skyline, unsigned atlasSize, unsigned w, unsigned h, unsigned *rx, unsigned *ry)
+{
+    unsigned best = skyline.size();
+    unsigned bestY = atlasSize;
+    unsigned bestWidth = atlasSize;
+    for (unsigned i=0; i<skyline.size(); ++i) {
+        unsigned x = skyline[i].x;
+        if (x + w > atlasSize)
+            break;
+        unsigned y = 0;
+        for (unsigned j=i; j<skyline.size() && skyline[j].x < x + w; ++j)
+            y = std::max(y, skyline[j].y);
+        if (y + h > atlasSize)
+            continue;
+        if (y < bestY || (y == bestY && skyline[i].width < bestWidth)) {
+            best = i;
+            bestY = y;
+            bestWidth = skyline[i].width;
+        }
+    }
+
+    if (best == skyline.size())
+        return false;
+
+    Segment segment = { skyline[best].x, bestY + h, w };
+    skyline.insert(skyline.begin() + best, segment);
+
+    // Trim the segments now covered by the new one
+    unsigned end = segment.x + segment.width;
+    for (unsigned i=best+1; i<skyline.size(); ) {
+        Segment &s = skyline[i];
+        if (s.x >= end)
+            break;
+        unsigned overlap = end - s.x;
+        if (overlap >= s.width) {
+            skyline.erase(skyline.begin() + i);
+        } else {
+            s.x += overlap;
+            s.width -= overlap;
+            break;
+        }
+    }
+
+    // Merge neighbours at the same height
+    for (unsigned i=1; i<skyline.size(); ) {
+        if (skyline[i-1].y == skyline[i].y) {
+            skyline[i-1].width += skyline[i].width;
+            skyline.erase(skyline.begin() + i);
+        } else {
+            ++i;
+        }
+    }
+
+    *rx = segment.x;
+    *ry = bestY;
+    return true;
+}
+
+inline OpenGLAtlasTexture *OpenGLTextureAtlas::create(vec2 size, const void *data, bool *compacted)
+{
+    unsigned sw = size.x;
+    unsigned sh = size.y;
+    unsigned w = sw + 2;
+    unsigned h = sh + 2;
+    if (w > m_size || h > m_size)
+        return 0;
+
+    unsigned x, y;
+    if (!allocate(m_skyline, m_size, w, h, &x, &y)) {
+        // Only worth compacting if the dead space could hold the region.
+        if (m_allocatedArea - m_usedArea < w * h || !compact())
+            return 0;
+        *compacted = true;
+        if (!allocate(m_skyline, m_size, w, h, &x, &y))
+            return 0;
+    }
+
+    // Copy the pixels into the middle of the region and repeat the edge
+    // pixels into the border.
+    const unsigned *src = (const unsigned *) data;
+    std::vector<unsigned> padded(w * h);
+    for (unsigned py=0; py<h; ++py) {
+        unsigned sy = std::min(std::max(int(py) - 1, 0), int(sh) - 1);
+        for (unsigned px=0; px<w; ++px) {
+            unsigned sx = std::min(std::max(int(px) - 1, 0), int(sw) - 1);
+            padded[py * w + px] = src[sy * sw + sx];
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, m_id);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, padded.data());
+
+    OpenGLAtlasTexture *texture = new OpenGLAtlasTexture(shared_from_this(), vec2(x, y), size);
+    m_textures.push_back(texture);
+    m_usedArea += w * h;
+    m_allocatedArea += w * h;
+    return texture;
+}
+
+inline void OpenGLTextureAtlas::release(OpenGLAtlasTexture *texture)
+{
+    auto it = std::find(m_textures.begin(), m_textures.end(), texture);
+    assert(it != m_textures.end());
+    m_textures.erase(it);
+    m_usedArea -= (texture->m_size.x + 2) * (texture->m_size.y + 2);
+
+    // Nothing left, so we can start from scratch without copying anything
+    if (m_textures.empty()) {
+        m_skyline.clear();
+        m_skyline.push_back(Segment { 0, 0, m_size });
+        m_allocatedArea = 0;
+    }
+}
+
+inline bool OpenGLTextureAtlas::compact()
+{
+    // Pack the tallest textures first as this packs better.
+    std::vector<OpenGLAtlasTexture *> textures(m_textures);
+    std::sort(textures.begin(), textures.end(), [](OpenGLAtlasTexture *a, OpenGLAtlasTexture *b) {
+        return a->m_size.y > b->m_size.y;
+    });
+
+    std::vector<Segment> skyline;
+    skyline.push_back(Segment { 0, 0, m_size });
+    std::vector<vec2> positions(textures.size());
+    for (unsigned i=0; i<textures.size(); ++i) {
+        unsigned x, y;
+        if (!allocate(skyline, m_size, textures[i]->m_size.x + 2, textures[i]->m_size.y + 2, &x, &y))
+            return false;
+        positions[i] = vec2(x, y);
+    }
+
+    // Copy the regions over into a new texture on the GPU.
+    GLint storedFbo;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &storedFbo);
+
+    GLuint id;
+    glGenTextures(1, &id);
+    createStorage(id);
+
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_id, 0);
+    for (unsigned i=0; i<textures.size(); ++i) {
+        OpenGLAtlasTexture *t = textures[i];
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, positions[i].x, positions[i].y,
+                            t->m_position.x, t->m_position.y, t->m_size.x + 2, t->m_size.y + 2);
+        t->m_position = positions[i];
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, storedFbo);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &m_id);
+
+    m_id = id;
+    m_skyline = skyline;
+    m_allocatedArea = m_usedArea;
+    ++m_compactCount;
+    return true;
+}
+
+RENGINE_END_NAMESPACE
@@ -36,6 +36,9 @@ public:
         : m_sceneRoot(0)
         , m_surface(0)
         , m_fillColor(0, 0, 0, 1)
+        , m_bufferAge(0)
+        , m_damageTracking(false)
+        , m_gpuTiming(false)
     {
     }
 
@@ -76,6 +79,27 @@ public:
      */
     virtual bool readPixels(int x, int y, int width, int height, unsigned *bytes) = 0;
 
+    /*!
+        Starts reading back pixels like readPixels() and returns a future
+        which holds them once they are available, or an empty vector if
+        they could not be read.
+
+        Renderers which can read back without waiting for the GPU make the
+        pixels available once the next frame has been rendered and swapped,
+        so reading back one frame overlaps rendering the next. Don't wait
+        for the future on the rendering thread before then. The default
+        implementation reads the pixels right away.
+     */
+    virtual std::future<std::vector<unsigned>> readPixelsAsync(int x, int y, int width, int height)
+    {
+        std::promise<std::vector<unsigned>> promise;
+        std::vector<unsigned> pixels(width * height);
+        if (!readPixels(x, y, width, height, pixels.data()))
+            pixels.clear();
+        promise.set_value(std::move(pixels));
+        return promise.get_future();
+    }
+
     /*!
         Called after the frame has been swapped. The renderer can use this
         to perform post-frame cleanup, for instance...
@@ -85,6 +109,109 @@ public:
     void setFillColor(vec4 c) { m_fillColor = c; }
     vec4 fillColor() const { return m_fillColor; }
 
+    /*!
+        Enables damage tracking. The renderer will then only repaint the parts
+        of the surface which have changed since the frame held by the back
+        buffer was rendered, see setBufferAge(). The repainted area is
+        available from damageRect() after render() so the backend can present
+        only that part of the surface.
+     */
+    void setDamageTrackingEnabled(bool enabled) { m_damageTracking = enabled; }
+    bool damageTrackingEnabled() const { return m_damageTracking; }
+
+    /*!
+        Sets the age of the back buffer's content in frames, as in
+        EGL_EXT_buffer_age. 1 means it holds the previous frame, 2 the one
+        before that and 0 means the content is undefined, in which case the
+        whole surface is repainted.
+     */
+    void setBufferAge(unsigned age) { m_bufferAge = age; }
+    unsigned bufferAge() const { return m_bufferAge; }
+
+    /*!
+        Returns the area of the surface, in device pixels, which was repainted
+        by the last call to render(). The rect is empty when nothing was
+        repainted.
+     */
+    rect2d damageRect() const { return m_damageRect; }
+
+    /*!
+        Counters for the last frame, for monitoring the cost of a scene.
+        Node counts describe the render list, which is kept across frames
+        when the tree has not changed. The rest is for the last call to
+        render() only. CPU times are in milliseconds.
+     */
+    struct RenderStats {
+        unsigned frame = 0;                 // counts the calls to render(), from 1
+        bool fullRebuild = false;           // the render list was rebuilt from scratch
+
+        unsigned rectangleNodes = 0;
+        unsigned textureNodes = 0;
+        unsigned transformNodes = 0;
+        unsigned transformNodes3D = 0;      // with a 3D projection
+        unsigned layeredNodes = 0;          // opacity, color filter, blur or shadow rendered through a layer
+        unsigned clipNodes = 0;
+        unsigned renderNodes = 0;
+        unsigned occludedNodes = 0;         // skipped because opaque nodes cover them
+
+        unsigned drawCalls = 0;
+        unsigned shaderSwitches = 0;
+        unsigned textureBinds = 0;
+        unsigned framebufferSwitches = 0;
+        unsigned redundantStateChanges = 0; // state changes skipped because nothing changed
+        unsigned vertexBytesUploaded = 0;
+        unsigned layerTextures = 0;         // held by the renderer, in use or kept for reuse
+        unsigned layerTextureBytes = 0;
+
+        double prepassTime = 0;             // counting the nodes and finding occluders
+        double buildTime = 0;               // building or updating the render list
+        double renderTime = 0;              // issuing the draw calls
+    };
+
+    /*!
+        Returns the counters for the last frame. Renderers fill in the ones
+        which apply to them and leave the rest at 0.
+     */
+    const RenderStats &stats() const { return m_stats; }
+
+    /*!
+        The GPU time, in milliseconds, spent on the phases of a frame.
+        mainPass, layers and blur add up to total.
+     */
+    struct GpuTimes {
+        struct Layer {
+            const Node *node;       // for identification only, it may have been destroyed since
+            double content;         // rendering its children, including nested layers
+            double blur;            // its blur or shadow passes
+        };
+        unsigned frame = 0;         // counts the frames rendered with GPU timing, from 1
+        double total = 0;
+        double mainPass = 0;        // drawing to the surface
+        double layers = 0;          // rendering the children of layers
+        double blur = 0;            // blur and shadow passes
+        std::vector<Layer> layerTimes;  // the layers rendered in the frame, in the order they were started
+    };
+
+    /*!
+        Enables measuring the GPU time of each frame with timer queries, when
+        the renderer supports it. The results are collected a few frames
+        later, so that the renderer does not have to wait for the GPU, and
+        are then available from gpuTimes() and logged.
+     */
+    void setGpuTimingEnabled(bool enabled) { m_gpuTiming = enabled; }
+    bool gpuTimingEnabled() const { return m_gpuTiming; }
+
+    /*!
+        The GPU times of the last frame whose timer queries have completed.
+        Its frame is 0 until then.
+     */
+    const GpuTimes &gpuTimes() const { return m_gpuTimes; }
+
+protected:
+    void setDamageRect(rect2d rect) { m_damageRect = rect; }
+    void setGpuTimes(GpuTimes &&times) { m_gpuTimes = std::move(times); }
+    void setStats(const RenderStats &stats) { m_stats = stats; }
+
 #if 0
     Texture *createTextureFromSubtree(Node *node, rect2d sourceRect);
     Texture *createTextureWithBlurFromTexture(Texture *texture, int kernelRadius);
@@ -117,6 +244,12 @@ private:
     Node *m_sceneRoot;
     Surface *m_surface;
     vec4 m_fillColor;
+    rect2d m_damageRect;
+    RenderStats m_stats;
+    GpuTimes m_gpuTimes;
+    unsigned m_bufferAge;
+    bool m_damageTracking;
+    bool m_gpuTiming;
 };
 
 #if 0
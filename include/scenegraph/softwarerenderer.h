@@ -0,0 +1,1039 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// Define RENGINE_SOFTWARE_NO_SIMD to always use the scalar fill loops
+#if !defined(RENGINE_SOFTWARE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define RENGINE_SOFTWARE_SSE2
+#include <emmintrin.h>
+#endif
+
+// The number of rows in each of the bands a frame is split into, which are
+// rasterized in parallel
+#ifndef RENGINE_SOFTWARE_BAND_ROWS
+#define RENGINE_SOFTWARE_BAND_ROWS 32
+#endif
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    A texture held in memory, as premultiplied RGBA8.
+ */
+class SoftwareTexture : public Texture
+{
+public:
+    SoftwareTexture(vec2 size, Format format, const void *data);
+
+    vec2 size() const override { return vec2(m_width, m_height); }
+    Format format() const override { return m_format; }
+    GLuint textureId() const override { return 0; }
+
+    int pixelWidth() const { return m_width; }
+    int pixelHeight() const { return m_height; }
+    const unsigned *pixels() const { return m_pixels.data(); }
+
+private:
+    int m_width;
+    int m_height;
+    Format m_format;
+    std::vector<unsigned> m_pixels;
+};
+
+/*!
+    Renders the scene graph on the CPU, into a buffer in memory. It needs no
+    OpenGL context, so it can render on machines without a GPU and run pixel
+    tests anywhere.
+
+    The tree is first turned into a list of quads per layer, in device
+    pixels, with the same projection, 3D ordering and clipping as
+    OpenGLRenderer. The layers are then rasterized from the innermost out.
+    Each is split into bands of RENGINE_SOFTWARE_BAND_ROWS rows, which are
+    rasterized on a thread pool. Blending is done on premultiplied RGBA8
+    like OpenGLRenderer does, using SSE2 for the span fills when available.
+
+    Render nodes draw with OpenGL, so they are skipped. Textures must come
+    from createTextureFromImageData().
+ */
+class SoftwareRenderer : public Renderer
+{
+public:
+    SoftwareRenderer();
+
+    Texture *createTextureFromImageData(vec2 size, Texture::Format format, void *data) override;
+    void initialize() override { }
+    bool render() override;
+    bool readPixels(int x, int y, int w, int h, unsigned *pixels) override;
+
+    /*!
+        The size of the frame, in pixels, when there is no target surface.
+     */
+    void setSize(vec2 size) { m_size = size; }
+    vec2 size() const { return targetSurface() ? targetSurface()->size() : m_size; }
+
+    /*!
+        Sets the number of threads the frames are rasterized on, including
+        the one calling render(). The default is the number of cores.
+     */
+    void setThreadCount(unsigned count) { m_pool.reset(new ThreadPool(count)); }
+    unsigned threadCount() const { return m_pool->threadCount(); }
+
+    /*!
+        The last frame, as premultiplied RGBA8 with the top row first.
+     */
+    const unsigned *pixels() const { return m_pixels.data(); }
+
+    static void blendSolidSpan(unsigned *dst, int count, unsigned color);
+    static void blendSpan(unsigned *dst, const unsigned *src, int count, unsigned opacity = 255);
+
+    struct Bounds {
+        Bounds() : x0(INT_MAX), y0(INT_MAX), x1(INT_MIN), y1(INT_MIN) { }
+        Bounds(int x0, int y0, int x1, int y1) : x0(x0), y0(y0), x1(x1), y1(y1) { }
+        bool isEmpty() const { return x1 <= x0 || y1 <= y0; }
+        Bounds operator&(const Bounds &o) const { return Bounds(std::max(x0, o.x0), std::max(y0, o.y0), std::min(x1, o.x1), std::min(y1, o.y1)); }
+        Bounds operator|(const Bounds &o) const { return Bounds(std::min(x0, o.x0), std::min(y0, o.y0), std::max(x1, o.x1), std::max(y1, o.y1)); }
+        Bounds adjusted(int dx0, int dy0, int dx1, int dy1) const { return Bounds(x0 + dx0, y0 + dy0, x1 + dx1, y1 + dy1); }
+        int x0, y0, x1, y1;         // half open, in device pixels
+    };
+    struct Clip {
+        Bounds bounds;
+        int mask;                   // index into m_masks for clips which aren't axis aligned, otherwise -1
+    };
+    struct Command {
+        enum Type {
+            DrawSolid,
+            DrawTexture,
+            DrawLayer
+        };
+        Type type;
+        vec2 v[4];                  // top left, bottom left, top right and bottom right, in device pixels
+        Bounds bounds;              // the pixels it covers, including the clip
+        unsigned color;             // premultiplied RGBA8, for DrawSolid
+        const SoftwareTexture *texture;
+        rect2d texRect;             // the texture's subRect()
+        unsigned layer;             // index into m_layers, for DrawLayer
+        unsigned clip;              // index into m_clips
+        float z;                    // only valid inside 3D subtrees
+    };
+    struct Layer {
+        Node *node;                 // 0 for the frame itself
+        std::vector<Command> commands;
+        Bounds content;             // the pixels the commands cover
+        Bounds bounds;              // the pixels of 'pixels', content plus room for blur
+        std::vector<unsigned> pixels;
+        std::vector<unsigned char> alpha;   // the shadow, a blurred copy of the alpha in 'pixels'
+    };
+    struct Target {
+        unsigned *pixels;
+        Bounds bounds;
+        int stride;
+        unsigned *row(int y) const { return pixels + (y - bounds.y0) * stride - bounds.x0; }
+    };
+    struct BuildState {
+        BuildState() : farPlane(0), layer(0), clip(0), zSum(0), zCount(0), render3d(false) { }
+        mat4 m2d;
+        mat4 m3d;
+        float farPlane;
+        unsigned layer;             // the layer the commands are added to
+        unsigned clip;
+        float zSum;                 // sum and count of the z of the quads in 3D, for layers
+        unsigned zCount;
+        bool render3d;
+    };
+
+    void build(BuildState &s, Node *n);
+    void buildLayer(BuildState &s, Node *n);
+    bool isLayered(Node *n) const;
+    void mapQuad(const BuildState &s, vec2 a, vec2 b, vec2 *v) const;
+    bool addCommand(BuildState &s, Command &c);
+    Bounds boundsOf(const vec2 *v) const;
+    unsigned addClip(const BuildState &s, ClipNode *node);
+    void renderLayer(Layer *layer);
+    void rasterize(Layer *layer, const Target &t);
+    void draw(const Command &c, const Target &t, int y0, int y1, unsigned *scratch);
+    void drawLayer(const Command &c, const Target &t, int y0, int y1, unsigned *scratch);
+    void blendRow(unsigned *dst, const unsigned *src, int x0, int x1, int y, const Clip &clip, unsigned opacity);
+    bool spanOf(const vec2 *polygon, float y, int *x0, int *x1) const;
+    static void polygonOf(const vec2 *v, vec2 *polygon);
+    static unsigned sample(const SoftwareTexture *texture, vec2 t);
+    std::vector<unsigned> blurKernel(unsigned radius) const;
+    void blur(Layer *layer, unsigned radius);
+    void blurAlpha(Layer *layer, unsigned radius);
+    void applyColorMatrix(Layer *layer, const mat4 &matrix);
+
+    std::unique_ptr<ThreadPool> m_pool;
+    std::vector<std::unique_ptr<Layer>> m_layers;
+    unsigned m_layerCount;
+    std::vector<Clip> m_clips;
+    std::vector<std::vector<unsigned char>> m_masks;
+    unsigned m_maskCount;
+    std::vector<unsigned> m_pixels;
+    vec2 m_size;
+    int m_width;
+    int m_height;
+};
+
+inline SoftwareTexture::SoftwareTexture(vec2 size, Format format, const void *data)
+    : m_width(size.x)
+    , m_height(size.y)
+    , m_format(format)
+{
+    const unsigned *src = (const unsigned *) data;
+    m_pixels.assign(src, src + m_width * m_height);
+    bool bgr = format == BGRA_32 || format == BGRx_32;
+    bool opaque = (format & AlphaFormatMask) == 0;
+    for (unsigned &p : m_pixels) {
+        if (bgr)
+            p = (p & 0xff00ff00) | ((p & 0xff) << 16) | ((p >> 16) & 0xff);
+        if (opaque)
+            p |= 0xff000000;
+    }
+}
+
+inline SoftwareRenderer::SoftwareRenderer()
+    : m_pool(new ThreadPool())
+    , m_layerCount(0)
+    , m_maskCount(0)
+    , m_width(0)
+    , m_height(0)
+{
+}
+
+inline Texture *SoftwareRenderer::createTextureFromImageData(vec2 size, Texture::Format format, void *data)
+{
+    return new SoftwareTexture(size, format, data);
+}
+
+/*!
+    Multiplies the channels of \a p by \a s / 255.
+ */
+inline unsigned rengine_scalePixel(unsigned p, unsigned s)
+{
+    unsigned rb = (p & 0x00ff00ff) * s + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+    unsigned ag = ((p >> 8) & 0x00ff00ff) * s + 0x00800080;
+    ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+    return rb | ag;
+}
+
+#ifdef RENGINE_SOFTWARE_SSE2
+// x / 255 for 16-bit lanes holding products of two bytes
+inline __m128i rengine_div255_epi16(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// The alpha of each of the two pixels in \a x, unpacked to 16-bit lanes
+inline __m128i rengine_alpha_epi16(__m128i x)
+{
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+}
+#endif
+
+/*!
+    Blends the premultiplied \a color over \a count pixels at \a dst.
+ */
+inline void SoftwareRenderer::blendSolidSpan(unsigned *dst, int count, unsigned color)
+{
+    unsigned alpha = color >> 24;
+    if (alpha == 255) {
+        std::fill(dst, dst + count, color);
+        return;
+    } else if (color == 0) {
+        return;
+    }
+
+    int i = 0;
+#ifdef RENGINE_SOFTWARE_SSE2
+    __m128i c = _mm_set1_epi32(color);
+    __m128i ia = _mm_set1_epi16(255 - alpha);
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i lo = rengine_div255_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia));
+        __m128i hi = rengine_div255_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_adds_epu8(_mm_packus_epi16(lo, hi), c));
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = color + rengine_scalePixel(dst[i], 255 - alpha);
+}
+
+/*!
+    Blends \a count premultiplied pixels from \a src over the ones at \a dst,
+    with \a opacity from 0 to 255.
+ */
+inline void SoftwareRenderer::blendSpan(unsigned *dst, const unsigned *src, int count, unsigned opacity)
+{
+    int i = 0;
+#ifdef RENGINE_SOFTWARE_SSE2
+    __m128i zero = _mm_setzero_si128();
+    __m128i full = _mm_set1_epi16(255);
+    __m128i o = _mm_set1_epi16(opacity);
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i slo = _mm_unpacklo_epi8(s, zero);
+        __m128i shi = _mm_unpackhi_epi8(s, zero);
+        if (opacity < 255) {
+            slo = rengine_div255_epi16(_mm_mullo_epi16(slo, o));
+            shi = rengine_div255_epi16(_mm_mullo_epi16(shi, o));
+        }
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i dlo = rengine_div255_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, rengine_alpha_epi16(slo))));
+        __m128i dhi = rengine_div255_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, rengine_alpha_epi16(shi))));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_adds_epu8(_mm_packus_epi16(slo, shi), _mm_packus_epi16(dlo, dhi)));
+    }
+#endif
+    for (; i < count; ++i) {
+        unsigned s = opacity < 255 ? rengine_scalePixel(src[i], opacity) : src[i];
+        unsigned alpha = s >> 24;
+        if (alpha == 255)
+            dst[i] = s;
+        else if (s != 0)
+            dst[i] = s + rengine_scalePixel(dst[i], 255 - alpha);
+    }
+}
+
+inline bool SoftwareRenderer::isLayered(Node *n) const
+{
+    switch (n->type()) {
+    case Node::OpacityNodeType: return static_cast<OpacityNode *>(n)->opacity() < 1.0f;
+    case Node::ColorFilterNodeType: return !static_cast<ColorFilterNode *>(n)->colorMatrix().isIdentity();
+    case Node::BlurNodeType: return static_cast<BlurNode *>(n)->radius() > 0;
+    case Node::ShadowNodeType: return static_cast<ShadowNode *>(n)->color().w > 0;
+    default: return false;
+    }
+}
+
+/*!
+    Maps the corners of the rectangle from \a a to \a b into device pixels,
+    the same way OpenGLRenderer does.
+ */
+inline void SoftwareRenderer::mapQuad(const BuildState &s, vec2 a, vec2 b, vec2 *v) const
+{
+    if (s.render3d) {
+        v[0] = s.m2d * ((s.m3d * vec3(a))       .project2D(s.farPlane));
+        v[1] = s.m2d * ((s.m3d * vec3(a.x, b.y)).project2D(s.farPlane));
+        v[2] = s.m2d * ((s.m3d * vec3(b.x, a.y)).project2D(s.farPlane));
+        v[3] = s.m2d * ((s.m3d * vec3(b))       .project2D(s.farPlane));
+    } else {
+        s.m2d.mapQuad2D(a, b, v);
+    }
+}
+
+/*!
+    Returns the pixels whose centers are inside the bounding box of the quad
+    at \a v.
+ */
+inline SoftwareRenderer::Bounds SoftwareRenderer::boundsOf(const vec2 *v) const
+{
+    vec2 tl = min(min(v[0], v[1]), min(v[2], v[3]));
+    vec2 br = max(max(v[0], v[1]), max(v[2], v[3]));
+    return Bounds(std::ceil(tl.x - 0.5f), std::ceil(tl.y - 0.5f), std::ceil(br.x - 0.5f), std::ceil(br.y - 0.5f));
+}
+
+/*!
+    Adds \a c to the current layer, unless it is clipped away. Returns false
+    if it was.
+ */
+inline bool SoftwareRenderer::addCommand(BuildState &s, Command &c)
+{
+    c.clip = s.clip;
+    c.bounds = c.bounds & m_clips[s.clip].bounds;
+    if (c.bounds.isEmpty())
+        return false;
+    Layer *layer = m_layers[s.layer].get();
+    layer->commands.push_back(c);
+    layer->content = layer->content | c.bounds;
+    if (s.render3d) {
+        s.zSum += c.z;
+        ++s.zCount;
+    }
+    return true;
+}
+
+/*!
+    Adds the clip for \a node inside the current one and returns its index.
+    Clips which are not axis aligned, or are projected, get a mask of the
+    pixels inside them.
+ */
+inline unsigned SoftwareRenderer::addClip(const BuildState &s, ClipNode *node)
+{
+    const Clip &parent = m_clips[s.clip];
+    rect2d g = node->geometry();
+    vec2 v[4];
+    mapQuad(s, g.tl, g.br, v);
+
+    Clip clip;
+    clip.bounds = boundsOf(v) & parent.bounds;
+    clip.mask = -1;
+    if ((s.render3d || (s.m2d.type & ~(mat4::Translation2D | mat4::Scale2D)) != 0) && !clip.bounds.isEmpty()) {
+        if (m_masks.size() <= m_maskCount)
+            m_masks.resize(m_maskCount + 1);
+        clip.mask = m_maskCount++;
+        std::vector<unsigned char> &mask = m_masks[clip.mask];
+        mask.assign(m_width * m_height, 0);
+        vec2 polygon[4];
+        polygonOf(v, polygon);
+        for (int y=clip.bounds.y0; y<clip.bounds.y1; ++y) {
+            int x0, x1;
+            if (!spanOf(polygon, y + 0.5f, &x0, &x1))
+                continue;
+            x0 = std::max(x0, clip.bounds.x0);
+            x1 = std::min(x1, clip.bounds.x1);
+            unsigned char *row = mask.data() + y * m_width;
+            const unsigned char *parentRow = parent.mask >= 0 ? m_masks[parent.mask].data() + y * m_width : 0;
+            for (int x=x0; x<x1; ++x)
+                row[x] = parentRow ? parentRow[x] : 1;
+        }
+    } else if (parent.mask >= 0) {
+        clip.mask = parent.mask;
+    }
+    m_clips.push_back(clip);
+    return m_clips.size() - 1;
+}
+
+inline void SoftwareRenderer::build(BuildState &s, Node *n)
+{
+    n->preprocess();
+
+    switch (n->type()) {
+    case Node::TextureNodeType:
+    case Node::RectangleNodeType: {
+        rect2d geometry = static_cast<RectangleNodeBase *>(n)->geometry();
+        if (geometry.width() == 0 || geometry.height() == 0)
+            break;
+
+        Command c;
+        if (n->type() == Node::TextureNodeType) {
+            const Texture *texture = static_cast<TextureNode *>(n)->texture();
+            c.type = Command::DrawTexture;
+            c.texture = dynamic_cast<const SoftwareTexture *>(texture);
+            if (!c.texture)
+                break;
+            c.texRect = texture->subRect();
+        } else {
+            vec4 color = static_cast<RectangleNode *>(n)->color();
+            if (color.w < RENGINE_RENDERER_ALPHA_THRESHOLD)
+                break;
+            unsigned char *bytes = (unsigned char *) &c.color;
+            bytes[0] = color.x * color.w * 255.0f + 0.5f;
+            bytes[1] = color.y * color.w * 255.0f + 0.5f;
+            bytes[2] = color.z * color.w * 255.0f + 0.5f;
+            bytes[3] = color.w * 255.0f + 0.5f;
+            c.type = Command::DrawSolid;
+        }
+        mapQuad(s, geometry.tl, geometry.br, c.v);
+        c.bounds = boundsOf(c.v);
+        c.z = s.render3d ? (s.m3d * vec3((geometry.tl + geometry.br) / 2.0f)).z : 0;
+        addCommand(s, c);
+    } break;
+
+    case Node::TransformNodeType: {
+        TransformNode *tn = static_cast<TransformNode *>(n);
+        bool projection = tn->projectionDepth() && !s.render3d;
+        std::vector<Command> &commands = m_layers[s.layer]->commands;
+        unsigned first = commands.size();
+        if (projection) {
+            s.render3d = true;
+            s.farPlane = tn->projectionDepth();
+        }
+
+        mat4 *m = s.render3d ? &s.m3d : &s.m2d;
+        mat4 old = *m;
+        *m = *m * tn->matrix();
+        for (Node *c = n->child(); c; c = c->sibling())
+            build(s, c);
+        *m = old;
+
+        if (projection) {
+            s.render3d = false;
+            s.farPlane = 0;
+            std::stable_sort(commands.begin() + first, commands.end(), [](const Command &a, const Command &b) { return a.z < b.z; });
+        }
+    } return;
+
+    case Node::ClipNodeType: {
+        ClipNode *cn = static_cast<ClipNode *>(n);
+        std::vector<Command> &commands = m_layers[s.layer]->commands;
+        unsigned first = commands.size();
+        unsigned storedClip = s.clip;
+        s.clip = addClip(s, cn);
+        if (!m_clips[s.clip].bounds.isEmpty()) {
+            for (Node *c = n->child(); c; c = c->sibling())
+                build(s, c);
+        }
+        s.clip = storedClip;
+
+        // Like OpenGLRenderer, order a projected clip's commands among
+        // themselves and then as one, at the depth of the clip's center
+        if (s.render3d) {
+            rect2d g = cn->geometry();
+            float z = (s.m3d * vec3((g.tl + g.br) / 2.0f)).z;
+            std::stable_sort(commands.begin() + first, commands.end(), [](const Command &a, const Command &b) { return a.z < b.z; });
+            for (auto it = commands.begin() + first; it != commands.end(); ++it)
+                it->z = z;
+        }
+    } return;
+
+    case Node::ShadowNodeType:
+    case Node::BlurNodeType:
+    case Node::ColorFilterNodeType:
+    case Node::OpacityNodeType:
+        if (isLayered(n)) {
+            buildLayer(s, n);
+            return;
+        }
+        break;
+
+    case Node::RenderNodeType: {
+        static bool warned = false;
+        if (!warned) {
+            warned = true;
+            logw << "render nodes draw with OpenGL and are skipped by the software renderer" << std::endl;
+        }
+    } break;
+
+    default:
+        break;
+    }
+
+    for (Node *c = n->child(); c; c = c->sibling())
+        build(s, c);
+}
+
+/*!
+    Builds the children of the layered node \a n into a layer of their own
+    and adds the command which draws it with the effect.
+ */
+inline void SoftwareRenderer::buildLayer(BuildState &s, Node *n)
+{
+    unsigned index = m_layerCount++;
+    if (m_layers.size() < m_layerCount)
+        m_layers.push_back(std::unique_ptr<Layer>(new Layer()));
+    Layer *layer = m_layers[index].get();
+    layer->node = n;
+    layer->commands.clear();
+    layer->content = Bounds();
+
+    unsigned storedLayer = s.layer;
+    float zSum = s.zSum;
+    unsigned zCount = s.zCount;
+    s.layer = index;
+    for (Node *c = n->child(); c; c = c->sibling())
+        build(s, c);
+    s.layer = storedLayer;
+
+    Bounds frame(0, 0, m_width, m_height);
+    Bounds content = layer->content & frame;
+    if (content.isEmpty()) {
+        layer->bounds = Bounds();
+        return;
+    }
+
+    Command c;
+    c.type = Command::DrawLayer;
+    c.layer = index;
+    c.z = s.zCount > zCount ? (s.zSum - zSum) / (s.zCount - zCount) : 0;
+    if (n->type() == Node::BlurNodeType) {
+        int r = static_cast<BlurNode *>(n)->radius();
+        layer->bounds = content.adjusted(-r, -r, r, r) & frame;
+        c.bounds = layer->bounds;
+    } else if (n->type() == Node::ShadowNodeType) {
+        ShadowNode *shadow = static_cast<ShadowNode *>(n);
+        int r = shadow->radius();
+        int dx = std::round(shadow->offset().x);
+        int dy = std::round(shadow->offset().y);
+        layer->bounds = content.adjusted(-r, -r, r, r) & frame;
+        c.bounds = (content | layer->bounds.adjusted(dx, dy, dx, dy)) & frame;
+    } else {
+        layer->bounds = content;
+        c.bounds = content;
+    }
+    c.v[0] = vec2(c.bounds.x0, c.bounds.y0);
+    c.v[1] = vec2(c.bounds.x0, c.bounds.y1);
+    c.v[2] = vec2(c.bounds.x1, c.bounds.y0);
+    c.v[3] = vec2(c.bounds.x1, c.bounds.y1);
+    addCommand(s, c);
+}
+
+/*!
+    Puts the corners of the quad at \a v into \a polygon in clockwise order
+    on screen, which is top left, top right, bottom right and bottom left
+    unless the quad is mirrored.
+ */
+inline void SoftwareRenderer::polygonOf(const vec2 *v, vec2 *polygon)
+{
+    polygon[0] = v[0];
+    polygon[1] = v[2];
+    polygon[2] = v[3];
+    polygon[3] = v[1];
+    float area = 0;
+    for (int i=0; i<4; ++i) {
+        vec2 p = polygon[i];
+        vec2 q = polygon[(i + 1) % 4];
+        area += p.x * q.y - q.x * p.y;
+    }
+    if (area < 0)
+        std::swap(polygon[1], polygon[3]);
+}
+
+/*!
+    Finds the pixels on the row with its centers at \a y which have their
+    centers inside \a polygon. Left and top edges are inside, right and
+    bottom edges are not, so quads which share an edge don't overlap.
+ */
+inline bool SoftwareRenderer::spanOf(const vec2 *polygon, float y, int *x0, int *x1) const
+{
+    int lo = INT_MIN;
+    int hi = INT_MAX;
+    for (int i=0; i<4; ++i) {
+        vec2 p = polygon[i];
+        vec2 q = polygon[(i + 1) % 4];
+        float dx = q.x - p.x;
+        float dy = q.y - p.y;
+        // Inside where dx * (y - p.y) - dy * (x - p.x) >= 0
+        float a = dx * (y - p.y);
+        if (dy == 0) {
+            if (a < 0 || (a == 0 && dx <= 0))
+                return false;
+        } else {
+            float x = p.x + a / dy;
+            if (dy < 0)
+                lo = std::max(lo, int(std::ceil(x - 0.5f)));
+            else
+                hi = std::min(hi, int(std::ceil(x - 0.5f)));
+        }
+    }
+    *x0 = lo;
+    *x1 = hi;
+    return lo < hi;
+}
+
+/*!
+    Samples \a texture at \a t with bilinear filtering, clamped to the edges.
+ */
+inline unsigned SoftwareRenderer::sample(const SoftwareTexture *texture, vec2 t)
+{
+    int w = texture->pixelWidth();
+    int h = texture->pixelHeight();
+    float x = t.x * w - 0.5f;
+    float y = t.y * h - 0.5f;
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    unsigned wx = (x - fx) * 256.0f + 0.5f;
+    unsigned wy = (y - fy) * 256.0f + 0.5f;
+    int x0 = std::min(std::max(int(fx), 0), w - 1);
+    int y0 = std::min(std::max(int(fy), 0), h - 1);
+    int x1 = std::min(std::max(int(fx) + 1, 0), w - 1);
+    int y1 = std::min(std::max(int(fy) + 1, 0), h - 1);
+    const unsigned *pixels = texture->pixels();
+    unsigned p00 = pixels[y0 * w + x0];
+    if (wx == 0 && wy == 0)
+        return p00;
+    unsigned p10 = pixels[y0 * w + x1];
+    unsigned p01 = pixels[y1 * w + x0];
+    unsigned p11 = pixels[y1 * w + x1];
+    unsigned result = 0;
+    for (int shift=0; shift<32; shift += 8) {
+        unsigned top = ((p00 >> shift) & 0xff) * (256 - wx) + ((p10 >> shift) & 0xff) * wx;
+        unsigned bottom = ((p01 >> shift) & 0xff) * (256 - wx) + ((p11 >> shift) & 0xff) * wx;
+        result |= (((top * (256 - wy) + bottom * wy) + 32768) >> 16) << shift;
+    }
+    return result;
+}
+
+/*!
+    Draws the rows from \a y0 up to \a y1 of \a c into \a t. \a scratch
+    holds a row of the frame.
+ */
+inline void SoftwareRenderer::draw(const Command &c, const Target &t, int y0, int y1, unsigned *scratch)
+{
+    if (c.type == Command::DrawLayer) {
+        drawLayer(c, t, y0, y1, scratch);
+        return;
+    }
+
+    const Clip &clip = m_clips[c.clip];
+    Bounds area = c.bounds & t.bounds;
+    y0 = std::max(y0, area.y0);
+    y1 = std::min(y1, area.y1);
+    if (y0 >= y1 || area.isEmpty())
+        return;
+
+    vec2 polygon[4];
+    polygonOf(c.v, polygon);
+
+    // The texture coordinates are interpolated across the two triangles
+    // OpenGLRenderer draws the quad as, 0-1-2 and 2-1-3, which differ
+    // when the quad is projected.
+    vec2 origin[2];
+    vec2 dx[2];
+    vec2 dy[2];
+    vec2 diagonal = c.v[2] - c.v[1];
+    float side0 = 0;
+    bool parallelogram = true;
+    if (c.type == Command::DrawTexture) {
+        const rect2d &r = c.texRect;
+        vec2 tc[4] = { r.tl, vec2(r.left(), r.bottom()), vec2(r.right(), r.top()), r.br };
+        const int triangles[2][3] = { { 0, 1, 2 }, { 3, 2, 1 } };
+        for (int i=0; i<2; ++i) {
+            vec2 a = c.v[triangles[i][0]];
+            vec2 b = c.v[triangles[i][1]] - a;
+            vec2 e = c.v[triangles[i][2]] - a;
+            vec2 ta = tc[triangles[i][0]];
+            vec2 tb = tc[triangles[i][1]] - ta;
+            vec2 te = tc[triangles[i][2]] - ta;
+            float det = b.x * e.y - e.x * b.y;
+            if (det == 0)
+                return;
+            dx[i] = (tb * e.y - te * b.y) * (1.0f / det);
+            dy[i] = (te * b.x - tb * e.x) * (1.0f / det);
+            origin[i] = ta - dx[i] * a.x - dy[i] * a.y;
+        }
+        vec2 d = c.v[3] - (c.v[1] + c.v[2] - c.v[0]);
+        parallelogram = std::abs(d.x) < 0.001f && std::abs(d.y) < 0.001f;
+        side0 = diagonal.x * (c.v[0].y - c.v[1].y) - diagonal.y * (c.v[0].x - c.v[1].x);
+    }
+
+    for (int y=y0; y<y1; ++y) {
+        float cy = y + 0.5f;
+        int x0, x1;
+        if (!spanOf(polygon, cy, &x0, &x1))
+            continue;
+        x0 = std::max(x0, area.x0);
+        x1 = std::min(x1, area.x1);
+        if (x0 >= x1)
+            continue;
+
+        unsigned *dst = t.row(y);
+        if (c.type == Command::DrawSolid) {
+            if (clip.mask < 0) {
+                blendSolidSpan(dst + x0, x1 - x0, c.color);
+            } else {
+                std::fill(scratch + x0, scratch + x1, c.color);
+                blendRow(dst, scratch, x0, x1, y, clip, 255);
+            }
+        } else {
+            for (int x=x0; x<x1; ++x) {
+                float cx = x + 0.5f;
+                int i = 0;
+                if (!parallelogram) {
+                    float side = diagonal.x * (cy - c.v[1].y) - diagonal.y * (cx - c.v[1].x);
+                    i = (side > 0) == (side0 > 0) ? 0 : 1;
+                }
+                scratch[x] = sample(c.texture, origin[i] + dx[i] * cx + dy[i] * cy);
+            }
+            blendRow(dst, scratch, x0, x1, y, clip, 255);
+        }
+    }
+}
+
+/*!
+    Blends the pixels from \a x0 to \a x1 in \a src over \a dst, both rows
+    indexed by x, on the row \a y, leaving out what \a clip's mask excludes.
+ */
+inline void SoftwareRenderer::blendRow(unsigned *dst, const unsigned *src, int x0, int x1, int y, const Clip &clip, unsigned opacity)
+{
+    if (clip.mask < 0) {
+        blendSpan(dst + x0, src + x0, x1 - x0, opacity);
+        return;
+    }
+    const unsigned char *mask = m_masks[clip.mask].data() + y * m_width;
+    int x = x0;
+    while (x < x1) {
+        while (x < x1 && !mask[x])
+            ++x;
+        int start = x;
+        while (x < x1 && mask[x])
+            ++x;
+        if (x > start)
+            blendSpan(dst + start, src + start, x - start, opacity);
+    }
+}
+
+/*!
+    Draws the rows from \a y0 up to \a y1 of the layer of \a c into \a t,
+    applying the layer's effect.
+ */
+inline void SoftwareRenderer::drawLayer(const Command &c, const Target &t, int y0, int y1, unsigned *scratch)
+{
+    const Layer *layer = m_layers[c.layer].get();
+    const Clip &clip = m_clips[c.clip];
+    Node *node = layer->node;
+    Bounds clipped = c.bounds & t.bounds;
+    y0 = std::max(y0, clipped.y0);
+    y1 = std::min(y1, clipped.y1);
+    int stride = layer->bounds.x1 - layer->bounds.x0;
+
+    unsigned opacity = 255;
+    if (node->type() == Node::OpacityNodeType)
+        opacity = static_cast<OpacityNode *>(node)->opacity() * 255.0f + 0.5f;
+
+    if (node->type() == Node::ShadowNodeType) {
+        ShadowNode *shadow = static_cast<ShadowNode *>(node);
+        int dx = std::round(shadow->offset().x);
+        int dy = std::round(shadow->offset().y);
+        vec4 color = shadow->color();
+        Bounds area = layer->bounds.adjusted(dx, dy, dx, dy) & clipped;
+        for (int y=std::max(y0, area.y0); y<std::min(y1, area.y1); ++y) {
+            const unsigned char *alpha = layer->alpha.data() + (y - dy - layer->bounds.y0) * stride - layer->bounds.x0 - dx;
+            for (int x=area.x0; x<area.x1; ++x) {
+                vec4 s = color * (alpha[x] / 255.0f);
+                scratch[x] = (unsigned(s.x * 255.0f + 0.5f))
+                             | (unsigned(s.y * 255.0f + 0.5f) << 8)
+                             | (unsigned(s.z * 255.0f + 0.5f) << 16)
+                             | (unsigned(s.w * 255.0f + 0.5f) << 24);
+            }
+            blendRow(t.row(y), scratch, area.x0, area.x1, y, clip, 255);
+        }
+    }
+
+    Bounds area = layer->bounds & clipped;
+    for (int y=std::max(y0, area.y0); y<std::min(y1, area.y1); ++y) {
+        const unsigned *src = layer->pixels.data() + (y - layer->bounds.y0) * stride - layer->bounds.x0;
+        blendRow(t.row(y), src, area.x0, area.x1, y, clip, opacity);
+    }
+}
+
+/*!
+    Rasterizes the commands of \a layer into \a t, one band of rows per task.
+ */
+inline void SoftwareRenderer::rasterize(Layer *layer, const Target &t)
+{
+    int y0 = t.bounds.y0;
+    int bands = (t.bounds.y1 - y0 + RENGINE_SOFTWARE_BAND_ROWS - 1) / RENGINE_SOFTWARE_BAND_ROWS;
+    m_pool->run(bands, [this, layer, &t, y0] (unsigned band) {
+        std::vector<unsigned> scratch(t.bounds.x1 - t.bounds.x0);
+        unsigned *row = scratch.data() - t.bounds.x0;
+        int first = y0 + band * RENGINE_SOFTWARE_BAND_ROWS;
+        int last = std::min(first + RENGINE_SOFTWARE_BAND_ROWS, t.bounds.y1);
+        for (const Command &c : layer->commands)
+            draw(c, t, first, last, row);
+    });
+}
+
+/*!
+    Returns the weights of the gaussian with \a radius, from the center and
+    out, in 16.16 fixed point. The weights are the same as OpenGLRenderer's.
+ */
+inline std::vector<unsigned> SoftwareRenderer::blurKernel(unsigned radius) const
+{
+    float sigma = 0.3f * radius + 0.8f;
+    std::vector<float> weights(radius + 1);
+    float sum = 0;
+    for (unsigned i=0; i<=radius; ++i) {
+        weights[i] = std::exp(-float(i * i) / (2.0f * sigma * sigma));
+        sum += i == 0 ? weights[i] : 2.0f * weights[i];
+    }
+    std::vector<unsigned> kernel(radius + 1);
+    for (unsigned i=0; i<=radius; ++i)
+        kernel[i] = weights[i] / sum * 65536.0f + 0.5f;
+    return kernel;
+}
+
+/*!
+    Blurs the pixels of \a layer with a separable gaussian of \a radius. The
+    pixels outside the layer are transparent.
+ */
+inline void SoftwareRenderer::blur(Layer *layer, unsigned radius)
+{
+    int w = layer->bounds.x1 - layer->bounds.x0;
+    int h = layer->bounds.y1 - layer->bounds.y0;
+    int r = radius;
+    std::vector<unsigned> kernel = blurKernel(radius);
+    std::vector<unsigned> tmp(w * h);
+    unsigned *pixels = layer->pixels.data();
+    unsigned *horizontal = tmp.data();
+
+    auto pass = [&kernel, r] (const unsigned *src, unsigned *dst, int count, int step) {
+        for (int i=0; i<count; ++i) {
+            unsigned sum[4] = { 32768, 32768, 32768, 32768 };
+            for (int k=std::max(-r, -i); k<=std::min(r, count - 1 - i); ++k) {
+                unsigned p = src[(i + k) * step];
+                unsigned weight = kernel[std::abs(k)];
+                sum[0] += (p & 0xff) * weight;
+                sum[1] += ((p >> 8) & 0xff) * weight;
+                sum[2] += ((p >> 16) & 0xff) * weight;
+                sum[3] += (p >> 24) * weight;
+            }
+            dst[i * step] = std::min(sum[0] >> 16, 255u)
+                            | (std::min(sum[1] >> 16, 255u) << 8)
+                            | (std::min(sum[2] >> 16, 255u) << 16)
+                            | (std::min(sum[3] >> 16, 255u) << 24);
+        }
+    };
+    m_pool->run(h, [&] (unsigned y) { pass(pixels + y * w, horizontal + y * w, w, 1); });
+    m_pool->run(w, [&] (unsigned x) { pass(horizontal + x, pixels + x, h, w); });
+}
+
+/*!
+    Stores a copy of the alpha of \a layer, blurred with \a radius, in the
+    layer's 'alpha'.
+ */
+inline void SoftwareRenderer::blurAlpha(Layer *layer, unsigned radius)
+{
+    int w = layer->bounds.x1 - layer->bounds.x0;
+    int h = layer->bounds.y1 - layer->bounds.y0;
+    int r = radius;
+    std::vector<unsigned> kernel = blurKernel(radius);
+    std::vector<unsigned char> tmp(w * h);
+    layer->alpha.resize(w * h);
+    const unsigned *pixels = layer->pixels.data();
+    unsigned char *horizontal = tmp.data();
+    unsigned char *alpha = layer->alpha.data();
+
+    m_pool->run(h, [&] (unsigned y) {
+        const unsigned *src = pixels + y * w;
+        for (int x=0; x<w; ++x) {
+            unsigned sum = 32768;
+            for (int k=std::max(-r, -x); k<=std::min(r, w - 1 - x); ++k)
+                sum += (src[x + k] >> 24) * kernel[std::abs(k)];
+            horizontal[y * w + x] = std::min(sum >> 16, 255u);
+        }
+    });
+    m_pool->run(w, [&] (unsigned x) {
+        for (int y=0; y<h; ++y) {
+            unsigned sum = 32768;
+            for (int k=std::max(-r, -y); k<=std::min(r, h - 1 - y); ++k)
+                sum += horizontal[(y + k) * w + x] * kernel[std::abs(k)];
+            alpha[y * w + x] = std::min(sum >> 16, 255u);
+        }
+    });
+}
+
+/*!
+    Multiplies the premultiplied pixels of \a layer with \a matrix, the same
+    as OpenGLRenderer's color filter shader.
+ */
+inline void SoftwareRenderer::applyColorMatrix(Layer *layer, const mat4 &matrix)
+{
+    int w = layer->bounds.x1 - layer->bounds.x0;
+    int h = layer->bounds.y1 - layer->bounds.y0;
+    unsigned *pixels = layer->pixels.data();
+    m_pool->run(h, [&] (unsigned y) {
+        for (unsigned *p = pixels + y * w; p < pixels + (y + 1) * w; ++p) {
+            if (*p == 0)
+                continue;
+            vec4 c = matrix * (vec4(*p & 0xff, (*p >> 8) & 0xff, (*p >> 16) & 0xff, *p >> 24) / 255.0f);
+            c = min(max(c, vec4(0.0f)), vec4(1.0f)) * 255.0f + 0.5f;
+            *p = unsigned(c.x) | (unsigned(c.y) << 8) | (unsigned(c.z) << 16) | (unsigned(c.w) << 24);
+        }
+    });
+}
+
+/*!
+    Rasterizes \a layer into its pixels and applies the effect which can be
+    done before it is drawn.
+ */
+inline void SoftwareRenderer::renderLayer(Layer *layer)
+{
+    if (layer->bounds.isEmpty())
+        return;
+
+    Target t;
+    t.bounds = layer->bounds;
+    t.stride = t.bounds.x1 - t.bounds.x0;
+    layer->pixels.assign(t.stride * (t.bounds.y1 - t.bounds.y0), 0);
+    t.pixels = layer->pixels.data();
+    rasterize(layer, t);
+
+    Node *node = layer->node;
+    if (node->type() == Node::BlurNodeType)
+        blur(layer, static_cast<BlurNode *>(node)->radius());
+    else if (node->type() == Node::ShadowNodeType)
+        blurAlpha(layer, static_cast<ShadowNode *>(node)->radius());
+    else if (node->type() == Node::ColorFilterNodeType)
+        applyColorMatrix(layer, static_cast<ColorFilterNode *>(node)->colorMatrix());
+}
+
+inline bool SoftwareRenderer::render()
+{
+    Node *root = sceneRoot();
+    if (root == 0) {
+        logw << " - no 'sceneRoot', surely this is not what you intended?" << std::endl;
+        return false;
+    }
+
+    vec2 s = size();
+    m_width = s.x;
+    m_height = s.y;
+    m_pixels.resize(m_width * m_height);
+
+    // Layer 0 is the frame itself
+    if (m_layers.empty())
+        m_layers.push_back(std::unique_ptr<Layer>(new Layer()));
+    m_layerCount = 1;
+    Layer *frame = m_layers[0].get();
+    frame->node = 0;
+    frame->commands.clear();
+    frame->content = Bounds();
+    frame->bounds = Bounds(0, 0, m_width, m_height);
+    m_clips.clear();
+    Clip noClip = { frame->bounds, -1 };
+    m_clips.push_back(noClip);
+    m_maskCount = 0;
+
+    BuildState state;
+    build(state, root);
+
+    // Nested layers come after the one they are drawn into
+    for (unsigned i=m_layerCount-1; i>0; --i)
+        renderLayer(m_layers[i].get());
+
+    vec4 c = fillColor() * 255.0f + 0.5f;
+    std::fill(m_pixels.begin(), m_pixels.end(), unsigned(c.x) | (unsigned(c.y) << 8) | (unsigned(c.z) << 16) | (unsigned(c.w) << 24));
+    Target t = { m_pixels.data(), frame->bounds, m_width };
+    if (m_width > 0 && m_height > 0)
+        rasterize(frame, t);
+
+    setDamageRect(rect2d(0, 0, m_width, m_height));
+    return true;
+}
+
+/*!
+    Reads back the pixels like OpenGLRenderer, with \a x and \a y from the
+    bottom left corner of the frame and the top row first in \a pixels.
+ */
+inline bool SoftwareRenderer::readPixels(int x, int y, int w, int h, unsigned *pixels)
+{
+    if (x < 0 || y < 0 || x + w > m_width || y + h > m_height)
+        return false;
+    for (int i=0; i<h; ++i) {
+        const unsigned *src = m_pixels.data() + (m_height - y - h + i) * m_width + x;
+        std::copy(src, src + w, pixels + i * w);
+    }
+    return true;
+}
+
+RENGINE_END_NAMESPACE
@@ -63,6 +63,15 @@ public:
      */
     virtual GLuint textureId() const = 0;
 
+    /*!
+        Returns the normalized rectangle this texture occupies inside
+        textureId(). This is the full texture unless the texture is a
+        sub-region of a larger texture, like an atlas. Code which binds
+        textureId() itself must map its texture coordinates into this
+        rectangle.
+     */
+    virtual rect2d subRect() const { return rect2d(0, 0, 1, 1); }
+
 
     /*!
         A pointer to the backend that created this texture. Can be
@@ -63,5 +63,6 @@ int main(int argc, char **argv) {
     RENGINE_ALLOCATION_POOL(rengine::ColorFilterNode, rengine_ColorFilterNode, 8);                     \
     RENGINE_ALLOCATION_POOL(rengine::BlurNode, rengine_BlurNode, 8);                                   \
     RENGINE_ALLOCATION_POOL(rengine::ShadowNode, rengine_ShadowNode, 8);                               \
+    RENGINE_ALLOCATION_POOL(rengine::ClipNode, rengine_ClipNode, 8);                                   \
     return RENGINE_NAMESPACE_PREFIX rengine_main<InterfaceName>(argc, argv);                           \
 }
@@ -36,6 +36,7 @@ public:
             printf("running changed...\n");
             requestRender();
         }));
+        m_animationManager.setVirtualClock(Backend::get()->usesVirtualClock());
     }
 
     ~StandardSurface()
@@ -86,12 +87,20 @@ public:
         // Advance the animations just before rendering..
         m_animationManager.tick();
 
+        // The renderer only repaints what has changed since the frame in the
+        // back buffer when tracking damage.
+        if (m_renderer->damageTrackingEnabled())
+            m_renderer->setBufferAge(bufferAge());
+
         // And then render the stuff
         onBeforeRender();
         m_renderer->render();
         onAfterRender();
 
-        commitRender();
+        if (m_renderer->damageTrackingEnabled())
+            commitPartialRender(m_renderer->damageRect());
+        else
+            commitRender();
         m_renderer->frameSwapped();
 
         // Schedule a repaint again if there are animations running...
@@ -59,6 +59,21 @@ public:
      */
     virtual bool commitRender() = 0;
 
+    /*!
+        Implement in the backend to present the frame when only \a damage, in
+        device pixels, has changed since the previous frame, for instance
+        using EGL_KHR_swap_buffers_with_damage. The default implementation
+        presents the whole surface.
+     */
+    virtual bool commitPartialRender(rect2d damage) { (void) damage; return commitRender(); }
+
+    /*!
+        Implement in the backend to report how many frames ago the content of
+        the back buffer was presented, as in EGL_EXT_buffer_age. Return 0 if
+        the content is undefined.
+     */
+    virtual unsigned bufferAge() const { return 0; }
+
     /*!
         Implement in the backend to report the size of a surface to the application
      */
@@ -109,6 +124,10 @@ public:
 
     bool commitRender() { return m_impl->commitRender(); }
 
+    bool commitPartialRender(rect2d damage) { return m_impl->commitPartialRender(damage); }
+
+    unsigned bufferAge() const { return m_impl->bufferAge(); }
+
     vec2 size() const { return m_impl->size(); }
 
     void requestSize(vec2 size) { m_impl->requestSize(size); }
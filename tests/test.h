@@ -132,6 +132,13 @@ public:
     virtual Node *build() = 0;
     virtual void check() = 0;
 
+    // Reimplement to modify the tree and return true to have it rendered and
+    // checked again, without rebuilding it.
+    virtual bool nextFrame() { return false; }
+
+    // Called before each frame is rendered
+    virtual void beforeRender() { }
+
     vec4 pixel(int x, int y) {
         assert(x >= 0);
         assert(x < m_w);
@@ -165,7 +172,7 @@ protected:
 class TestBase : public StandardSurface
 {
 public:
-    TestBase() : leaveRunning(false), m_currentTest(0) { }
+    TestBase() : leaveRunning(false), m_currentTest(0), m_nextFrame(false) { }
 
     void addTest(StaticRenderTest *test) {
         tests.push_back(test);
@@ -173,6 +180,11 @@ public:
     }
 
     Node *update(Node *root) override {
+        if (m_nextFrame) {
+            m_nextFrame = false;
+            return root;
+        }
+
         if (root)
             root->destroy();
 
@@ -187,6 +199,11 @@ public:
         return m_currentTest->build();
     }
 
+    void onBeforeRender() override {
+        if (m_currentTest)
+            m_currentTest->beforeRender();
+    }
+
     void onAfterRender() override {
         if (!m_currentTest)
             return;
@@ -207,7 +224,10 @@ public:
         m_currentTest->check();
         cout << "tst_" << m_currentTest->name() << ": ok" << endl;
 
-        if (tests.empty()) {
+        if (m_currentTest->nextFrame()) {
+            m_nextFrame = true;
+            requestRender();
+        } else if (tests.empty()) {
             if (!leaveRunning)
                 Backend::get()->quit();
         } else {
@@ -221,6 +241,7 @@ public:
 
 private:
     StaticRenderTest *m_currentTest;
+    bool m_nextFrame;
     list<StaticRenderTest *> tests;
 };
 
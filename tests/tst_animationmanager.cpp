@@ -0,0 +1,108 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "test.h"
+
+#include <vector>
+
+// Records the times it is ticked with
+class RecordingAnimation : public AbstractAnimation
+{
+public:
+    void tick(double time) override {
+        times.push_back(time);
+        if (time >= duration() * iterations())
+            setRunning(false);
+    }
+
+    std::vector<double> times;
+};
+
+void tst_animationmanager_virtualClock()
+{
+    AnimationManager manager;
+    manager.setVirtualClock(true);
+    manager.setTickInterval(0.1);
+    check_true(manager.virtualClock());
+    check_fuzzyEqual(manager.tickInterval(), 0.1);
+
+    auto animation = std::make_shared<RecordingAnimation>();
+    animation->setDuration(0.5);
+    manager.start(animation, 0.25);
+
+    // Frames at 0.0, 0.1 and 0.2 are before the start, which happens at 0.3
+    for (int i=0; i<3; ++i) {
+        manager.tick();
+        check_true(animation->times.empty());
+        check_true(manager.animationsScheduled());
+    }
+
+    // Taking time between the frames doesn't change the animation's progress
+    for (int i=0; i<20 && (manager.animationsRunning() || manager.animationsScheduled()); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(i % 3));
+        manager.tick();
+    }
+
+    check_true(!animation->isRunning());
+    check_true(!manager.isRunning());
+    check_equal(animation->times.size(), 6u);
+    for (unsigned i=0; i<animation->times.size(); ++i)
+        check_fuzzyEqual(animation->times.at(i), i * 0.1);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_animationmanager_virtualClockKeepsRunning()
+{
+    AnimationManager manager;
+    manager.setVirtualClock(true);
+
+    // The clock also advances while idle, so an animation started after some
+    // frames is scheduled at the time of the upcoming frame and begins on the
+    // one after that, like it would with the wall clock
+    for (int i=0; i<10; ++i)
+        manager.tick();
+
+    auto animation = std::make_shared<RecordingAnimation>();
+    animation->setDuration(1);
+    manager.start(animation);
+    manager.tick();
+    check_true(animation->times.empty());
+    manager.tick();
+    manager.tick();
+    check_true(animation->isRunning());
+    check_equal(animation->times.size(), 2u);
+    check_fuzzyEqual(animation->times.at(0), 0.0);
+    check_fuzzyEqual(animation->times.at(1), 0.016);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    tst_animationmanager_virtualClock();
+    tst_animationmanager_virtualClockKeepsRunning();
+    return 0;
+}
@@ -0,0 +1,90 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "test.h"
+
+void tst_framearena_allocate()
+{
+    FrameArena arena;
+    arena.reset(FrameArena::sizeOf<int>(3) + FrameArena::sizeOf<double>(5));
+
+    int *ints = arena.allocate<int>(3);
+    double *doubles = arena.allocate<double>(5);
+    check_true(ints != 0);
+    check_true((char *) doubles - (char *) ints == FrameArena::sizeOf<int>(3));
+    check_equal(uintptr_t(doubles) % FrameArena::Alignment, 0u);
+    check_equal(arena.bytesUsed(), 16u + 48u);
+    check_true(arena.capacity() >= arena.bytesUsed());
+    check_equal(arena.growCount(), 1u);
+
+    // Same size or smaller reuses the memory
+    arena.reset(64);
+    check_equal(arena.allocate<int>(3), ints);
+    arena.reset(32);
+    check_equal(arena.growCount(), 1u);
+
+    cout << __PRETTY_FUNCTION__ << ": ok" << endl;
+}
+
+void tst_framearena_shrink()
+{
+    FrameArena arena;
+    arena.setShrinkPolicy(3, 0.5);
+    arena.reset(1024);
+    unsigned capacity = arena.capacity();
+
+    // Above the threshold, never shrinks
+    for (int i=0; i<10; ++i)
+        arena.reset(capacity / 2 + 16);
+    check_equal(arena.capacity(), capacity);
+    check_equal(arena.shrinkCount(), 0u);
+
+    // Below the threshold for 3 frames, shrinks to the largest of those
+    arena.reset(128);
+    arena.reset(256);
+    check_equal(arena.capacity(), capacity);
+    arena.reset(64);
+    check_equal(arena.capacity(), 256u);
+    check_equal(arena.shrinkCount(), 1u);
+
+    // The high water mark is the peak, shrinking does not lower it
+    check_equal(arena.highWaterMark(), 1024u);
+
+    // Disabled
+    arena.setShrinkPolicy(0, 0.5);
+    for (int i=0; i<10; ++i)
+        arena.reset(16);
+    check_equal(arena.capacity(), 256u);
+
+    cout << __PRETTY_FUNCTION__ << ": ok" << endl;
+}
+
+int main(int, char **)
+{
+    tst_framearena_allocate();
+    tst_framearena_shrink();
+
+    return 0;
+}
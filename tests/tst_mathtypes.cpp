@@ -258,9 +258,41 @@ void tst_rect2d_intersect()
     check_equal(r.tl, vec2(-4, -8));
     check_equal(r.br, vec2(-1, -2));
 
+    r = rect2d(0, 0, 10, 10) & rect2d(5, -5, 15, 8);
+    check_equal(r.tl, vec2(5, 0));
+    check_equal(r.br, vec2(10, 8));
+    r &= rect2d(20, 20, 30, 30);
+    check_true(r.width() < 0);
+    check_true(r.height() < 0);
+
     cout << __PRETTY_FUNCTION__ << ": ok" << endl;
 }
 
+void tst_mat4_mapQuad2D()
+{
+    vec2 a(1, 2);
+    vec2 b(5, 10);
+    mat4 matrices[] = {
+        mat4(),
+        mat4::translate2D(10, 20),
+        mat4::scale2D(2, -3),
+        mat4::translate2D(10, 20) * mat4::scale2D(2, 3),
+        mat4::rotate2D(0.5),
+        mat4::translate2D(10, 20) * mat4::rotate2D(-1.3) * mat4::scale2D(2, 3),
+        mat4::rotateAroundX(0.4) * mat4::translate2D(3, 4)
+    };
+
+    for (const mat4 &m : matrices) {
+        vec2 v[4];
+        m.mapQuad2D(a, b, v);
+        check_fuzzyEqual(v[0], m * a);
+        check_fuzzyEqual(v[1], m * vec2(a.x, b.y));
+        check_fuzzyEqual(v[2], m * vec2(b.x, a.y));
+        check_fuzzyEqual(v[3], m * b);
+    }
+
+    cout << __PRETTY_FUNCTION__ << ": ok" << endl;
+}
 
 int main(int, char **)
 {
@@ -268,6 +300,7 @@ int main(int, char **)
     tst_mat4();
     tst_mat4_vecx();
     tst_mat4_invert();
+    tst_mat4_mapQuad2D();
     tst_rect2d();
     tst_rect2d_intersect();
 
@@ -209,6 +209,1215 @@ public:
     }
 };
 
+class Batching : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "Batching"; }
+    Node *build() override {
+        Renderer *renderer = static_cast<StandardSurface *>(surface())->renderer();
+        unsigned red[] = { 0xff0000ff, 0xff0000ff, 0xff0000ff, 0xff0000ff };
+        unsigned green[] = { 0xff00ff00, 0xff00ff00, 0xff00ff00, 0xff00ff00 };
+        Texture *redTexture = renderer->createTextureFromImageData(vec2(2, 2), Texture::RGBA_32, red);
+        Texture *greenTexture = renderer->createTextureFromImageData(vec2(2, 2), Texture::RGBA_32, green);
+
+        // Atlasing is opt-in, so each texture has its own texture id
+        check_true(redTexture->textureId() != greenTexture->textureId());
+        check_true(redTexture->subRect() == rect2d(0, 0, 1, 1));
+
+        Node *root = Node::create();
+        *root
+            // A run of rectangles with different colors
+            << RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1))
+            << RectangleNode::create(rect2d::fromXywh(20, 10, 10, 10), vec4(0, 1, 0, 1))
+            << RectangleNode::create(rect2d::fromXywh(30, 10, 10, 10), vec4(0, 0, 1, 0.5))
+            // A run of textures, broken up by a change of texture
+            << TextureNode::create(rect2d::fromXywh(10, 30, 10, 10), redTexture)
+            << TextureNode::create(rect2d::fromXywh(20, 30, 10, 10), redTexture)
+            << TextureNode::create(rect2d::fromXywh(30, 30, 10, 10), greenTexture)
+            << TextureNode::create(rect2d::fromXywh(40, 30, 10, 10), redTexture)
+            // Overlapping rectangle and texture, painting order must be kept
+            << RectangleNode::create(rect2d::fromXywh(10, 50, 10, 10), vec4(0, 0, 1, 1))
+            << TextureNode::create(rect2d::fromXywh(15, 50, 10, 10), greenTexture)
+            << RectangleNode::create(rect2d::fromXywh(20, 50, 10, 10), vec4(1, 0, 0, 1))
+            // Rectangles on either side of a layer
+            << RectangleNode::create(rect2d::fromXywh(10, 70, 10, 10), vec4(1, 0, 0, 1))
+            << &(*OpacityNode::create(0.5)
+                 << RectangleNode::create(rect2d::fromXywh(20, 70, 10, 10), vec4(0, 1, 0, 1))
+                )
+            << RectangleNode::create(rect2d::fromXywh(30, 70, 10, 10), vec4(0, 0, 1, 1))
+            ;
+        return root;
+    }
+
+    void check() override {
+        check_pixel(15, 15, vec4(1, 0, 0, 1));
+        check_pixel(25, 15, vec4(0, 1, 0, 1));
+        check_pixel(35, 15, vec4(0, 0, 0.5, 1));
+
+        check_pixel(15, 35, vec4(1, 0, 0, 1));
+        check_pixel(25, 35, vec4(1, 0, 0, 1));
+        check_pixel(35, 35, vec4(0, 1, 0, 1));
+        check_pixel(45, 35, vec4(1, 0, 0, 1));
+
+        check_pixel(12, 55, vec4(0, 0, 1, 1));
+        check_pixel(17, 55, vec4(0, 1, 0, 1));
+        check_pixel(22, 55, vec4(1, 0, 0, 1));
+        check_pixel(27, 55, vec4(1, 0, 0, 1));
+
+        check_pixel(15, 75, vec4(1, 0, 0, 1));
+        check_pixel(25, 75, vec4(0, 0.5, 0, 1));
+        check_pixel(35, 75, vec4(0, 0, 1, 1));
+    }
+};
+
+class AtlasCompaction : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "AtlasCompaction"; }
+    Node *build() override {
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+
+        // Fill up an atlas, then delete all but one texture. Adding another
+        // texture will then have to compact the atlas.
+        renderer->setTextureAtlasEnabled(true);
+        std::vector<unsigned> pixels(250 * 250);
+        std::vector<Texture *> textures;
+        for (int i=0; i<16; ++i) {
+            std::fill(pixels.begin(), pixels.end(), i == 5 ? 0xff0000ff : 0xffff0000);
+            textures.push_back(renderer->createTextureFromImageData(vec2(250, 250), Texture::RGBx_32, pixels.data()));
+        }
+        for (int i=0; i<16; ++i)
+            if (i != 5)
+                delete textures[i];
+        std::fill(pixels.begin(), pixels.end(), 0xff00ff00);
+        Texture *green = renderer->createTextureFromImageData(vec2(250, 250), Texture::RGBx_32, pixels.data());
+        renderer->setTextureAtlasEnabled(false);
+
+        check_equal(textures[5]->textureId(), green->textureId());
+        for (auto atlas : renderer->m_atlases) {
+            if (atlas->format() == Texture::RGBx_32) {
+                check_equal(atlas->compactCount(), 1u);
+                check_equal(atlas->textureCount(), 2u);
+            }
+        }
+
+        Node *root = Node::create();
+        *root
+            << TextureNode::create(rect2d::fromXywh(0, 0, 250, 250), textures[5])
+            << TextureNode::create(rect2d::fromXywh(300, 0, 250, 250), green);
+        return root;
+    }
+
+    void check() override {
+        check_pixel(0, 0, vec4(1, 0, 0, 1));
+        check_pixel(125, 125, vec4(1, 0, 0, 1));
+        check_pixel(249, 249, vec4(1, 0, 0, 1));
+        check_pixel(250, 125, vec4(0, 0, 0, 1));
+        check_pixel(300, 0, vec4(0, 1, 0, 1));
+        check_pixel(425, 125, vec4(0, 1, 0, 1));
+        check_pixel(549, 249, vec4(0, 1, 0, 1));
+    }
+};
+
+class RetainedUpdates : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "RetainedUpdates"; }
+    Node *build() override {
+        m_frame = 0;
+        m_root = Node::create();
+        m_rect = RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1));
+        m_xform = TransformNode::create(mat4::translate2D(30, 10));
+        m_opacity = OpacityNode::create(0.5);
+
+        *m_root
+            << m_rect
+            << &(*m_xform
+                 << RectangleNode::create(rect2d::fromXywh(0, 0, 10, 10), vec4(0, 1, 0, 1))
+                )
+            << &(*m_opacity
+                 << RectangleNode::create(rect2d::fromXywh(60, 10, 10, 10), vec4(0, 0, 1, 1))
+                );
+        return m_root;
+    }
+
+    bool nextFrame() override {
+        switch (++m_frame) {
+        case 1: // same size, rebuilt in place
+            m_rect->setColor(vec4(0, 0, 1, 1));
+            m_xform->setMatrix(mat4::translate2D(40, 10));
+            break;
+        case 2: // new node, full rebuild
+            *m_opacity << RectangleNode::create(rect2d::fromXywh(80, 10, 10, 10), vec4(1, 0, 0, 1));
+            break;
+        case 3: // layer property change
+            m_opacity->setOpacity(1.0);
+            break;
+        case 4: // nothing changed
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+
+    void check() override {
+        vec4 black(0, 0, 0, 1);
+        vec4 rectColor = m_frame == 0 ? vec4(1, 0, 0, 1) : vec4(0, 0, 1, 1);
+        float xformX = m_frame == 0 ? 30 : 40;
+        float opacity = m_frame < 3 ? 0.5 : 1.0;
+        vec4 addedColor = m_frame < 2 ? black : vec4(opacity, 0, 0, 1);
+
+        check_pixel(15, 15, rectColor);
+        check_pixel(xformX + 5, 15, vec4(0, 1, 0, 1));
+        check_pixel(xformX - 1, 15, black);
+        check_pixel(xformX + 10, 15, black);
+        check_pixel(65, 15, vec4(0, 0, opacity, 1));
+        check_pixel(85, 15, addedColor);
+    }
+
+private:
+    int m_frame;
+    Node *m_root;
+    RectangleNode *m_rect;
+    TransformNode *m_xform;
+    OpacityNode *m_opacity;
+};
+
+class LayerCaching : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "LayerCaching"; }
+    Node *build() override {
+        m_frame = 0;
+        m_rect = RectangleNode::create(rect2d::fromXywh(200, 10, 10, 10), vec4(1, 0, 0, 1));
+        m_blur = BlurNode::create(5);
+        m_shadow = ShadowNode::create(5, vec2(5, 5), vec4(0, 0, 1, 1));
+        m_opacity = OpacityNode::create(0.5);
+        renderer()->setLayerCachingEnabled(true);
+
+        Node *root = Node::create();
+        *root
+            << m_rect
+            << &(*m_blur << RectangleNode::create(rect2d::fromXywh(20, 20, 40, 40), vec4(1, 1, 1, 1)))
+            << &(*m_shadow << RectangleNode::create(rect2d::fromXywh(100, 20, 40, 40), vec4(0, 1, 0, 1)))
+            << &(*m_opacity << RectangleNode::create(rect2d::fromXywh(200, 50, 10, 10), vec4(1, 0, 0, 1)));
+        return root;
+    }
+
+    OpenGLRenderer *renderer() const { return static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer()); }
+
+    bool nextFrame() override {
+        switch (++m_frame) {
+        case 1: // A change outside the layers, reuses both
+            m_rect->setColor(vec4(0, 1, 0, 1));
+            return true;
+        case 2: // A change to one of them
+            m_blur->setRadius(20);
+            return true;
+        case 3: // Only affects how the layer is drawn, reuses its content
+            m_opacityTexture = element(m_opacity)->texture;
+            m_opacity->setOpacity(0.25);
+            return true;
+        default:
+            renderer()->setLayerCachingEnabled(false);
+            check_true(!isCached(m_blur));
+            return false;
+        }
+    }
+
+    OpenGLRenderer::Element *element(Node *node) {
+        OpenGLRenderer *renderer = this->renderer();
+        for (unsigned i=0; i<renderer->m_elementCount; ++i)
+            if (renderer->m_elements[i].node == node)
+                return renderer->m_elements + i;
+        return 0;
+    }
+
+    bool isCached(Node *node) {
+        OpenGLRenderer::Element *e = element(node);
+        return e && e->cached;
+    }
+
+    void check() override {
+        vec2 samples[] = { vec2(18, 40), vec2(40, 40), vec2(62, 40), vec2(120, 40), vec2(142, 50), vec2(120, 63) };
+        const int count = sizeof(samples) / sizeof(vec2);
+
+        check_true(isCached(m_blur));
+        check_true(isCached(m_shadow));
+        check_true(isCached(m_opacity));
+        if (m_frame == 3) {
+            check_equal(element(m_opacity)->texture, m_opacityTexture);
+            check_equal(renderer()->stats().framebufferSwitches, 0u);
+            check_pixel(205, 55, vec4(0.25, 0, 0, 1));
+        } else {
+            check_pixel(205, 55, vec4(0.5, 0, 0, 1));
+        }
+
+        if (m_frame == 0) {
+            for (int i=0; i<count; ++i)
+                m_pixels0[i] = pixel(samples[i].x, samples[i].y);
+            return;
+        }
+
+        check_pixel(205, 15, vec4(0, 1, 0, 1));
+        for (int i=0; i<count; ++i) {
+            if (m_frame >= 2 && samples[i].x < 100)
+                continue;
+            check_pixel(samples[i].x, samples[i].y, m_pixels0[i]);
+        }
+        if (m_frame >= 2)
+            check_true(pixel(18, 40).x > m_pixels0[0].x + 0.05);
+    }
+
+private:
+    int m_frame;
+    unsigned m_opacityTexture;
+    vec4 m_pixels0[6];
+    RectangleNode *m_rect;
+    BlurNode *m_blur;
+    ShadowNode *m_shadow;
+    OpacityNode *m_opacity;
+};
+
+class LayerTexturePool : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "LayerTexturePool"; }
+    Node *build() override {
+        m_frame = 0;
+        m_rect = RectangleNode::create(rect2d::fromXywh(10, 10, 40, 40), vec4(1, 0, 0, 1));
+        return &(*OpacityNode::create(0.5) << m_rect);
+    }
+
+    bool nextFrame() override {
+        // Grow the layer, but stay within the same size bucket
+        if (++m_frame > 2)
+            return false;
+        m_rect->setGeometry(rect2d::fromXywh(10, 10, 40 + m_frame * 5, 40 + m_frame * 5));
+        return true;
+    }
+
+    void check() override {
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        if (m_frame == 0)
+            m_textureCount = renderer->texturePool()->textureCount();
+        check_equal(renderer->texturePool()->textureCount(), m_textureCount);
+
+        float edge = 50 + m_frame * 5;
+        check_pixel(12, 12, vec4(0.5, 0, 0, 1));
+        check_pixel(edge - 2, edge - 2, vec4(0.5, 0, 0, 1));
+        check_pixel(edge + 2, edge + 2, vec4(0, 0, 0, 1));
+    }
+
+private:
+    int m_frame;
+    unsigned m_textureCount;
+    RectangleNode *m_rect;
+};
+
+class DamageTracking : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "DamageTracking"; }
+    Node *build() override {
+        m_frame = 0;
+        renderer()->setDamageTrackingEnabled(true);
+        m_a = RectangleNode::create(rect2d::fromXywh(10, 10, 20, 20), vec4(1, 0, 0, 1));
+        m_b = RectangleNode::create(rect2d::fromXywh(100, 10, 20, 20), vec4(0, 0, 1, 1));
+        return &(*Node::create() << m_a << m_b);
+    }
+
+    Renderer *renderer() const { return static_cast<StandardSurface *>(surface())->renderer(); }
+
+    // The test surface keeps its content between frames
+    void beforeRender() override { renderer()->setBufferAge(1); }
+
+    bool nextFrame() override {
+        switch (++m_frame) {
+        case 1: m_a->setColor(vec4(0, 1, 0, 1)); return true;
+        case 2: m_b->setGeometry(rect2d::fromXywh(150, 10, 20, 20)); return true;
+        case 3: return true;
+        default:
+            renderer()->setDamageTrackingEnabled(false);
+            return false;
+        }
+    }
+
+    void check() override {
+        rect2d damage = renderer()->damageRect();
+        switch (m_frame) {
+        case 0: check_equal(damage, rect2d(vec2(0, 0), surface()->size())); break;
+        case 1: check_equal(damage, rect2d(9, 9, 31, 31)); break;
+        case 2: check_equal(damage, rect2d(99, 9, 171, 31)); break;
+        case 3: check_true(damage.width() <= 0 || damage.height() <= 0); break;
+        }
+
+        vec4 colorA = m_frame == 0 ? vec4(1, 0, 0, 1) : vec4(0, 1, 0, 1);
+        int xB = m_frame < 2 ? 110 : 160;
+        check_pixel(20, 20, colorA);
+        check_pixel(xB, 20, vec4(0, 0, 1, 1));
+        if (m_frame >= 2) {
+            check_pixel(110, 20, vec4(0, 0, 0, 1));
+        }
+    }
+
+private:
+    int m_frame;
+    RectangleNode *m_a;
+    RectangleNode *m_b;
+};
+
+class OpaquePass : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "OpaquePass"; }
+    Node *build() override {
+        renderer()->setOpaquePassEnabled(true);
+        Node *root = Node::create();
+        *root
+            << RectangleNode::create(rect2d::fromXywh(0, 0, 200, 100), vec4(0, 0, 1, 1))
+            << RectangleNode::create(rect2d::fromXywh(50, 0, 100, 100), vec4(1, 0, 0, 0.5))
+            << RectangleNode::create(rect2d::fromXywh(100, 0, 50, 100), vec4(0, 1, 0, 1))
+            << &(*OpacityNode::create(0.5) << RectangleNode::create(rect2d::fromXywh(125, 0, 50, 100), vec4(1, 1, 1, 1)));
+        return root;
+    }
+
+    OpenGLRenderer *renderer() const { return static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer()); }
+
+    void check() override {
+        check_pixel( 25, 50, vec4(0, 0, 1, 1));
+        check_pixel( 75, 50, vec4(0.5, 0, 0.5, 1));
+        check_pixel(112, 50, vec4(0, 1, 0, 1));
+        check_pixel(137, 50, vec4(0.5, 1, 0.5, 1));
+        check_pixel(162, 50, vec4(0.5, 0.5, 1, 1));
+        check_pixel(190, 50, vec4(0, 0, 1, 1));
+        renderer()->setOpaquePassEnabled(false);
+    }
+};
+
+class OcclusionCulling : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "OcclusionCulling"; }
+    Node *build() override {
+        m_frame = 0;
+        m_hidden = RectangleNode::create(rect2d::fromXywh(10, 10, 50, 50), vec4(1, 0, 0, 1));
+        m_occluder = RectangleNode::create(rect2d::fromXywh(0, 0, 100, 100), vec4(0, 0, 1, 1));
+        m_underRotated = RectangleNode::create(rect2d::fromXywh(250, 40, 20, 20), vec4(1, 1, 1, 1));
+        m_group = Node::create();
+        m_groupHidden = RectangleNode::create(rect2d::fromXywh(110, 210, 50, 50), vec4(1, 0, 0, 1));
+        m_groupOccluder = RectangleNode::create(rect2d::fromXywh(100, 200, 100, 100), vec4(0, 0, 1, 1));
+
+        Node *root = Node::create();
+        *root
+            << m_hidden
+            << m_occluder
+            << m_underRotated
+            << &(*TransformNode::create(mat4::translate2D(260, 50) * mat4::rotate2D(M_PI / 4))
+                 << RectangleNode::create(rect2d::fromXywh(-40, -40, 80, 80), vec4(0, 1, 0, 1))
+                )
+            << &(*m_group << m_groupHidden << m_groupOccluder);
+        return root;
+    }
+
+    bool nextFrame() override {
+        switch (++m_frame) {
+        case 1: // moving the occluder reveals what was behind it
+            m_occluder->setGeometry(rect2d::fromXywh(50, 0, 100, 100));
+            break;
+        case 2: // so does destroying an occluder inside a group
+            m_group->remove(m_groupOccluder);
+            m_groupOccluder->destroy();
+            *m_group << RectangleNode::create(rect2d::fromXywh(300, 200, 10, 10), vec4(0, 1, 0, 1));
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+
+    void check() override {
+        unsigned hiddenElements = m_frame == 0 ? 0 : 1;
+        vec4 hiddenColor = m_frame == 0 ? vec4(0, 0, 1, 1) : vec4(1, 0, 0, 1);
+        check_equal(m_hidden->renderRange().elementCount, hiddenElements);
+        check_equal(m_underRotated->renderRange().elementCount, 1u);
+        check_pixel(30, 30, hiddenColor);
+        check_pixel(80, 30, vec4(0, 0, 1, 1));
+        check_pixel(260, 50, vec4(0, 1, 0, 1));
+
+        unsigned groupHiddenElements = m_frame < 2 ? 0 : 1;
+        vec4 groupHiddenColor = m_frame < 2 ? vec4(0, 0, 1, 1) : vec4(1, 0, 0, 1);
+        vec4 groupOccluderColor = m_frame < 2 ? vec4(0, 0, 1, 1) : vec4(0, 0, 0, 1);
+        check_equal(m_groupHidden->renderRange().elementCount, groupHiddenElements);
+        check_pixel(130, 230, groupHiddenColor);
+        check_pixel(180, 280, groupOccluderColor);
+        if (m_frame == 2) {
+            check_pixel(305, 205, vec4(0, 1, 0, 1));
+        }
+    }
+
+private:
+    int m_frame;
+    RectangleNode *m_hidden;
+    RectangleNode *m_occluder;
+    RectangleNode *m_underRotated;
+    Node *m_group;
+    RectangleNode *m_groupHidden;
+    RectangleNode *m_groupOccluder;
+};
+
+class ViewportCulling : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "ViewportCulling"; }
+    Node *build() override {
+        m_frame = 0;
+        m_scroll = TransformNode::create(mat4::translate2D(0, -1000));
+        m_group = Node::create();
+        *m_scroll << m_group;
+        for (int i=0; i<100; ++i) {
+            vec4 color = i % 2 == 0 ? vec4(1, 0, 0, 1) : vec4(0, 1, 0, 1);
+            m_rows[i] = RectangleNode::create(rect2d::fromXywh(100, i * 20, 20, 20), color);
+            if (i < 10)
+                *m_group << m_rows[i];
+            else
+                *m_scroll << m_rows[i];
+        }
+
+        Node *root = Node::create();
+        *root << m_scroll;
+        return root;
+    }
+
+    bool nextFrame() override {
+        switch (++m_frame) {
+        case 1: // scrolling brings more rows into view
+            m_scroll->setMatrix(mat4::translate2D(0, -900));
+            break;
+        case 2: // changes in a culled subtree
+            m_rows[5]->setColor(vec4(0, 0, 1, 1));
+            break;
+        case 3: // culled subtree comes into view
+            m_scroll->setMatrix(mat4::translate2D(0, 0));
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+
+    void check() override {
+        vec4 red(1, 0, 0, 1);
+        vec4 green(0, 1, 0, 1);
+        vec4 blue(0, 0, 1, 1);
+        if (m_frame < 3) {
+            unsigned firstVisible = m_frame == 0 ? 50 : 45;
+            vec4 firstColor = m_frame == 0 ? red : green;
+            check_equal(m_group->renderRange().elementCount, 0u);
+            check_equal(m_rows[firstVisible - 1]->renderRange().elementCount, 0u);
+            check_equal(m_rows[firstVisible]->renderRange().elementCount, 1u);
+            check_pixel(110, 5, firstColor);
+        } else {
+            check_equal(m_group->renderRange().elementCount, 10u);
+            check_pixel(110, 5, red);
+            check_pixel(110, 30, green);
+            check_pixel(110, 110, blue);
+        }
+    }
+
+private:
+    int m_frame;
+    TransformNode *m_scroll;
+    Node *m_group;
+    RectangleNode *m_rows[100];
+};
+
+class Clipping : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "Clipping"; }
+    Node *build() override {
+        m_outside = RectangleNode::create(rect2d::fromXywh(200, 200, 10, 10), vec4(1, 1, 1, 1));
+        TransformNode *projection = TransformNode::create(mat4::translate2D(270, 150));
+        projection->setProjectionDepth(1000);
+
+        Node *root = Node::create();
+        *root
+            << &(*ClipNode::create(rect2d::fromXywh(10, 10, 50, 50))
+                 << RectangleNode::create(rect2d::fromXywh(0, 0, 100, 100), vec4(1, 0, 0, 1))
+                 << m_outside
+                )
+            << &(*TransformNode::create(mat4::translate2D(200, 60) * mat4::rotate2D(M_PI / 4))
+                 << &(*ClipNode::create(rect2d::fromXywh(-30, -30, 60, 60))
+                      << RectangleNode::create(rect2d::fromXywh(-50, -50, 100, 100), vec4(0, 1, 0, 1))
+                     )
+                )
+            << &(*OpacityNode::create(0.5)
+                 << &(*TransformNode::create(mat4::translate2D(350, 60) * mat4::rotate2D(M_PI / 4))
+                      << &(*ClipNode::create(rect2d::fromXywh(-30, -30, 60, 60))
+                           << RectangleNode::create(rect2d::fromXywh(-50, -50, 100, 100), vec4(1, 1, 1, 1))
+                          )
+                     )
+                )
+            << &(*projection
+                 << &(*TransformNode::create(mat4::rotateAroundY(M_PI / 3))
+                      << &(*ClipNode::create(rect2d::fromXywh(-30, -30, 60, 60))
+                           << RectangleNode::create(rect2d::fromXywh(-50, -50, 100, 100), vec4(0, 0, 1, 1))
+                          )
+                     )
+                );
+        return root;
+    }
+
+    void check() override {
+        vec4 black(0, 0, 0, 1);
+        vec4 gray(0.5, 0.5, 0.5, 1);
+
+        // axis aligned, using the scissor
+        check_pixel( 5,  5, black);
+        check_pixel(30, 30, vec4(1, 0, 0, 1));
+        check_pixel(65, 30, black);
+        check_equal(m_outside->renderRange().elementCount, 0u);
+
+        // rotated, using the stencil buffer
+        check_pixel(200, 60, vec4(0, 1, 0, 1));
+        check_pixel(235, 60, vec4(0, 1, 0, 1));
+        check_pixel(225, 35, black);
+
+        // rotated inside a layer
+        check_pixel(350, 60, gray);
+        check_pixel(385, 60, gray);
+        check_pixel(375, 35, black);
+
+        // projected, using the stencil buffer
+        check_pixel(270, 150, vec4(0, 0, 1, 1));
+        check_pixel(270, 170, vec4(0, 0, 1, 1));
+        check_pixel(280, 150, black);
+        check_pixel(270, 190, black);
+    }
+
+private:
+    RectangleNode *m_outside;
+};
+
+class VertexStreaming : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "VertexStreaming"; }
+    Node *build() override {
+        m_frame = 0;
+        Node *root = Node::create();
+        for (int i=0; i<20; ++i) {
+            m_rects[i] = RectangleNode::create(rect2d::fromXywh(10 + i * 10, 10, 10, 10), vec4(0, 1, 0, 1));
+            *root << m_rects[i];
+        }
+        return root;
+    }
+
+    bool nextFrame() override {
+        ++m_frame;
+        if (m_frame > RENGINE_OPENGL_VERTEX_BUFFER_COUNT + 3)
+            return false;
+        // The last frame has no changes
+        if (m_frame <= RENGINE_OPENGL_VERTEX_BUFFER_COUNT + 2)
+            m_rects[5]->setColor(colorFor(m_frame));
+        return true;
+    }
+
+    vec4 colorFor(int frame) const { return frame % 2 == 0 ? vec4(1, 0, 0, 1) : vec4(0, 0, 1, 1); }
+
+    void check() override {
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        const unsigned quadBytes = 4 * (2 * sizeof(vec2) + sizeof(unsigned));
+
+        // Each buffer in the ring is filled in full the first time it is
+        // used, after that only the changed rectangle is uploaded.
+        unsigned expected = quadBytes * 20;
+        if (m_frame > RENGINE_OPENGL_VERTEX_BUFFER_COUNT + 2)
+            expected = 0;
+        else if (m_frame >= RENGINE_OPENGL_VERTEX_BUFFER_COUNT)
+            expected = quadBytes;
+        check_equal(renderer->vertexBytesUploaded(), expected);
+
+        vec4 color = m_frame == 0 ? vec4(0, 1, 0, 1) : colorFor(std::min(m_frame, RENGINE_OPENGL_VERTEX_BUFFER_COUNT + 2));
+        check_pixel(65, 15, color);
+        check_pixel(55, 15, vec4(0, 1, 0, 1));
+        check_pixel(75, 15, vec4(0, 1, 0, 1));
+    }
+
+private:
+    int m_frame;
+    RectangleNode *m_rects[20];
+};
+
+class StateCache : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "StateCache"; }
+    Node *build() override {
+        m_frame = 0;
+        Node *root = Node::create();
+        // Layers of the same size and opacity use identical uniforms
+        for (int i=0; i<3; ++i) {
+            m_layers[i] = OpacityNode::create(0.5);
+            *m_layers[i] << RectangleNode::create(rect2d::fromXywh(10 + i * 20, 10, 10, 10), vec4(1, 0, 0, 1));
+            *root << m_layers[i];
+        }
+        return root;
+    }
+
+    bool nextFrame() override {
+        ++m_frame;
+        if (m_frame > 1)
+            return false;
+        // Changing a single value must still reach the shader
+        m_layers[1]->setOpacity(1.0);
+        return true;
+    }
+
+    void check() override {
+        OpenGLRenderer *renderer = static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer());
+        check_true(renderer->redundantStateChanges() > 0);
+
+        vec4 dimmed(0.5, 0, 0, 1);
+        vec4 middle = m_frame == 0 ? dimmed : vec4(1, 0, 0, 1);
+        check_pixel(15, 15, dimmed);
+        check_pixel(35, 15, middle);
+        check_pixel(55, 15, dimmed);
+    }
+
+private:
+    int m_frame;
+    OpacityNode *m_layers[3];
+};
+
+class BlurDownsampling : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "BlurDownsampling"; }
+    Node *build() override {
+        m_exact = BlurNode::create(48);
+        m_exact->setQuality(BlurNode::HighQuality);
+        m_downsampled = BlurNode::create(48);
+
+        Node *root = Node::create();
+        *root
+            << &(*m_exact << RectangleNode::create(rect2d::fromXywh(100, 100, 60, 60), vec4(1, 1, 1, 1)))
+            << &(*m_downsampled << RectangleNode::create(rect2d::fromXywh(400, 100, 60, 60), vec4(1, 1, 1, 1)));
+        return root;
+    }
+
+    void check() override {
+        check_equal(OpenGLRenderer::blurDownsampling(m_exact), 1u);
+        check_true(OpenGLRenderer::blurDownsampling(m_downsampled) > 1);
+
+        // The downsampled blur should look close to the full resolution one
+        float offsets[] = { 30, 0, -20, -40, 90 };
+        for (float dx : offsets) {
+            for (float dy : offsets) {
+                vec4 exact = pixel(130 + dx, 130 + dy);
+                vec4 downsampled = pixel(430 + dx, 130 + dy);
+                check_true(fuzzy_equals(exact, downsampled, 0.1f));
+            }
+        }
+        // The edge is still soft
+        check_true(pixel(460, 130).x > 0.2 && pixel(460, 130).x < 0.8);
+    }
+
+private:
+    BlurNode *m_exact;
+    BlurNode *m_downsampled;
+};
+
+class ShadowDownsampling : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "ShadowDownsampling"; }
+    Node *build() override {
+        m_shadow = ShadowNode::create(40, vec2(20, 20), vec4(1, 0, 0, 1));
+        // A blur of the shadow's shape in the shadow's color, which is
+        // downsampled by the same factor
+        m_reference = BlurNode::create(40);
+
+        Node *root = Node::create();
+        *root
+            << &(*m_shadow << RectangleNode::create(rect2d::fromXywh(100, 100, 100, 100), vec4(0, 1, 0, 1)))
+            << &(*m_reference << RectangleNode::create(rect2d::fromXywh(420, 120, 100, 100), vec4(1, 0, 0, 1)));
+        return root;
+    }
+
+    void check() override {
+        check_true(OpenGLRenderer::blurDownsampling(m_shadow) > 1);
+        check_equal(OpenGLRenderer::blurDownsampling(m_shadow), OpenGLRenderer::blurDownsampling(m_reference));
+
+        // The content is drawn at full resolution on top of the shadow
+        check_pixel(100, 100, vec4(0, 1, 0, 1));
+        check_pixel(199, 199, vec4(0, 1, 0, 1));
+        check_pixel(90, 150, vec4(0, 0, 0, 1));
+
+        // The shadow's falloff should match the blur's
+        float maxError = 0;
+        for (int i=200; i<270; ++i) {
+            vec4 right = pixel(i, 170);
+            vec4 below = pixel(170, i);
+            check_true(right.y == 0 && right.z == 0);
+            maxError = std::max(maxError, std::abs(right.x - pixel(i + 300, 170).x));
+            maxError = std::max(maxError, std::abs(below.x - pixel(470, i).x));
+        }
+        check_true(maxError < 0.01f);
+    }
+
+private:
+    ShadowNode *m_shadow;
+    BlurNode *m_reference;
+};
+
+class Instancing : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "Instancing"; }
+    Node *build() override {
+        m_frame = 0;
+        renderer()->setInstancingEnabled(true);
+        unsigned red[] = { 0xff0000ff, 0xff0000ff, 0xff0000ff, 0xff0000ff };
+        Texture *redTexture = renderer()->createTextureFromImageData(vec2(2, 2), Texture::RGBA_32, red);
+
+        m_rect = RectangleNode::create(rect2d::fromXywh(10, 10, 20, 20), vec4(0, 1, 0, 1));
+        m_xform = TransformNode::create(mat4::translate2D(260, 50) * mat4::rotate2D(M_PI / 4));
+        m_xform3d = TransformNode::create(mat4::translate2D(400, 50) * mat4::rotateAroundY(0.5));
+        m_xform3d->setProjectionDepth(1000);
+
+        Node *root = Node::create();
+        *root
+            << m_rect
+            << RectangleNode::create(rect2d::fromXywh(30, 10, 20, 20), vec4(0, 0, 1, 0.5))
+            << TextureNode::create(rect2d::fromXywh(50, 10, 20, 20), redTexture)
+            << &(*OpacityNode::create(0.5) << RectangleNode::create(rect2d::fromXywh(70, 10, 20, 20), vec4(1, 1, 1, 1)))
+            << &(*m_xform << RectangleNode::create(rect2d::fromXywh(-20, -20, 40, 40), vec4(1, 1, 0, 1)))
+            << &(*m_xform3d << RectangleNode::create(rect2d::fromXywh(-20, -20, 40, 40), vec4(0, 1, 1, 1)));
+        return root;
+    }
+
+    bool nextFrame() override {
+        switch (++m_frame) {
+        case 1: // A retained update only changes the instance
+            m_rect->setColor(vec4(1, 0, 1, 1));
+            return true;
+        case 2: // Drawing without instancing must give the same result
+            renderer()->setInstancingEnabled(false);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    OpenGLRenderer *renderer() const { return static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer()); }
+
+    bool isInstanced(Node *node) {
+        OpenGLRenderer *renderer = this->renderer();
+        for (unsigned i=0; i<renderer->m_elementCount; ++i)
+            if (renderer->m_elements[i].node == node)
+                return renderer->m_elements[i].instanced;
+        return false;
+    }
+
+    void check() override {
+        bool instanced = m_frame < 2 && renderer()->instancingSupported();
+        check_equal(isInstanced(m_rect), instanced);
+        check_equal(isInstanced(m_xform3d->child()), false);
+
+        // Only the layer and the 3D rectangle upload vertices, the other five
+        // quads upload just their instance.
+        const unsigned quadBytes = 4 * (2 * sizeof(vec2) + sizeof(unsigned));
+        unsigned expected = instanced ? 5 * sizeof(OpenGLRenderer::RectInstance) + 2 * quadBytes : 7 * quadBytes;
+        check_equal(renderer()->vertexBytesUploaded(), expected);
+
+        vec4 color = m_frame == 0 ? vec4(0, 1, 0, 1) : vec4(1, 0, 1, 1);
+        check_pixel(20, 20, color);
+        check_pixel(40, 20, vec4(0, 0, 0.5, 1));
+        check_pixel(60, 20, vec4(1, 0, 0, 1));
+        check_pixel(80, 20, vec4(0.5, 0.5, 0.5, 1));
+        check_pixel(260, 50, vec4(1, 1, 0, 1));
+        check_pixel(260, 70, vec4(1, 1, 0, 1));
+        check_pixel(400, 50, vec4(0, 1, 1, 1));
+
+        // The edges are where the two paths could differ
+        vec2 samples[] = { vec2(10, 10), vec2(29, 29), vec2(260, 22), vec2(231, 50), vec2(288, 50), vec2(260, 78) };
+        const int count = sizeof(samples) / sizeof(vec2);
+        for (int i=0; i<count; ++i) {
+            if (m_frame == 1) {
+                m_pixels[i] = pixel(samples[i].x, samples[i].y);
+            } else if (m_frame == 2) {
+                check_pixel(samples[i].x, samples[i].y, m_pixels[i]);
+            }
+        }
+    }
+
+private:
+    int m_frame;
+    vec4 m_pixels[6];
+    RectangleNode *m_rect;
+    TransformNode *m_xform;
+    TransformNode *m_xform3d;
+};
+
+class ParallelBuild : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "ParallelBuild"; }
+    Node *build() override {
+        m_frame = 0;
+        renderer()->setBuildThreadCount(4);
+
+        // Enough rows for the build to be split over the threads
+        Node *root = Node::create();
+        for (int y=0; y<40; ++y) {
+            TransformNode *row = TransformNode::create(mat4::translate2D(0, y * 10));
+            for (int x=0; x<30; ++x)
+                *row << RectangleNode::create(rect2d::fromXywh(x * 10, 0, 8, 8), vec4(x / 30.0, y / 40.0, 0, 1));
+            *root << row;
+        }
+        *root
+            << &(*OpacityNode::create(0.5) << RectangleNode::create(rect2d::fromXywh(400, 10, 50, 50), vec4(1, 1, 1, 1)))
+            << &(*ClipNode::create(rect2d::fromXywh(400, 100, 20, 20)) << RectangleNode::create(rect2d::fromXywh(390, 90, 50, 50), vec4(0, 0, 1, 1)))
+            // Hides some of the rows above
+            << RectangleNode::create(rect2d::fromXywh(0, 200, 100, 100), vec4(1, 1, 1, 1));
+        return root;
+    }
+
+    bool nextFrame() override {
+        if (++m_frame > 1)
+            return false;
+        // Build the same tree again on the render thread only
+        renderer()->setBuildThreadCount(1);
+        renderer()->m_retainedRoot = 0;
+        return true;
+    }
+
+    OpenGLRenderer *renderer() const { return static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer()); }
+
+    void check() override {
+        OpenGLRenderer *renderer = this->renderer();
+        if (m_frame == 0) {
+            check_equal(renderer->buildThreadCount(), 4u);
+            check_true(renderer->m_subtrees.size() > 1);
+            m_elements.assign(renderer->m_elements, renderer->m_elements + renderer->m_elementCount);
+            m_vertices.assign(renderer->m_vertices, renderer->m_vertices + renderer->m_vertexCount);
+        } else {
+            check_equal(renderer->buildThreadCount(), 1u);
+            check_equal(renderer->m_elementCount, (unsigned) m_elements.size());
+            check_equal(renderer->m_vertexCount, (unsigned) m_vertices.size());
+            for (unsigned i=0; i<m_elements.size(); ++i) {
+                const OpenGLRenderer::Element &e = renderer->m_elements[i];
+                check_true(e.node == m_elements[i].node);
+                check_equal(e.vboOffset, m_elements[i].vboOffset);
+                check_equal(e.groupSize, m_elements[i].groupSize);
+            }
+            for (unsigned i=0; i<m_vertices.size(); ++i)
+                check_true(renderer->m_vertices[i] == m_vertices[i]);
+        }
+
+        check_pixel(5, 5, vec4(0, 0, 0, 1));
+        check_pixel(295, 395, vec4(29 / 30.0, 39 / 40.0, 0, 1));
+        check_pixel(50, 250, vec4(1, 1, 1, 1));
+        check_pixel(425, 35, vec4(0.5, 0.5, 0.5, 1));
+        check_pixel(410, 110, vec4(0, 0, 1, 1));
+        check_pixel(430, 110, vec4(0, 0, 0, 1));
+    }
+
+private:
+    int m_frame;
+    std::vector<OpenGLRenderer::Element> m_elements;
+    std::vector<vec2> m_vertices;
+};
+
+class DepthOrdering : public StaticRenderTest
+{
+public:
+    static mat4 translateZ(float z) {
+        return mat4(1, 0, 0, 0,
+                    0, 1, 0, 0,
+                    0, 0, 1, z,
+                    0, 0, 0, 1);
+    }
+
+    const char *name() const override { return "DepthOrdering"; }
+    Node *build() override {
+        m_frame = 0;
+        m_rect = RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 1, 1, 1));
+        m_back = TransformNode::create(translateZ(0));
+        m_front = TransformNode::create(translateZ(10));
+        m_opacity = OpacityNode::create(0.5);
+        TransformNode *xform3d = TransformNode::create(mat4::translate2D(200, 200));
+        xform3d->setProjectionDepth(1000);
+
+        Node *root = Node::create();
+        *root
+            << m_rect
+            << &(*xform3d
+                 // The layer comes last in the tree, but is in front at first
+                 << &(*m_front << &(*m_opacity << RectangleNode::create(rect2d::fromXywh(0, -50, 100, 100), vec4(0, 1, 0, 1))))
+                 << &(*m_back << RectangleNode::create(rect2d::fromXywh(-50, -50, 100, 100), vec4(1, 0, 0, 1)))
+                );
+        return root;
+    }
+
+    bool nextFrame() override {
+        switch (++m_frame) {
+        case 1: // Moves the red rect in front of the layer
+            m_back->setMatrix(translateZ(20));
+            return true;
+        case 2: // A change outside the 3D subtree keeps the order and the layer
+            renderer()->setLayerCachingEnabled(true);
+            // Poison the sort keys, the kept order should not need them
+            std::fill(renderer()->m_depthKeys.begin(), renderer()->m_depthKeys.end(), ~0u);
+            m_rect->setColor(vec4(0, 0, 1, 1));
+            return true;
+        default:
+            renderer()->setLayerCachingEnabled(false);
+            return false;
+        }
+    }
+
+    OpenGLRenderer *renderer() const { return static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer()); }
+
+    bool isCached(Node *node) {
+        OpenGLRenderer *renderer = this->renderer();
+        for (unsigned i=0; i<renderer->m_elementCount; ++i)
+            if (renderer->m_elements[i].node == node)
+                return renderer->m_elements[i].cached;
+        return false;
+    }
+
+    void check() override {
+        OpenGLRenderer *renderer = this->renderer();
+
+        // 3D subtrees no longer prevent reusing the elements
+        check_true(renderer->m_retainedRoot != 0);
+        check_equal(renderer->m_depthOrders.size(), 1u);
+        check_equal(renderer->m_depthOrders[0].order.size(), 2u);
+        if (m_frame == 2) {
+            check_true(isCached(m_opacity));
+            check_true(renderer->m_depthOrders[0].order == m_order);
+            check_true(std::all_of(renderer->m_depthKeys.begin(), renderer->m_depthKeys.end(), [](unsigned k) { return k == ~0u; }));
+        }
+        m_order = renderer->m_depthOrders[0].order;
+
+        vec4 rectColor = m_frame < 2 ? vec4(1, 1, 1, 1) : vec4(0, 0, 1, 1);
+        vec4 overlapColor = m_frame == 0 ? vec4(0.5, 0.5, 0, 1) : vec4(1, 0, 0, 1);
+        check_pixel(15, 15, rectColor);
+        check_pixel(175, 200, vec4(1, 0, 0, 1));
+        check_pixel(275, 200, vec4(0, 0.5, 0, 1));
+        check_pixel(225, 200, overlapColor);
+    }
+
+private:
+    int m_frame;
+    std::vector<unsigned> m_order;
+    RectangleNode *m_rect;
+    TransformNode *m_back;
+    TransformNode *m_front;
+    OpacityNode *m_opacity;
+};
+
+class AsyncReadback : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "AsyncReadback"; }
+    Node *build() override {
+        m_frame = 0;
+        m_rect = RectangleNode::create(rect2d::fromXywh(10, 10, 20, 20), vec4(1, 0, 0, 1));
+        Node *root = Node::create();
+        *root
+            << m_rect
+            << RectangleNode::create(rect2d::fromXywh(10, 30, 20, 20), vec4(0, 1, 0, 1));
+        return root;
+    }
+
+    bool nextFrame() override {
+        if (++m_frame > 2)
+            return false;
+        m_rect->setColor(m_frame == 1 ? vec4(0, 0, 1, 1) : vec4(1, 0, 1, 1));
+        return true;
+    }
+
+    OpenGLRenderer *renderer() const { return static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer()); }
+
+    void check() override {
+        if (m_frame == 0) {
+            // Start reading back this frame, the whole surface and the bottom
+            // part of the rects, from GL's bottom left origin
+            m_expected.assign(m_pixels, m_pixels + m_w * m_h);
+            m_full = renderer()->readPixelsAsync(0, 0, m_w, m_h);
+            m_part = renderer()->readPixelsAsync(10, m_h - 50, 20, 40);
+            if (renderer()->readbackSupported()) {
+                check_true(m_full.wait_for(std::chrono::seconds(0)) == std::future_status::timeout);
+            }
+            check_pixel(15, 15, vec4(1, 0, 0, 1));
+            return;
+        }
+
+        if (m_frame == 1) {
+            // The readbacks are only mapped once this frame has been
+            // submitted and swapped, so they don't stall it
+            check_pixel(15, 15, vec4(0, 0, 1, 1));
+            if (renderer()->readbackSupported()) {
+                check_true(m_full.wait_for(std::chrono::seconds(0)) == std::future_status::timeout);
+                check_true(m_part.wait_for(std::chrono::seconds(0)) == std::future_status::timeout);
+            }
+            return;
+        }
+
+        // The readbacks hold the first frame, top row first
+        check_pixel(15, 15, vec4(1, 0, 1, 1));
+        check_true(m_full.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+        check_true(m_part.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+        std::vector<unsigned> full = m_full.get();
+        std::vector<unsigned> part = m_part.get();
+        check_true(full == m_expected);
+        check_equal(part.size(), 20u * 40u);
+        for (int y=0; y<40; ++y)
+            for (int x=0; x<20; ++x)
+                check_equal(part[y * 20 + x], m_expected[(y + 10) * m_w + x + 10]);
+        check_equal_hex(part[0], 0xff0000ffu);
+        check_equal_hex(part[39 * 20], 0xff00ff00u);
+    }
+
+private:
+    int m_frame;
+    RectangleNode *m_rect;
+    std::vector<unsigned> m_expected;
+    std::future<std::vector<unsigned>> m_full;
+    std::future<std::vector<unsigned>> m_part;
+};
+
+class GpuTiming : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "GpuTiming"; }
+    Node *build() override {
+        m_frame = 0;
+        m_blur = BlurNode::create(5);
+        m_opacity = OpacityNode::create(0.5);
+        m_rect = RectangleNode::create(rect2d::fromXywh(10, 10, 20, 20), vec4(1, 0, 0, 1));
+        renderer()->setGpuTimingEnabled(true);
+
+        Node *root = Node::create();
+        *root
+            << m_rect
+            << &(*m_opacity
+                 << &(*m_blur << RectangleNode::create(rect2d::fromXywh(50, 50, 40, 40), vec4(1, 1, 1, 1))));
+        return root;
+    }
+
+    OpenGLRenderer *renderer() const { return static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer()); }
+
+    bool nextFrame() override {
+        // Keep changing the layers so they are rendered every frame, until
+        // the timer queries of the first frame have been collected
+        const Renderer::GpuTimes &times = renderer()->gpuTimes();
+        if (!renderer()->gpuTimingSupported() || times.frame > 0 || ++m_frame > 20) {
+            renderer()->setGpuTimingEnabled(false);
+            return false;
+        }
+        m_blur->setRadius(5 + m_frame % 2);
+        return true;
+    }
+
+    void check() override {
+        const Renderer::GpuTimes &times = renderer()->gpuTimes();
+        check_pixel(15, 15, vec4(1, 0, 0, 1));
+        check_true(renderer()->m_gpuTimers.size() <= RENGINE_OPENGL_GPU_TIMER_FRAMES);
+        if (times.frame == 0)
+            return;
+
+        // The results come from an earlier frame
+        check_true(times.frame <= renderer()->m_gpuFrame);
+        check_true(times.total > 0);
+        check_true(times.mainPass >= 0 && times.layers >= 0 && times.blur >= 0);
+        check_true(fuzzy_equals(times.mainPass + times.layers + times.blur, times.total, 0.001f));
+        check_equal(times.layerTimes.size(), 2u);
+        check_true(times.layerTimes[0].node == m_opacity);
+        check_true(times.layerTimes[1].node == m_blur);
+        // The opacity layer contains the blur layer
+        check_true(times.layerTimes[0].content >= times.layerTimes[1].content + times.layerTimes[1].blur);
+    }
+
+private:
+    int m_frame;
+    RectangleNode *m_rect;
+    OpacityNode *m_opacity;
+    BlurNode *m_blur;
+};
+
+class RenderStatistics : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "RenderStatistics"; }
+    Node *build() override {
+        m_frame = 0;
+        Node *root = Node::create();
+        for (int i=0; i<3; ++i)
+            *root << RectangleNode::create(rect2d::fromXywh(10 + i * 20, 10, 10, 10), vec4(0, 0, 1, 1));
+        *root << &(*OpacityNode::create(0.5) << RectangleNode::create(rect2d::fromXywh(10, 30, 10, 10), vec4(1, 0, 0, 1)));
+        return root;
+    }
+
+    OpenGLRenderer *renderer() const { return static_cast<OpenGLRenderer *>(static_cast<StandardSurface *>(surface())->renderer()); }
+
+    bool nextFrame() override {
+        // The second frame has no changes
+        return ++m_frame <= 1;
+    }
+
+    void check() override {
+        const Renderer::RenderStats &stats = renderer()->stats();
+        check_true(stats.frame > 0);
+        if (m_frame == 0)
+            m_firstFrame = stats.frame;
+        check_equal(stats.frame, m_firstFrame + m_frame);
+
+        // The render list is kept, so the nodes are the same in both frames
+        check_equal(stats.rectangleNodes, 4u);
+        check_equal(stats.textureNodes, 0u);
+        check_equal(stats.layeredNodes, 1u);
+        check_equal(stats.occludedNodes, 0u);
+        check_true(stats.layerTextures > 0);
+        check_true(stats.layerTextureBytes >= 10 * 10 * 4);
+        check_equal(stats.vertexBytesUploaded, renderer()->vertexBytesUploaded());
+        check_equal(stats.redundantStateChanges, renderer()->redundantStateChanges());
+        check_true(stats.prepassTime >= 0 && stats.buildTime >= 0 && stats.renderTime >= 0);
+
+        if (m_frame == 0) {
+            // One batch for the three rectangles, one for the layer's content
+            // and one for the layer itself, which is rendered into its own
+            // framebuffer object and back.
+            check_true(stats.fullRebuild);
+            check_equal(stats.drawCalls, 3u);
+            check_equal(stats.framebufferSwitches, 2u);
+            check_true(stats.shaderSwitches >= 2);
+            check_true(stats.textureBinds >= 1);
+            check_true(stats.vertexBytesUploaded > 0);
+        } else {
+            // Nothing is uploaded, but the layer is not cached by default
+            check_true(!stats.fullRebuild);
+            check_equal(stats.prepassTime, 0.0);
+            check_equal(stats.drawCalls, 3u);
+            check_equal(stats.framebufferSwitches, 2u);
+            check_equal(stats.vertexBytesUploaded, 0u);
+        }
+
+        check_pixel(15, 15, vec4(0, 0, 1, 1));
+        check_pixel(55, 15, vec4(0, 0, 1, 1));
+        check_pixel(15, 35, vec4(0.5, 0, 0, 1));
+    }
+
+private:
+    int m_frame;
+    unsigned m_firstFrame;
+};
+
 int main(int argc, char *argv[])
 {
     RENGINE_BACKEND backend;
@@ -218,6 +1427,26 @@ int main(int argc, char *argv[])
     testBase.addTest(new ColorsAndPositions());
     testBase.addTest(new TexturesOnViewportEdge());
     testBase.addTest(new OpacityTextures());
+    testBase.addTest(new Batching());
+    testBase.addTest(new AtlasCompaction());
+    testBase.addTest(new RetainedUpdates());
+    testBase.addTest(new LayerCaching());
+    testBase.addTest(new LayerTexturePool());
+    testBase.addTest(new DamageTracking());
+    testBase.addTest(new OpaquePass());
+    testBase.addTest(new OcclusionCulling());
+    testBase.addTest(new ViewportCulling());
+    testBase.addTest(new Clipping());
+    testBase.addTest(new VertexStreaming());
+    testBase.addTest(new StateCache());
+    testBase.addTest(new BlurDownsampling());
+    testBase.addTest(new ShadowDownsampling());
+    testBase.addTest(new Instancing());
+    testBase.addTest(new ParallelBuild());
+    testBase.addTest(new DepthOrdering());
+    testBase.addTest(new AsyncReadback());
+    testBase.addTest(new GpuTiming());
+    testBase.addTest(new RenderStatistics());
     testBase.show();
 
     backend.run();
@@ -0,0 +1,381 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "test.h"
+
+#include <cstring>
+
+static SoftwareRenderer *renderer = 0;
+
+static mat4 translateZ(float z)
+{
+    return mat4(1, 0, 0, 0,
+                0, 1, 0, 0,
+                0, 0, 1, z,
+                0, 0, 0, 1);
+}
+
+class ColorsAndBlending : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "ColorsAndBlending"; }
+    Node *build() override {
+        Node *root = Node::create();
+        *root
+            << RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1))
+            << RectangleNode::create(rect2d::fromXywh(30, 10, 10, 10), vec4(0, 1, 0, 0.5))
+            << RectangleNode::create(rect2d::fromXywh(50, 10, 10, 10), vec4(1, 1, 1, 1))
+            << RectangleNode::create(rect2d::fromXywh(50, 10, 10, 10), vec4(0, 0, 1, 0.25))
+            // Rects sharing an edge don't overlap
+            << RectangleNode::create(rect2d::fromXywh(70.5, 10, 10, 10), vec4(1, 1, 1, 0.5))
+            << RectangleNode::create(rect2d::fromXywh(80.5, 10, 10, 10), vec4(1, 1, 1, 0.5));
+        return root;
+    }
+
+    void check() override {
+        vec4 black(0, 0, 0, 1);
+        vec4 gray(0.5, 0.5, 0.5, 1);
+        check_pixel( 9,  9, black);
+        check_pixel(10, 10, vec4(1, 0, 0, 1));
+        check_pixel(19, 19, vec4(1, 0, 0, 1));
+        check_pixel(20, 20, black);
+        check_pixel(35, 15, vec4(0, 0.5, 0, 1));
+        check_pixel(55, 15, vec4(0.75, 0.75, 1, 1));
+        check_pixel(69, 15, black);
+        check_pixel(70, 15, gray);
+        check_pixel(80, 15, gray);
+        check_pixel(89, 15, gray);
+        check_pixel(90, 15, black);
+    }
+};
+
+class Textures : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "Textures"; }
+    Node *build() override {
+        // Blue and green on the top row, red and transparent on the bottom
+        unsigned rgba[] = { 0xffff0000, 0xff00ff00, 0xff0000ff, 0x00000000 };
+        unsigned bgra[] = { 0xff0000ff, 0xff00ff00, 0xffff0000, 0x00000000 };
+        m_rgba = renderer->createTextureFromImageData(vec2(2, 2), Texture::RGBA_32, rgba);
+        m_bgra = renderer->createTextureFromImageData(vec2(2, 2), Texture::BGRA_32, bgra);
+        m_rgbx = renderer->createTextureFromImageData(vec2(2, 2), Texture::RGBx_32, rgba);
+
+        Node *root = Node::create();
+        *root
+            << RectangleNode::create(rect2d::fromXywh(0, 0, 140, 40), vec4(1, 1, 1, 1))
+            << TextureNode::create(rect2d::fromXywh(10, 10, 20, 20), m_rgba)
+            << TextureNode::create(rect2d::fromXywh(40, 10, 20, 20), m_bgra)
+            << TextureNode::create(rect2d::fromXywh(70, 10, 20, 20), m_rgbx)
+            << &(*TransformNode::create(mat4::translate2D(120, 20) * mat4::rotate2D(M_PI / 2))
+                 << TextureNode::create(rect2d::fromXywh(-10, -10, 20, 20), m_rgba));
+        return root;
+    }
+
+    void check() override {
+        vec4 red(1, 0, 0, 1);
+        vec4 green(0, 1, 0, 1);
+        vec4 blue(0, 0, 1, 1);
+        vec4 black(0, 0, 0, 1);
+        vec4 white(1, 1, 1, 1);
+        check_pixel(11, 11, blue);
+        check_pixel(28, 11, green);
+        check_pixel(11, 28, red);
+        check_pixel(28, 28, white);
+        // Linear filtering between the texels, 0.55 of the way from blue to green
+        check_true(fuzzy_equals(pixel(20, 10), vec4(0, 0.55, 0.45, 1), 0.01f));
+        check_pixel(41, 11, blue);
+        check_pixel(58, 11, green);
+        check_pixel(41, 28, red);
+        check_pixel(58, 28, white);
+        // No alpha, so the transparent texel is black
+        check_pixel(88, 28, black);
+
+        // Rotated 90 degrees clockwise, so the top left is on the top right
+        check_pixel(128, 11, blue);
+        check_pixel(128, 28, green);
+        check_pixel(111, 11, red);
+
+        delete m_rgba;
+        delete m_bgra;
+        delete m_rgbx;
+    }
+
+private:
+    Texture *m_rgba;
+    Texture *m_bgra;
+    Texture *m_rgbx;
+};
+
+class Layers : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "Layers"; }
+    Node *build() override {
+        ColorFilterNode *swap = ColorFilterNode::create();
+        swap->setColorMatrix(mat4(0, 1, 0, 0,
+                                  1, 0, 0, 0,
+                                  0, 0, 1, 0,
+                                  0, 0, 0, 1));
+
+        Node *root = Node::create();
+        *root
+            << &(*OpacityNode::create(0.5)
+                 << RectangleNode::create(rect2d::fromXywh(10, 10, 20, 20), vec4(1, 0, 0, 1))
+                 << RectangleNode::create(rect2d::fromXywh(20, 20, 20, 20), vec4(0, 0, 1, 1))
+                )
+            << &(*swap << RectangleNode::create(rect2d::fromXywh(50, 10, 20, 20), vec4(1, 0, 0, 1)))
+            << &(*OpacityNode::create(0.5)
+                 << &(*OpacityNode::create(0.5) << RectangleNode::create(rect2d::fromXywh(80, 10, 20, 20), vec4(1, 1, 1, 1))));
+        return root;
+    }
+
+    void check() override {
+        check_pixel(15, 15, vec4(0.5, 0, 0, 1));
+        // Only the top rect shows where they overlap
+        check_pixel(25, 25, vec4(0, 0, 0.5, 1));
+        check_pixel(35, 35, vec4(0, 0, 0.5, 1));
+        check_pixel(60, 20, vec4(0, 1, 0, 1));
+        check_pixel(90, 20, vec4(0.25, 0.25, 0.25, 1));
+    }
+};
+
+class BlurAndShadow : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "BlurAndShadow"; }
+    Node *build() override {
+        Node *root = Node::create();
+        *root
+            << &(*BlurNode::create(5) << RectangleNode::create(rect2d::fromXywh(20, 20, 40, 40), vec4(1, 1, 1, 1)))
+            << &(*ShadowNode::create(0, vec2(10, 10), vec4(0, 0, 1, 1))
+                 << RectangleNode::create(rect2d::fromXywh(100, 20, 40, 40), vec4(0, 1, 0, 1)))
+            << &(*ShadowNode::create(5, vec2(5, 5), vec4(0, 0, 1, 1))
+                 << RectangleNode::create(rect2d::fromXywh(200, 20, 40, 40), vec4(1, 0, 0, 1)));
+        return root;
+    }
+
+    void check() override {
+        vec4 black(0, 0, 0, 1);
+        vec4 white(1, 1, 1, 1);
+
+        check_pixel(40, 40, white);
+        check_pixel(10, 40, black);
+        // The edge is halfway between the two pixels
+        check_true(fuzzy_equals(pixel(19, 40).x + pixel(20, 40).x, 1.0f, 0.02f));
+        check_true(pixel(18, 40).x > 0.05 && pixel(18, 40).x < 0.5);
+        check_true(pixel(22, 40).x > 0.5 && pixel(22, 40).x < 0.95);
+        check_pixel(40, 19, pixel(40, 60));
+
+        check_pixel(120, 40, vec4(0, 1, 0, 1));
+        check_pixel(145, 45, vec4(0, 0, 1, 1));
+        check_pixel(115, 65, vec4(0, 0, 1, 1));
+        check_pixel(105, 65, black);
+        check_pixel(150, 45, black);
+
+        check_pixel(220, 40, vec4(1, 0, 0, 1));
+        vec4 shadow = pixel(242, 40);
+        check_true(shadow.x == 0 && shadow.y == 0 && shadow.z > 0.5 && shadow.z < 1);
+        check_pixel(225, 76, black);
+    }
+};
+
+class Projection : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "Projection"; }
+    Node *build() override {
+        m_frame = 0;
+        m_back = TransformNode::create(translateZ(0));
+        m_front = TransformNode::create(translateZ(10));
+        TransformNode *xform3d = TransformNode::create(mat4::translate2D(100, 100), 1000);
+        m_rotation = TransformNode::create(mat4());
+
+        Node *root = Node::create();
+        *root
+            << &(*xform3d
+                 << &(*m_front << &(*OpacityNode::create(0.5) << RectangleNode::create(rect2d::fromXywh(0, -50, 100, 100), vec4(0, 1, 0, 1))))
+                 << &(*m_back << RectangleNode::create(rect2d::fromXywh(-50, -50, 100, 100), vec4(1, 0, 0, 1)))
+                )
+            << &(*TransformNode::create(mat4::translate2D(300, 100), 1000)
+                 << &(*m_rotation << RectangleNode::create(rect2d::fromXywh(-50, -50, 100, 100), vec4(1, 1, 1, 1))));
+        return root;
+    }
+
+    bool nextFrame() override {
+        if (++m_frame > 1)
+            return false;
+        m_back->setMatrix(translateZ(20));
+        m_rotation->setMatrix(mat4::rotateAroundY(M_PI / 3));
+        return true;
+    }
+
+    void check() override {
+        vec4 red(1, 0, 0, 1);
+        vec4 white(1, 1, 1, 1);
+        vec4 black(0, 0, 0, 1);
+        if (m_frame == 0) {
+            check_pixel(125, 100, vec4(0.5, 0.5, 0, 1));
+            check_pixel(260, 100, white);
+            check_pixel(340, 100, white);
+        } else {
+            check_pixel(125, 100, red);
+            // Rotated half way around the y axis, the rect is narrower
+            check_pixel(300, 100, white);
+            check_pixel(260, 100, black);
+            check_pixel(340, 100, black);
+        }
+    }
+
+private:
+    int m_frame;
+    TransformNode *m_back;
+    TransformNode *m_front;
+    TransformNode *m_rotation;
+};
+
+class Clipping : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "Clipping"; }
+    Node *build() override {
+        TransformNode *projection = TransformNode::create(mat4::translate2D(270, 150));
+        projection->setProjectionDepth(1000);
+
+        Node *root = Node::create();
+        *root
+            << &(*ClipNode::create(rect2d::fromXywh(10, 10, 50, 50))
+                 << RectangleNode::create(rect2d::fromXywh(0, 0, 100, 100), vec4(1, 0, 0, 1))
+                )
+            << &(*TransformNode::create(mat4::translate2D(200, 60) * mat4::rotate2D(M_PI / 4))
+                 << &(*ClipNode::create(rect2d::fromXywh(-30, -30, 60, 60))
+                      << RectangleNode::create(rect2d::fromXywh(-50, -50, 100, 100), vec4(0, 1, 0, 1))
+                     )
+                )
+            << &(*OpacityNode::create(0.5)
+                 << &(*TransformNode::create(mat4::translate2D(350, 60) * mat4::rotate2D(M_PI / 4))
+                      << &(*ClipNode::create(rect2d::fromXywh(-30, -30, 60, 60))
+                           << RectangleNode::create(rect2d::fromXywh(-50, -50, 100, 100), vec4(1, 1, 1, 1))
+                          )
+                     )
+                )
+            << &(*projection
+                 << &(*TransformNode::create(mat4::rotateAroundY(M_PI / 3))
+                      << &(*ClipNode::create(rect2d::fromXywh(-30, -30, 60, 60))
+                           << RectangleNode::create(rect2d::fromXywh(-50, -50, 100, 100), vec4(0, 0, 1, 1))
+                          )
+                     )
+                );
+        return root;
+    }
+
+    void check() override {
+        vec4 black(0, 0, 0, 1);
+        vec4 gray(0.5, 0.5, 0.5, 1);
+
+        check_pixel( 5,  5, black);
+        check_pixel(10, 10, vec4(1, 0, 0, 1));
+        check_pixel(59, 59, vec4(1, 0, 0, 1));
+        check_pixel(60, 30, black);
+
+        check_pixel(200, 60, vec4(0, 1, 0, 1));
+        check_pixel(235, 60, vec4(0, 1, 0, 1));
+        check_pixel(225, 35, black);
+
+        check_pixel(350, 60, gray);
+        check_pixel(385, 60, gray);
+        check_pixel(375, 35, black);
+
+        check_pixel(270, 150, vec4(0, 0, 1, 1));
+        check_pixel(270, 170, vec4(0, 0, 1, 1));
+        check_pixel(280, 150, black);
+        check_pixel(270, 190, black);
+    }
+};
+
+// Renders a busy scene on one thread and on several, which must give the
+// same pixels.
+class Threading : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "Threading"; }
+    Node *build() override {
+        Node *root = Node::create();
+        for (int i=0; i<50; ++i) {
+            float f = i / 50.0f;
+            *root << &(*TransformNode::create(mat4::translate2D(20 + i * 7, 20 + (i % 7) * 20) * mat4::rotate2D(f * 3))
+                       << RectangleNode::create(rect2d::fromXywh(-15, -15, 30, 30), vec4(f, 1 - f, 0.5, 0.7)));
+        }
+        *root << &(*BlurNode::create(3) << RectangleNode::create(rect2d::fromXywh(100, 100, 100, 50), vec4(1, 1, 1, 0.5)));
+        return root;
+    }
+
+    void check() override {
+        vector<unsigned> threaded(m_pixels, m_pixels + m_w * m_h);
+        unsigned threads = renderer->threadCount();
+        renderer->setThreadCount(1);
+        renderer->render();
+        renderer->setThreadCount(threads);
+        check_true(memcmp(threaded.data(), renderer->pixels(), threaded.size() * sizeof(unsigned)) == 0);
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    SoftwareRenderer softwareRenderer;
+    softwareRenderer.setSize(vec2(400, 200));
+    softwareRenderer.setThreadCount(4);
+    softwareRenderer.initialize();
+    renderer = &softwareRenderer;
+
+    StaticRenderTest *tests[] = {
+        new ColorsAndBlending(),
+        new Textures(),
+        new Layers(),
+        new BlurAndShadow(),
+        new Projection(),
+        new Clipping(),
+        new Threading()
+    };
+
+    vec2 size = renderer->size();
+    vector<unsigned> pixels(size.x * size.y);
+    for (StaticRenderTest *test : tests) {
+        test->setSurface(0);
+        Node *root = test->build();
+        renderer->setSceneRoot(root);
+        do {
+            bool ok = renderer->render() && renderer->readPixels(0, 0, size.x, size.y, pixels.data());
+            check_true(ok);
+            test->setPixels(size.x, size.y, pixels.data());
+            test->check();
+            cout << "tst_" << test->name() << ": ok" << endl;
+        } while (test->nextFrame());
+        renderer->setSceneRoot(0);
+        root->destroy();
+    }
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "test.h"
+
+static std::thread::id mainThread;
+
+// Every task runs exactly once, also when there are fewer tasks than threads
+void tst_threadpool_runAll()
+{
+    ThreadPool pool(4);
+    check_equal(pool.threadCount(), 4u);
+
+    unsigned counts[] = { 0, 1, 3, 4, 5, 1000 };
+    for (unsigned count : counts) {
+        std::vector<std::atomic<int>> runs(count);
+        for (auto &r : runs)
+            r = 0;
+        pool.run(count, [&runs] (unsigned i) { ++runs[i]; });
+        for (auto &r : runs)
+            check_equal(r.load(), 1);
+    }
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+// Tasks of uneven cost are stolen by the threads which are done with their
+// own, so a single slow range doesn't hold up the whole batch on one thread.
+void tst_threadpool_stealing()
+{
+    ThreadPool pool(4);
+
+    const unsigned count = 64;
+    std::vector<std::thread::id> threads(count);
+    pool.run(count, [&threads] (unsigned i) {
+        // The first thread's range is the slow one
+        if (i < count / 4)
+            this_thread::sleep_for(std::chrono::milliseconds(5));
+        threads[i] = this_thread::get_id();
+    });
+
+    unsigned others = 0;
+    for (unsigned i=0; i<count / 4; ++i)
+        others += threads[i] != threads[0];
+    check_true(others > 0);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+// A pool with a single thread runs everything on the calling thread, in order
+void tst_threadpool_singleThread()
+{
+    ThreadPool pool(1);
+    check_equal(pool.threadCount(), 1u);
+
+    std::vector<unsigned> order;
+    pool.run(10, [&order] (unsigned i) {
+        check_true(this_thread::get_id() == mainThread);
+        order.push_back(i);
+    });
+    check_equal(order.size(), 10u);
+    for (unsigned i=0; i<order.size(); ++i)
+        check_equal(order[i], i);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    mainThread = this_thread::get_id();
+
+    tst_threadpool_runAll();
+    tst_threadpool_stealing();
+    tst_threadpool_singleThread();
+
+    return 0;
+}